@@ -0,0 +1,215 @@
+/*
+ * bench_parser.cpp
+ *
+ * bench_parser modelDescription.xml [runs] [threads]
+ * Times parse() and freeElement() of the given file, with the size of the AST
+ * and of the text it points into when parsed in place, parseParallel() on the
+ * given number of threads (default one per processor), a parse filtered to
+ * the inputs and outputs, the lookup of every variable by name and by value
+ * reference, the selection of the variables under a component with the
+ * name trie against a scan of all names, and the lookup of the names of the
+ * parser vocabularies by perfect hash against a linear search.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xml_parser.hpp>
+#include <name_hash.hpp>
+#include <name_trie.hpp>
+
+#define LOOKUP_ROUNDS 200000
+#define PREFIX_QUERIES 100
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static long fileSize(const char* path) {
+	long size = -1;
+	FILE* file = fopen(path, "rb");
+	if (file) {
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fclose(file);
+	}
+	return size;
+}
+
+static int linearLookup(const char* const names[], int n, const char* name) {
+	int i;
+	for (i = 0; i < n; i++)
+		if (!strcmp(name, names[i]))
+			return i;
+	return -1;
+}
+
+// same table as in the parser, computed at start up here
+static const NameHash<128> attHash = makeNameHash<128>(attNames, SIZEOF_ATT);
+
+// Returns the ns per lookup of every attribute name
+static double benchLookup(int hashed, int* checksum) {
+	double start = now();
+	int r, i;
+	for (r = 0; r < LOOKUP_ROUNDS; r++)
+		for (i = 0; i < SIZEOF_ATT; i++)
+			*checksum += hashed ?
+					lookupName(attHash, attNames, attNames[i]) :
+					linearLookup(attNames, SIZEOF_ATT, attNames[i]);
+	return 1e9 * (now() - start) / LOOKUP_ROUNDS / SIZEOF_ATT;
+}
+
+// Returns the ns per getString of every attribute of every variable
+static double benchGetString(ModelDescription* md, int* checksum) {
+	double start = now();
+	long n = 0;
+	int i, a;
+	for (i = 0; md->modelVariables && md->modelVariables[i]; i++)
+		for (a = 0; a < SIZEOF_ATT; a++, n++)
+			*checksum += getString(md->modelVariables[i], (Att) a) != NULL;
+	return n ? 1e9 * (now() - start) / n : 0;
+}
+
+// Returns the names of the n variables of md, rebuilt from the name trie,
+// NULL to indicate failure. The receiver must call freeNames() to release them.
+static char** newNames(ModelDescription* md, int n) {
+	char** names = (char**) calloc(n + 1, sizeof(char*));
+	int i;
+	for (i = 0; names && i < n; i++)
+		if (!(names[i] = newVariableName(md, i)))
+			return NULL; // leaks the names so far, the bench exits anyway
+	return names;
+}
+
+static void freeNames(char** names) {
+	int i;
+	for (i = 0; names && names[i]; i++)
+		free(names[i]);
+	free(names);
+}
+
+// Returns the ns per lookup of every variable by name and by vr in ns[2]
+static void benchVariables(ModelDescription* md, double ns[2], int* checksum) {
+	ScalarVariable** vars = md->modelVariables;
+	char** names = newNames(md, md->table->n);
+	double start = now();
+	int i;
+	for (i = 0; names && names[i]; i++)
+		*checksum += getVariableByName(md, names[i]) == vars[i];
+	ns[0] += i ? 1e9 * (now() - start) / i : 0;
+	freeNames(names);
+	start = now();
+	for (i = 0; vars && vars[i]; i++)
+		*checksum += getVariable(md, vars[i]->info.vr, vars[i]->info.baseType)
+				!= NULL;
+	ns[1] += i ? 1e9 * (now() - start) / i : 0;
+}
+
+// Time the selection of the variables under the parent component of
+// PREFIX_QUERIES variables, in us per query, by trie and by a linear scan
+static void benchPrefix(ModelDescription* md, double us[2], int* checksum) {
+	const int* positions;
+	char prefix[256];
+	double start;
+	int n = md->table->n, q, i, k;
+	char** names = newNames(md, n);
+	if (!names)
+		return;
+	for (k = 0; k < 2; k++) {
+		start = now();
+		for (q = 0; q < PREFIX_QUERIES && n; q++) {
+			const char* name = names[(long) q * n / PREFIX_QUERIES];
+			const char* dot = strrchr(name, '.');
+			int len = dot ? dot - name + 1 : 0;
+			if (len >= (int) sizeof(prefix))
+				len = 0;
+			memcpy(prefix, name, len);
+			prefix[len] = '\0';
+			if (k == 0)
+				*checksum += findByPrefix(md, prefix, &positions);
+			else
+				for (i = 0; i < n; i++)
+					*checksum += !strncmp(names[i], prefix, len);
+		}
+		us[k] += q ? 1e6 * (now() - start) / q : 0;
+	}
+	freeNames(names);
+}
+
+// Returns the number of variables of md
+static int countVariables(ModelDescription* md) {
+	int n = 0;
+	while (md->modelVariables && md->modelVariables[n])
+		n++;
+	return n;
+}
+
+int main(int argc, char* argv[]) {
+	static const VarFilter io = { 1 << enu_input | 1 << enu_output, 0, NULL, 1 };
+	ModelDescription* md;
+	double parseTime = 0, freeTime = 0, getTime = 0, filterTime = 0, start;
+	double parallelTime = 0;
+	size_t footprint = 0, filterFootprint = 0, text = 0;
+	int vars = 0, filterVars = 0;
+	double varTime[2] = { 0, 0 };
+	double prefixTime[2] = { 0, 0 };
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+	int threads = argc > 3 ? atoi(argv[3]) : 0;
+	int checksum = 0, i;
+	long size;
+	if (argc < 2 || runs < 1) {
+		printf("usage: %s modelDescription.xml [runs] [threads]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	size = fileSize(argv[1]);
+	for (i = 0; i < runs; i++) {
+		start = now();
+		md = parse(argv[1]);
+		parseTime += now() - start;
+		if (!md)
+			return EXIT_FAILURE;
+		getTime += benchGetString(md, &checksum);
+		benchVariables(md, varTime, &checksum);
+		benchPrefix(md, prefixTime, &checksum);
+		footprint = md->arena->footprint;
+		text = md->arena->bufferSize;
+		vars = countVariables(md);
+		start = now();
+		freeElement(md);
+		freeTime += now() - start;
+		start = now();
+		md = parseParallel(argv[1], threads);
+		parallelTime += now() - start;
+		if (!md)
+			return EXIT_FAILURE;
+		freeElement(md);
+		start = now();
+		md = parseFiltered(argv[1], &io);
+		filterTime += now() - start;
+		if (!md)
+			return EXIT_FAILURE;
+		filterFootprint = md->arena->footprint;
+		filterVars = countVariables(md);
+		freeElement(md);
+	}
+	printf("parse     %10.3f ms  %8.1f MB/s\n", 1e3 * parseTime / runs,
+			size / 1e6 / (parseTime / runs));
+	printf("parallel  %10.3f ms  %8.1f MB/s\n", 1e3 * parallelTime / runs,
+			size / 1e6 / (parallelTime / runs));
+	printf("free      %10.3f ms\n", 1e3 * freeTime / runs);
+	printf("AST       %10.1f KB  %8d variables, %.1f KB text in place\n",
+			footprint / 1e3, vars, text / 1e3);
+	printf("parse io  %10.3f ms  %8.1f KB AST, %d variables\n",
+			1e3 * filterTime / runs, filterFootprint / 1e3, filterVars);
+	printf("getString %10.1f ns\n", getTime / runs);
+	printf("variable  %10.1f ns by name, %.1f ns by vr\n", varTime[0] / runs,
+			varTime[1] / runs);
+	printf("prefix    %10.1f us trie, %.1f us linear\n", prefixTime[0] / runs,
+			prefixTime[1] / runs);
+	printf("lookup    %10.1f ns hashed, %.1f ns linear\n",
+			benchLookup(1, &checksum), benchLookup(0, &checksum));
+	return checksum == -1; // keep the loops
+}
@@ -0,0 +1,178 @@
+/*
+ * bench_sweep.cpp
+ *
+ * bench_sweep [variables...]
+ * Generates a model description of each size, default 1k, 10k, 100k and 1M
+ * variables, and reports for it:
+ * - parse time, throughput in MB/s and in variables/s
+ * - size of the AST and the growth of the peak RSS while parsing
+ * - latency of the lookup of a variable by name and by value reference
+ * - time per row to select the non-alias variables, as outputRow() did by
+ *   visiting every variable, and with selectVariables()
+ * Each size is parsed in a child process of its own, so that the peak RSS
+ * belongs to that size only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <xml_parser.hpp>
+#include <name_trie.hpp>
+#include <model_gen.hpp>
+
+#define LOOKUPS 100000 // per size, at random
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Returns the current resident set size in KB
+static long residentKB() {
+	long pages = 0, resident = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file) {
+		if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(file);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Returns the ns per lookup of LOOKUPS variables drawn at random,
+// by name if byName, else by value reference
+static double benchLookup(ModelDescription* md, int n, int byName,
+		int* checksum) {
+	ScalarVariable** vars = md->modelVariables;
+	int* drawn = (int*) malloc(LOOKUPS * sizeof(int));
+	char** names = (char**) calloc(LOOKUPS, sizeof(char*));
+	unsigned state = 12345;
+	double start, ns = 0;
+	int k;
+	for (k = 0; drawn && names && k < LOOKUPS; k++) {
+		state = state * 1103515245 + 12345;
+		drawn[k] = (state >> 8) % n;
+		// the names are rebuilt from the name trie before the clock starts
+		if (byName)
+			names[k] = newVariableName(md, drawn[k]);
+	}
+	start = now();
+	for (k = 0; drawn && names && k < LOOKUPS; k++) {
+		ScalarVariable* sv = vars[drawn[k]];
+		*checksum += (byName ? getVariableByName(md, names[k] ? names[k] : "") :
+				getVariable(md, sv->info.vr, sv->info.baseType)) != NULL;
+	}
+	if (k)
+		ns = 1e9 * (now() - start) / LOOKUPS;
+	for (k = 0; names && k < LOOKUPS; k++)
+		free(names[k]);
+	free(names);
+	free(drawn);
+	return ns;
+}
+
+// Returns the ns per row to visit the non-alias variables with their
+// value reference and type, the bookkeeping of outputRow() without the calls
+// of the FMU
+static double benchRow(ModelDescription* md, int* checksum) {
+	ScalarVariable** vars = md->modelVariables;
+	int rows = 0, k;
+	double start = now();
+	do {
+		for (k = 0; vars[k]; k++)
+			if (getAlias(vars[k]) == enu_noAlias)
+				*checksum += getValueReference(vars[k])
+						+ vars[k]->typeSpec->type;
+		rows++;
+	} while (now() - start < 0.1);
+	return 1e9 * (now() - start) / rows;
+}
+
+// Returns the ns to select the non-alias variables with selectVariables()
+static double benchSelect(ModelDescription* md, int n, int* checksum) {
+	static const VarQuery q = { 0, 0, 0, 1 << enu_noAlias };
+	int* positions = (int*) malloc(n * sizeof(int));
+	int rows = 0;
+	double start = now();
+	if (!positions)
+		return 0;
+	do {
+		*checksum += selectVariables(md, &q, positions);
+		rows++;
+	} while (now() - start < 0.1);
+	free(positions);
+	return 1e9 * (now() - start) / rows;
+}
+
+// Parse xmlPath and print one line of results, called in a child process
+static int benchSize(const char* xmlPath, int n, long size) {
+	ModelDescription* md;
+	struct rusage usage;
+	double start, parseTime;
+	long rss = residentKB();
+	int checksum = 0;
+	start = now();
+	md = parse(xmlPath);
+	parseTime = now() - start;
+	getrusage(RUSAGE_SELF, &usage);
+	if (!md)
+		return EXIT_FAILURE;
+	printf("%8d %9.1f %10.1f %8.1f %10.0f %9.1f %9.1f %8.1f %8.1f %10.1f"
+			" %10.1f\n",
+			n, size / 1e6, 1e3 * parseTime, size / 1e6 / parseTime,
+			n / parseTime / 1e3, md->arena->footprint / 1e6,
+			(usage.ru_maxrss - rss) / 1e3, benchLookup(md, n, 1, &checksum),
+			benchLookup(md, n, 0, &checksum), benchRow(md, &checksum) / 1e3,
+			benchSelect(md, n, &checksum) / 1e3);
+	freeElement(md);
+	return checksum == -1; // keep the loops
+}
+
+int main(int argc, char* argv[]) {
+	static const int defaults[] = { 1000, 10000, 100000, 1000000 };
+	char xmlPath[] = "/tmp/bench_sweep_XXXXXX";
+	int nSizes = argc > 1 ? argc - 1 : 4;
+	int failed = 0, i;
+	int fd = mkstemp(xmlPath);
+	if (fd < 0) {
+		printf("error: could not create %s\n", xmlPath);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	printf("%8s %9s %10s %8s %10s %9s %9s %8s %8s %10s %10s\n", "vars", "MB",
+			"parse ms", "MB/s", "kvars/s", "AST MB", "peak MB", "name ns",
+			"vr ns", "row us", "select us");
+	for (i = 0; i < nSizes && !failed; i++) {
+		ModelGenOptions o;
+		struct stat st;
+		FILE* file = fopen(xmlPath, "w");
+		int status;
+		pid_t pid;
+		modelGenDefaults(&o, argc > 1 ? atoi(argv[i + 1]) : defaults[i]);
+		failed = !file || !generateModel(&o, file);
+		if (file)
+			failed = fclose(file) || failed;
+		if (failed || stat(xmlPath, &st) || o.variables < 1) {
+			printf("error: could not generate %d variables\n", o.variables);
+			failed = 1;
+			break;
+		}
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0) {
+			status = benchSize(xmlPath, o.variables, st.st_size);
+			fflush(stdout);
+			_exit(status);
+		}
+		failed = pid < 0 || waitpid(pid, &status, 0) != pid
+				|| !WIFEXITED(status) || WEXITSTATUS(status);
+	}
+	remove(xmlPath);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/*
+ * check_insitu.cpp
+ *
+ * check_insitu [modelDescription.xml...]
+ * Parses every file with expat, see parseBuffer(), in place, see
+ * parseBufferInSitu(), and on several threads, see parseBufferParallel(), and
+ * reports each file that one parser accepts and another rejects, or that
+ * yields different ASTs or different messages. The ASTs are compared by
+ * their images, see md_image.hpp. Without files, a built-in corpus is
+ * checked: a small model description and variants of it with references,
+ * line ends, comments, CDATA sections and declarations, and with errors such
+ * as invalid UTF-8, control chars, names that are no XML names, "--" in a
+ * comment or "]]>" in text, and a generated model description large enough
+ * to be split, with ModelVariables tags in comments.
+ * Exits with 1 if any file differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xml_parser.hpp>
+#include <md_image.hpp>
+#include <model_gen.hpp>
+
+#define MESSAGE_SIZE 4096
+#define LARGE_VARIABLES 40000 // a model description of about 8 MB
+#define THREADS 4
+
+// the parsers compared
+#define EXPAT 0
+#define IN_SITU 1
+#define PARALLEL 2
+#define PARSERS 3
+
+static const char* parserNames[PARSERS] = { "expat   ", "in place", "parallel" };
+
+// a model description with slots for the text before the root element, a
+// description, the text of a Name, and the text after the root element
+static const char* MODEL = "%s"
+		"<fmiModelDescription fmiVersion=\"1.0\" modelName=\"m\""
+		" modelIdentifier=\"m\" guid=\"{8c4e810f}\" description=\"%s\""
+		" numberOfContinuousStates=\"0\" numberOfEventIndicators=\"0\">\n"
+		"<!-- the variables -->\n"
+		"<ModelVariables>\n"
+		"\t<ScalarVariable name=\"u\" valueReference=\"0\" causality=\"input\">\n"
+		"\t\t<Real start=\"1.0\"/>\n"
+		"\t</ScalarVariable>\n"
+		"\t<ScalarVariable name=\"y\" valueReference=\"1\" causality=\"output\">\n"
+		"\t\t<Real/>\n"
+		"\t\t<DirectDependency><Name>%s</Name></DirectDependency>\n"
+		"\t</ScalarVariable>\n"
+		"</ModelVariables>\n"
+		"</fmiModelDescription>\n%s";
+
+#define DECL "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+
+typedef struct {
+	const char* name;
+	const char* head;
+	const char* description;
+	const char* input;
+	const char* tail;
+} Variant;
+
+static const Variant corpus[] = {
+	{ "valid", DECL, "d", "u", "" },
+	{ "no declaration", "", "d", "u", "" },
+	{ "byte order mark", "\xEF\xBB\xBF" DECL, "d", "u", "" },
+	{ "references", DECL, "&lt;&gt;&amp;&quot;&apos;&#65;&#x263A;&#x1F600;",
+			"&#117;", "" },
+	{ "line ends", DECL, "a\nb\r\nc\rd\te", "\r\nu\r\n", "" },
+	{ "multibyte chars", DECL, "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9D\x84\x9E",
+			"u", "" },
+	{ "C1 and DEL chars", DECL, "\xC2\x80\xC2\x9F\x7F", "u", "" },
+	{ "last chars of the planes", DECL, "\xEF\xBF\xBD\xF4\x8F\xBF\xBD", "u",
+			"" },
+	{ "]]> in a value", DECL, "a]]>b", "u", "" },
+	{ "CDATA", DECL, "d", "<![CDATA[u]]>", "" },
+	{ "comment and PI after the root", DECL, "d", "u",
+			"<!-- end -->\n<?pi x?>\n" },
+	{ "comment before the root", DECL "<!-- a - b -->\n", "d", "u", "" },
+	{ "empty comment", DECL "<!---->\n", "d", "u", "" },
+	{ "invalid UTF-8 in a value", DECL, "a\xFF\xFE" "b", "u", "" },
+	{ "invalid UTF-8 in text", DECL, "d", "u\xFF", "" },
+	{ "lone continuation byte", DECL, "a\x85" "b", "u", "" },
+	{ "truncated sequence", DECL, "a\xE2\x82", "u", "" },
+	{ "overlong encoding", DECL, "a\xC0\xAF" "b", "u", "" },
+	{ "overlong 3 byte encoding", DECL, "a\xE0\x80\xAF" "b", "u", "" },
+	{ "surrogate", DECL, "a\xED\xA0\x80" "b", "u", "" },
+	{ "U+FFFE", DECL, "a\xEF\xBF\xBE" "b", "u", "" },
+	{ "U+FFFF", DECL, "a\xEF\xBF\xBF" "b", "u", "" },
+	{ "beyond U+10FFFF", DECL, "a\xF4\x90\x80\x80" "b", "u", "" },
+	{ "byte F8", DECL, "a\xF8" "b", "u", "" },
+	{ "control char in a value", DECL, "a\x01" "b", "u", "" },
+	{ "control char in text", DECL, "d", "u\x1F", "" },
+	{ "control char in a comment", DECL "<!-- \x02 -->\n", "d", "u", "" },
+	{ "invalid UTF-8 in a comment", DECL "<!-- \xC3 -->\n", "d", "u", "" },
+	{ "control char after the root", DECL, "d", "u", "\x0B" },
+	{ "-- in a comment", DECL "<!-- a -- b -->\n", "d", "u", "" },
+	{ "comment ending with --->", DECL "<!-- a --->\n", "d", "u", "" },
+	{ "]]> in text", DECL, "d", "u]]>", "" },
+	{ "] and ]] in text", DECL, "d", "u]]", "" },
+	{ "reference to char 0", DECL, "&#0;", "u", "" },
+	{ "reference to a control char", DECL, "&#1;", "u", "" },
+	{ "reference to a surrogate", DECL, "&#xD800;", "u", "" },
+	{ "reference to U+FFFE", DECL, "&#xFFFE;", "u", "" },
+	{ "undefined entity", DECL, "&bogus;", "u", "" },
+	{ "bare ampersand", DECL, "a & b", "u", "" },
+	{ "< in a value", DECL, "a < b", "u", "" },
+	{ "name starting with a digit", DECL, "d", "u</Name><1a/><Name>", "" },
+	{ "name with $", DECL, "d", "u</Name><a$b/><Name>", "" },
+	{ "attribute name with a digit first", DECL, "d\" 1x=\"2", "u", "" },
+	{ "names with . - _ :", DECL, "d\" a.b-c_d:e=\"2", "u", "" },
+	{ "XML declaration not at the start", "\n" DECL, "d", "u", "" },
+	{ "XML declaration after the root", DECL, "d", "u", DECL },
+	{ "junk after the root", DECL, "d", "u", "<x/>" },
+	{ "text after the root", DECL, "d", "u", "junk" },
+	{ "mismatched tag", DECL, "d", "u</Nam><Name>", "" },
+	{ "references in skipped text", DECL, "d",
+			"u</Name>&lt;&#65;&#x263A;<Name>", "" },
+	{ "undefined entity in skipped text", DECL, "d",
+			"u</Name>&undefined;<Name>", "" },
+	{ "bare ampersand in skipped text", DECL, "d", "u</Name> & <Name>", "" },
+	{ "reference to a control char in skipped text", DECL, "d",
+			"u</Name>&#1;<Name>", "" },
+	{ "reference to U+FFFE in skipped text", DECL, "d",
+			"u</Name>&#xFFFE;<Name>", "" },
+	{ "reference to a surrogate in skipped text", DECL, "d",
+			"u</Name>&#xD800;<Name>", "" },
+	{ "reference beyond U+10FFFF in skipped text", DECL, "d",
+			"u</Name>&#1114112;<Name>", "" },
+	{ "unterminated reference in skipped text", DECL, "d",
+			"u</Name>&#65<Name>", "" },
+	{ "-- in a comment over lines", DECL "<!-- a\n\n -- b -->\n", "d", "u",
+			"" },
+	{ "unclosed comment", DECL, "d", "u", "<!-- a -" },
+	{ "]]> in text over lines", DECL, "d", "\n\nu]]>", "" },
+	{ "line end from a reference", DECL, "d", "&#10;u", "" },
+	{ "CDATA with line ends", DECL, "d", "<![CDATA[\r\nu\r\n]]>", "" },
+	{ "PI target xml-stylesheet", DECL "<?xml-stylesheet href='a'?>\n", "d",
+			"u", "" },
+	{ "PI target XML", DECL "<?XML x?>\n", "d", "u", "" },
+	{ "PI without target", DECL "<? x?>\n", "d", "u", "" },
+	{ "PI target with $", DECL "<?a$b x?>\n", "d", "u", "" },
+	{ "XML declaration in text", DECL, "d", "u" DECL, "" },
+	{ "declaration with single quotes",
+			"<?xml version='1.0' encoding='UTF-8'?>\n", "d", "u", "" },
+	{ "declaration with standalone",
+			"<?xml version=\"1.0\" standalone=\"yes\" ?>\n", "d", "u", "" },
+	{ "declaration without version", "<?xml encoding=\"UTF-8\"?>\n", "d",
+			"u", "" },
+	{ "declaration in the wrong order",
+			"<?xml encoding=\"UTF-8\" version=\"1.0\"?>\n", "d", "u", "" },
+	{ "declaration with another attribute",
+			"<?xml version=\"1.0\" foo=\"x\"?>\n", "d", "u", "" },
+	{ "declaration with an invalid version", "<?xml version=\"1.x\"?>\n",
+			"d", "u", "" },
+	{ "declaration with an invalid standalone",
+			"<?xml version=\"1.0\" standalone=\"maybe\"?>\n", "d", "u", "" },
+	{ "empty declaration", "<?xml?>\n", "d", "u", "" },
+};
+
+static char* readFile(const char* path, size_t* size) {
+	FILE* file = fopen(path, "rb");
+	char* text = NULL;
+	long n;
+	if (!file)
+		return NULL;
+	if (fseek(file, 0, SEEK_END) == 0 && (n = ftell(file)) >= 0
+			&& fseek(file, 0, SEEK_SET) == 0) {
+		text = (char*) malloc(n + 1);
+		if (text && fread(text, 1, n, file) != (size_t) n) {
+			free(text);
+			text = NULL;
+		}
+		*size = n;
+	}
+	fclose(file);
+	return text;
+}
+
+// Parse the size bytes of xml with the given parser, saving the image of the
+// AST to imagePath, and store what the parser printed in message, without
+// lines repeated right after each other.
+// Returns 1 if the text was accepted
+static int parseWith(int parser, const char* xml, size_t size,
+		const char* name, const char* imagePath, char* message) {
+	MdImageKey key = { 0, 0, "", 0 };
+	ModelDescription* md;
+	FILE* out = tmpfile();
+	int saved = dup(STDOUT_FILENO);
+	char line[MESSAGE_SIZE];
+	char last[MESSAGE_SIZE] = "";
+	size_t n = 0;
+	int ok;
+	if (!out || saved < 0) {
+		printf("error: cannot capture the messages of the parser\n");
+		exit(EXIT_FAILURE);
+	}
+	fflush(stdout);
+	dup2(fileno(out), STDOUT_FILENO);
+	if (parser == IN_SITU) {
+		char* copy = (char*) malloc(size ? size : 1);
+		if (copy)
+			memcpy(copy, xml, size);
+		md = copy ? parseBufferInSitu(copy, size, name, NULL, 1) : NULL;
+	} else if (parser == PARALLEL)
+		md = parseBufferParallel(xml, size, name, THREADS);
+	else
+		md = parseBuffer(xml, size, name);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	ok = md != NULL;
+	if (md) {
+		ok = mdImageSave(imagePath, md, &key);
+		freeElement(md);
+	}
+	rewind(out);
+	message[0] = '\0';
+	while (fgets(line, sizeof(line), out))
+		if (strcmp(line, last)) {
+			strncpy(message + n, line, MESSAGE_SIZE - 1 - n);
+			message[MESSAGE_SIZE - 1] = '\0';
+			n = strlen(message);
+			strcpy(last, line);
+		}
+	fclose(out);
+	return ok;
+}
+
+// Returns 1 if both files have the same content
+static int sameFile(const char* a, const char* b) {
+	size_t na, nb;
+	char* x = readFile(a, &na);
+	char* y = readFile(b, &nb);
+	int same = x && y && na == nb && !memcmp(x, y, na);
+	free(x);
+	free(y);
+	return same;
+}
+
+// Returns 1 if all parsers agree on the text
+static int check(const char* xml, size_t size, const char* name) {
+	static char messages[PARSERS][MESSAGE_SIZE];
+	char images[PARSERS][64];
+	int ok[PARSERS];
+	int i, same = 1;
+	for (i = 0; i < PARSERS; i++) {
+		sprintf(images[i], "/tmp/check_insitu_%d_%d.mdi", (int) getpid(), i);
+		ok[i] = parseWith(i, xml, size, name, images[i], messages[i]);
+	}
+	for (i = 1; i < PARSERS; i++)
+		same &= ok[i] == ok[EXPAT] && !strcmp(messages[i], messages[EXPAT])
+				&& (!ok[i] || sameFile(images[i], images[EXPAT]));
+	if (same)
+		printf("same      %s: %s\n", ok[EXPAT] ? "accepted" : "rejected",
+				name);
+	else {
+		printf("DIFFERENT %s\n", name);
+		for (i = 0; i < PARSERS; i++)
+			printf("  %s %s\n    %s", parserNames[i],
+					ok[i] ? "accepted" : "rejected",
+					messages[i][0] ? messages[i] : "\n");
+	}
+	for (i = 0; i < PARSERS; i++)
+		unlink(images[i]);
+	return same;
+}
+
+// Generate a model description of LARGE_VARIABLES variables and insert text
+// before the given tag, and after it when after is 1
+// Returns the text, NULL to indicate failure
+static char* generateLarge(const char* tag, int after, const char* text,
+		size_t* size) {
+	ModelGenOptions o;
+	char* model = NULL;
+	char* xml = NULL;
+	char* at;
+	size_t n = 0;
+	FILE* file = open_memstream(&model, &n);
+	if (!file)
+		return NULL;
+	modelGenDefaults(&o, LARGE_VARIABLES);
+	if (!generateModel(&o, file)) {
+		fclose(file);
+		free(model);
+		return NULL;
+	}
+	fclose(file);
+	at = strstr(model, tag);
+	if (at && after)
+		at = strchr(at, '>') + 1;
+	if (at)
+		xml = (char*) malloc(n + strlen(text) + 1);
+	if (xml)
+		sprintf(xml, "%.*s%s%s", (int) (at - model), model, text, at);
+	*size = xml ? strlen(xml) : 0;
+	free(model);
+	return xml;
+}
+
+// Returns the number of large texts that differ, checked are n of them
+static int checkLarge(int* n) {
+	static const struct {
+		const char* name;
+		const char* tag;
+		int after;
+		const char* text;
+	} large[] = {
+		{ "large", "<ModelVariables", 0, "" },
+		{ "large with <ModelVariables> in a comment before it",
+				"<ModelVariables", 0, "<!-- <ModelVariables> -->\n" },
+		{ "large with </ModelVariables> in a comment after it",
+				"</ModelVariables", 1, "\n<!-- </ModelVariables> -->" },
+		{ "large with both in a comment before it", "<ModelVariables", 0,
+				"<!-- <ModelVariables></ModelVariables> -->\n" },
+		{ "large with an error in the rest", "<ModelVariables", 0,
+				"<Bogus/>\n" },
+	};
+	int i, differ = 0;
+	for (i = 0; i < (int) (sizeof(large) / sizeof(large[0])); i++, (*n)++) {
+		size_t size;
+		char* xml = generateLarge(large[i].tag, large[i].after,
+				large[i].text, &size);
+		if (!xml) {
+			printf("error: cannot generate %s\n", large[i].name);
+			exit(EXIT_FAILURE);
+		}
+		differ += !check(xml, size, large[i].name);
+		free(xml);
+	}
+	return differ;
+}
+
+int main(int argc, char* argv[]) {
+	int i, differ = 0, n = 0;
+	if (argc > 1)
+		for (i = 1; i < argc; i++, n++) {
+			size_t size;
+			char* xml = readFile(argv[i], &size);
+			if (!xml) {
+				printf("error: cannot read %s\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			differ += !check(xml, size, argv[i]);
+			free(xml);
+		}
+	else
+		for (i = 0; i < (int) (sizeof(corpus) / sizeof(corpus[0])); i++, n++) {
+			const Variant* v = &corpus[i];
+			size_t size = strlen(MODEL) + strlen(v->head)
+					+ strlen(v->description) + strlen(v->input)
+					+ strlen(v->tail);
+			char* xml = (char*) malloc(size);
+			if (!xml)
+				return EXIT_FAILURE;
+			sprintf(xml, MODEL, v->head, v->description, v->input, v->tail);
+			differ += !check(xml, strlen(xml), v->name);
+			free(xml);
+		}
+	if (argc == 1)
+		differ += checkLarge(&n);
+	printf("%d of %d texts differ\n", differ, n);
+	return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
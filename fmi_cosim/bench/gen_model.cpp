@@ -0,0 +1,65 @@
+/*
+ * gen_model.cpp
+ *
+ * gen_model [-n variables] [-m real,integer,boolean,string,enumeration]
+ *           [-a aliases] [-t types] [-d dependencies] [-s seed] [file]
+ * Writes a synthetic modelDescription.xml to file or stdout, see
+ * model_gen.hpp for the meaning and the defaults of the options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <model_gen.hpp>
+
+static int usage(const char* name) {
+	printf("usage: %s [-n variables] [-m real,integer,boolean,string,enumeration]"
+			" [-a aliases] [-t types] [-d dependencies] [-s seed] [file]\n",
+			name);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+	ModelGenOptions o;
+	FILE* file = stdout;
+	int i, ok;
+	modelGenDefaults(&o, 1000);
+	for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+		const char* value = argv[i + 1];
+		switch (argv[i][1]) {
+		case 'n':
+			o.variables = atoi(value);
+			break;
+		case 'm':
+			if (sscanf(value, "%lf,%lf,%lf,%lf,%lf", &o.mix[GEN_REAL],
+					&o.mix[GEN_INTEGER], &o.mix[GEN_BOOLEAN],
+					&o.mix[GEN_STRING], &o.mix[GEN_ENUMERATION]) != GEN_TYPES)
+				return usage(argv[0]);
+			break;
+		case 'a':
+			o.aliases = atof(value);
+			break;
+		case 't':
+			o.typeDefinitions = atoi(value);
+			break;
+		case 'd':
+			o.dependencies = atof(value);
+			break;
+		case 's':
+			o.seed = strtoul(value, NULL, 10);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (i < argc - 1 || o.variables < 0 || (i < argc && argv[i][0] == '-'))
+		return usage(argv[0]);
+	if (i < argc && !(file = fopen(argv[i], "w"))) {
+		printf("error: could not open %s\n", argv[i]);
+		return EXIT_FAILURE;
+	}
+	ok = generateModel(&o, file);
+	if (file != stdout)
+		ok = !fclose(file) && ok;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,253 @@
+/*
+ * model_gen.cpp
+ *
+ * The variables are drawn first, so that aliases can refer to earlier
+ * variables of their type and outputs to inputs anywhere in the model,
+ * and then written in one pass.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <model_gen.hpp>
+
+#define GEN_PARAMETERS 0.1 // share of the other variables that are parameters
+
+typedef enum {
+	genInternal, genInput, genOutput, genParameter
+} GenRole;
+
+typedef struct {
+	unsigned char type;  // GEN_REAL etc.
+	unsigned char role;  // GenRole
+	unsigned char alias; // 0, 1 for alias, 2 for negatedAlias
+	unsigned vr;
+} GenVariable;
+
+static const char* typeNames[GEN_TYPES] = { "Real", "Integer", "Boolean",
+		"String", "Enumeration" };
+
+// xorshift, deterministic for a given seed
+static unsigned nextRandom(unsigned* state) {
+	unsigned x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// Returns a number in [0, 1)
+static double uniform(unsigned* state) {
+	return nextRandom(state) / 4294967296.0;
+}
+
+void modelGenDefaults(ModelGenOptions* o, int variables) {
+	o->variables = variables;
+	o->mix[GEN_REAL] = 80;
+	o->mix[GEN_INTEGER] = 10;
+	o->mix[GEN_BOOLEAN] = 8;
+	o->mix[GEN_STRING] = 1;
+	o->mix[GEN_ENUMERATION] = 1;
+	o->aliases = 0.3;
+	o->typeDefinitions = 20;
+	o->dependencies = 2;
+	o->inputs = 0.05;
+	o->outputs = 0.05;
+	o->seed = 1;
+}
+
+static int drawType(const ModelGenOptions* o, unsigned* state) {
+	double sum = 0, r;
+	int t;
+	for (t = 0; t < GEN_TYPES; t++)
+		sum += o->mix[t];
+	r = uniform(state) * sum;
+	for (t = 0; t < GEN_TYPES - 1; t++) {
+		if (r < o->mix[t])
+			return t;
+		r -= o->mix[t];
+	}
+	return t;
+}
+
+// Draw all variables. bases[t] collects the non-alias variables of type t,
+// inputs the inputs, all with room for every variable.
+static void drawVariables(const ModelGenOptions* o, GenVariable* vars,
+		int* bases[], int* inputs, int* nInputs) {
+	unsigned state = o->seed ? o->seed : 1;
+	unsigned refs[GEN_TYPES] = { 0 };
+	int nBases[GEN_TYPES] = { 0 };
+	int i;
+	for (i = 0; i < o->variables; i++) {
+		GenVariable* v = &vars[i];
+		double r = uniform(&state);
+		v->type = drawType(o, &state);
+		v->alias = 0;
+		if (r < o->inputs) {
+			v->role = genInput;
+			inputs[(*nInputs)++] = i;
+		} else if (r < o->inputs + o->outputs)
+			v->role = genOutput;
+		else if (nBases[v->type] && uniform(&state) < o->aliases) {
+			// same vr and variability as a variable of the same type
+			GenVariable* base = &vars[bases[v->type][nextRandom(&state)
+					% nBases[v->type]]];
+			v->role = base->role == genParameter ? genParameter : genInternal;
+			v->vr = base->vr;
+			v->alias = (v->type == GEN_REAL || v->type == GEN_INTEGER)
+					&& uniform(&state) < 0.2 ? 2 : 1;
+			continue;
+		} else
+			v->role = uniform(&state) < GEN_PARAMETERS ?
+					genParameter : genInternal;
+		v->vr = refs[v->type]++;
+		bases[v->type][nBases[v->type]++] = i;
+	}
+}
+
+static void writeName(FILE* file, int i) {
+	fprintf(file, "c%d.s%d.v%d", i / 1000, i / 50 % 20, i);
+}
+
+static void writeHeader(const ModelGenOptions* o, FILE* file) {
+	int t;
+	fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<fmiModelDescription fmiVersion=\"1.0\" modelName=\"Synthetic\" "
+			"modelIdentifier=\"Synthetic\" guid=\"{synthetic-%d-%u}\" "
+			"generationTool=\"model_gen\" variableNamingConvention=\"structured\" "
+			"numberOfContinuousStates=\"0\" numberOfEventIndicators=\"0\">\n",
+			o->variables, o->seed);
+	fprintf(file, "\t<UnitDefinitions>\n"
+			"\t\t<BaseUnit unit=\"K\">\n"
+			"\t\t\t<DisplayUnitDefinition displayUnit=\"degC\" gain=\"1\" offset=\"-273.15\" />\n"
+			"\t\t</BaseUnit>\n"
+			"\t</UnitDefinitions>\n"
+			"\t<TypeDefinitions>\n");
+	for (t = 0; t < o->typeDefinitions; t++)
+		fprintf(file, "\t\t<Type name=\"T%d\" description=\"Type %d\">\n"
+				"\t\t\t<RealType quantity=\"Q%d\" unit=\"K\" displayUnit=\"degC\" "
+				"nominal=\"%d\" min=\"0\" max=\"%d\" />\n"
+				"\t\t</Type>\n", t, t, t, 100 + t, 1000 + t);
+	fprintf(file, "\t\t<Type name=\"E\">\n"
+			"\t\t\t<EnumerationType min=\"1\" max=\"3\">\n"
+			"\t\t\t\t<Item name=\"low\" />\n"
+			"\t\t\t\t<Item name=\"medium\" />\n"
+			"\t\t\t\t<Item name=\"high\" />\n"
+			"\t\t\t</EnumerationType>\n"
+			"\t\t</Type>\n"
+			"\t</TypeDefinitions>\n"
+			"\t<DefaultExperiment startTime=\"0\" stopTime=\"10\" tolerance=\"1e-6\" />\n"
+			"\t<ModelVariables>\n");
+}
+
+static void writeTypeSpec(const ModelGenOptions* o, const GenVariable* v,
+		int i, FILE* file) {
+	fprintf(file, "\t\t\t<%s", typeNames[v->type]);
+	switch (v->type) {
+	case GEN_REAL:
+		if (o->typeDefinitions && i % 2)
+			fprintf(file, " declaredType=\"T%d\"", i % o->typeDefinitions);
+		else
+			fprintf(file, " unit=\"K\" nominal=\"300\"");
+		if (v->role != genOutput)
+			fprintf(file, " start=\"%d.5\"", i % 1000);
+		break;
+	case GEN_INTEGER:
+		if (v->role != genOutput)
+			fprintf(file, " start=\"%d\"", i % 1000);
+		break;
+	case GEN_BOOLEAN:
+		if (v->role != genOutput)
+			fprintf(file, " start=\"%s\"", i % 2 ? "true" : "false");
+		break;
+	case GEN_STRING:
+		if (v->role != genOutput)
+			fprintf(file, " start=\"s%d\"", i);
+		break;
+	default:
+		fprintf(file, " declaredType=\"E\"");
+		if (v->role != genOutput)
+			fprintf(file, " start=\"%d\"", 1 + i % 3);
+		break;
+	}
+	fprintf(file, " />\n");
+}
+
+// each output depends on floor(dependencies) or one more inputs, with the
+// given mean, drawn at random
+static void writeDependencies(const ModelGenOptions* o, int* inputs,
+		int nInputs, unsigned* state, FILE* file) {
+	int n = (int) floor(o->dependencies + uniform(state));
+	int k;
+	if (n > nInputs)
+		n = nInputs;
+	if (n <= 0)
+		return;
+	fprintf(file, "\t\t\t<DirectDependency>\n");
+	for (k = 0; k < n; k++) {
+		// partial Fisher-Yates shuffle, the first n inputs are distinct
+		int j = k + nextRandom(state) % (nInputs - k);
+		int tmp = inputs[k];
+		inputs[k] = inputs[j];
+		inputs[j] = tmp;
+		fprintf(file, "\t\t\t\t<Name>");
+		writeName(file, inputs[k]);
+		fprintf(file, "</Name>\n");
+	}
+	fprintf(file, "\t\t\t</DirectDependency>\n");
+}
+
+static void writeVariables(const ModelGenOptions* o, const GenVariable* vars,
+		int* inputs, int nInputs, FILE* file) {
+	static const char* aliasNames[] = { "noAlias", "alias", "negatedAlias" };
+	unsigned state = (o->seed ? o->seed : 1) ^ 0x5bd1e995;
+	int i;
+	for (i = 0; i < o->variables; i++) {
+		const GenVariable* v = &vars[i];
+		fprintf(file, "\t\t<ScalarVariable name=\"");
+		writeName(file, i);
+		fprintf(file, "\" valueReference=\"%u\"", v->vr);
+		if (i % 5 == 0)
+			fprintf(file, " description=\"Variable %d\"", i);
+		fprintf(file, " variability=\"%s\" causality=\"%s\" alias=\"%s\">\n",
+				v->role == genParameter ? "parameter" :
+				v->type == GEN_REAL ? "continuous" : "discrete",
+				v->role == genInput ? "input" :
+				v->role == genOutput ? "output" : "internal",
+				aliasNames[v->alias]);
+		writeTypeSpec(o, v, i, file);
+		if (v->role == genOutput)
+			writeDependencies(o, inputs, nInputs, &state, file);
+		fprintf(file, "\t\t</ScalarVariable>\n");
+	}
+}
+
+int generateModel(const ModelGenOptions* o, FILE* file) {
+	GenVariable* vars = (GenVariable*) malloc(
+			(o->variables + 1) * sizeof(GenVariable));
+	int* inputs = (int*) malloc((o->variables + 1) * sizeof(int));
+	int* bases[GEN_TYPES];
+	int nInputs = 0, ok = vars && inputs, t;
+	for (t = 0; t < GEN_TYPES; t++) {
+		bases[t] = (int*) malloc((o->variables + 1) * sizeof(int));
+		ok = ok && bases[t];
+	}
+	if (ok) {
+		drawVariables(o, vars, bases, inputs, &nInputs);
+		writeHeader(o, file);
+		writeVariables(o, vars, inputs, nInputs, file);
+		fprintf(file, "\t</ModelVariables>\n"
+				"\t<Implementation>\n"
+				"\t\t<CoSimulation_StandAlone>\n"
+				"\t\t\t<Capabilities canHandleVariableCommunicationStepSize=\"true\" "
+				"canHandleEvents=\"true\" canBeInstantiatedOnlyOncePerProcess=\"false\" />\n"
+				"\t\t</CoSimulation_StandAlone>\n"
+				"\t</Implementation>\n"
+				"</fmiModelDescription>\n");
+		ok = !ferror(file);
+	}
+	for (t = 0; t < GEN_TYPES; t++)
+		free(bases[t]);
+	free(inputs);
+	free(vars);
+	return ok;
+}
@@ -0,0 +1,47 @@
+/**
+* @file model_gen.hpp
+*
+* @brief Generator of synthetic model descriptions for benchmarks.
+* Writes a valid FMI 1.0 Co-Simulation modelDescription.xml with a given number of
+* variables, mix of base types, share of aliases, number of type definitions and
+* density of direct dependencies. Names are structured, e.g. c12.s3.v12345, so that
+* many of them share prefixes as in generated models. The output depends only on
+* the options, so runs can be compared.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef MODEL_GEN_HPP_
+#define MODEL_GEN_HPP_
+
+#include <stdio.h>
+
+// Base types of ModelGenOptions::mix
+#define GEN_REAL 0
+#define GEN_INTEGER 1
+#define GEN_BOOLEAN 2
+#define GEN_STRING 3
+#define GEN_ENUMERATION 4
+#define GEN_TYPES 5
+
+typedef struct {
+	int variables;         // number of ScalarVariables
+	double mix[GEN_TYPES]; // relative weights of the base types
+	double aliases;        // share of variables that alias another, 0..1
+	int typeDefinitions;   // number of RealTypes declared by Real variables
+	double dependencies;   // mean number of inputs an output depends on
+	double inputs;         // share of variables that are inputs, 0..1
+	double outputs;        // share of variables that are outputs, 0..1
+	unsigned seed;
+} ModelGenOptions;
+
+// Set the defaults: 80% Real, 10% Integer, 8% Boolean, 1% String and
+// Enumeration, 30% aliases, 20 types, 5% inputs, 5% outputs, each output
+// depending on 2 inputs on average
+void modelGenDefaults(ModelGenOptions* o, int variables);
+
+// Write the model description to file
+// Returns 0 to indicate failure
+int generateModel(const ModelGenOptions* o, FILE* file);
+
+#endif /* MODEL_GEN_HPP_ */
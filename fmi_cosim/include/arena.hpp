@@ -0,0 +1,63 @@
+/**
+* @file arena.hpp
+*
+* @brief Bump allocator for data that is released all at once.
+* Memory is taken from large blocks obtained with calloc, so it is zero-initialized
+* and cannot be freed one by one. Releasing the arena releases all blocks. The AST
+* of a model description lives in one arena, see parse(). An arena can also adopt
+* one buffer, e.g. the mapped XML text the AST points into, released with it.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <stddef.h>
+
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t size;             // usable bytes after the header
+	size_t used;
+} ArenaBlock;
+
+typedef struct {
+	ArenaBlock* blocks;      // block allocations are taken from first
+	size_t blockSize;        // size of the next block, doubles up to ARENA_MAX_BLOCK
+	size_t footprint;        // bytes obtained from calloc, including headers
+	size_t used;             // bytes handed out, including alignment
+	int allocations;
+	void* buffer;            // NULL or the adopted buffer, see arenaAdopt()
+	size_t bufferSize;
+	int mapped;              // 1 if buffer is released by munmap, 0 by free
+} Arena;
+
+#define ARENA_MAX_BLOCK (4 << 20)
+
+// blockSize is the size of the first block, 0 selects a default
+// Returns NULL to indicate failure
+Arena* arenaNew(size_t blockSize);
+
+// Returns size zeroed bytes, aligned for any type, or NULL to indicate failure
+void* arenaAlloc(Arena* a, size_t size);
+
+// Returns a copy of the first n chars of s, or NULL to indicate failure
+char* arenaStrndup(Arena* a, const char* s, size_t n);
+char* arenaStrdup(Arena* a, const char* s);
+
+// Release buffer of the given size with the arena, by munmap if mapped,
+// otherwise by free. An arena adopts at most one buffer.
+void arenaAdopt(Arena* a, void* buffer, size_t size, int mapped);
+
+// Release a buffer as arenaAdopt() would
+void arenaRelease(void* buffer, size_t size, int mapped);
+
+// Move all memory of other to a and free other, other may be NULL.
+// Allocations continue in the current block of a. An adopted buffer of
+// other moves as well, a must not have one then.
+void arenaMerge(Arena* a, Arena* other);
+
+// Release all memory of the arena, a may be NULL
+void arenaFree(Arena* a);
+
+#endif /* ARENA_HPP_ */
@@ -15,6 +15,7 @@
 
 #include <fmi_cosim.h>
 #include <support_cosim.hpp>
+#include <var_reader.hpp>
 
 /**
  * @struct var
@@ -39,12 +40,14 @@ struct var {
 	fmiStatus stat;// fmiStatus as a result of last operation over the variable
 	fmiValueReference vr; // a unique variable reference number for the variable as parsed from modelDescription.xml file
 	bool variableParsed;// a status flag to avoid repeated paring of the modelDescription.xml file
+	bool negated; // true for a negatedAlias, its value is the negated value of vr
 	// default constructor when variable name is not decided during declaration
 	var() {
 		name = "";
 		stat = fmiOK;
 		vr = 0;
 		variableParsed = false;
+		negated = false;
 		type = elm_ANY_TYPE;
 	};
 	// constructor when declared with a name
@@ -53,6 +56,7 @@ struct var {
 		stat = fmiOK;
 		vr = 0;
 		variableParsed = false;
+		negated = false;
 		type = elm_ANY_TYPE;
 	}
 	;
@@ -68,6 +72,11 @@ struct var {
 class fmi_cosim {
 	var tmp_in;
 	var tmp_out, tmp_par;
+	// reader of the variables of the last getOutputs() call, kept while the
+	// same array of variables is read
+	var* readerVars;
+	VarReader* reader;
+	VarValue* readerValues;
 public:
 
 	static FMU fmu_g;
@@ -75,6 +84,9 @@ public:
 	fmi_cosim(char* FMU_Path, fmiReal Tcurr, fmiReal Tdelta) {
 		T_curr = Tcurr;
 		T_delta = Tdelta;
+		readerVars = NULL;
+		reader = NULL;
+		readerValues = NULL;
 		tmp_FMU_Path = buildFMU(FMU_Path);
 	}
 	~fmi_cosim();
@@ -92,6 +104,9 @@ public:
 	fmiStatus getParam(var* outParam);
 
 	fmiStatus getOutput(var* outVar);
+	// get n variables at once, each value reference once also if several of
+	// them are aliases of one another
+	fmiStatus getOutputs(var* outVars, int n);
 
 	fmiStatus unloadFMU();
 
@@ -0,0 +1,48 @@
+/**
+* @file dep_graph.hpp
+*
+* @brief Direct dependencies of the outputs of a model on its inputs.
+* The DirectDependency elements of the model description are resolved once, by
+* validate(), into a DepGraph of variable positions. A master uses it to find the
+* outputs that have direct feedthrough, and the outputs affected by a change of
+* some inputs, instead of assuming that every output depends on every input.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef DEP_GRAPH_HPP_
+#define DEP_GRAPH_HPP_
+
+#include <xml_parser.hpp>
+
+// Build md->deps from the modelVariables and their table. A Name that is not
+// an input is reported and makes its output depend on every input. If md is
+// filtered, Names of variables that the filter skipped are left out silently,
+// so the rows hold the selected inputs only.
+// Returns 0 to indicate failure
+int buildDepGraph(ModelDescription* md);
+
+// Returns the number of inputs the variable at position o depends on
+// directly and sets *inputs to their positions, ascending. Variables other
+// than outputs depend on no input.
+int getDependencies(ModelDescription* md, int o, const int** inputs);
+
+// Returns 1 if the variable at position o depends directly on the input at i
+int dependsOn(ModelDescription* md, int o, int i);
+
+// Returns 1 if the variable at position o depends directly on any input
+int hasFeedthrough(ModelDescription* md, int o);
+
+// Store the positions of the outputs that depend on any of the n inputs
+// in outputs, which has room for all variables.
+// Returns the number of outputs, -1 to indicate failure
+int reachableOutputs(ModelDescription* md, const int* inputs, int n,
+		int* outputs);
+
+// Store the positions of the inputs that any of the n outputs depends on
+// in inputs, ascending, which has room for all variables.
+// Returns the number of inputs, -1 to indicate failure
+int reachableInputs(ModelDescription* md, const int* outputs, int n,
+		int* inputs);
+
+#endif /* DEP_GRAPH_HPP_ */
@@ -25,6 +25,7 @@
 
 #include "fmiFunctions.h"
 #include "xml_parser.hpp"
+#include "fmu_profile.hpp"
 
 typedef const char* (*fGetTypesPlatform)();
 typedef const char* (*fGetVersion)();
@@ -57,9 +58,14 @@ typedef fmiStatus (*fGetIntegerStatus)(fmiComponent c, const fmiStatusKind s, fm
 typedef fmiStatus (*fGetBooleanStatus)(fmiComponent c, const fmiStatusKind s, fmiBoolean* value);
 typedef fmiStatus (*fGetStringStatus) (fmiComponent c, const fmiStatusKind s, fmiString*  value);
 
+struct FmuHost; // see fmu_host.hpp
+
 typedef struct {
     ModelDescription* modelDescription;
     HANDLE dllHandle;
+    int dllFd; // memory file the dll was loaded from, -1 if loaded from a path
+    struct FmuHost* host; // worker process calling the dll, NULL if called directly
+    FmuProfile profile; // time spent loading and initializing
     fGetTypesPlatform getTypesPlatform;
     fGetVersion getVersion;
     fSetDebugLogging setDebugLogging;
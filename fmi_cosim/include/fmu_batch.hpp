@@ -0,0 +1,69 @@
+/**
+* @file fmu_batch.hpp
+*
+* @brief Loading and initialization of many FMUs on a pool of threads.
+* Extraction, parsing and loading of the shared library run in parallel for all FMUs.
+* Instantiation and initialization run in parallel for FMUs with different shared
+* libraries; instances sharing a library are created one after the other and at most
+* once if the FMU declares canBeInstantiatedOnlyOncePerProcess. Loading with
+* FMU_LOAD_PRIVATE gives every FMU its own copy of the library, so that also several
+* instances of such an FMU can be initialized and stepped concurrently. With
+* FMU_LOAD_HOSTED every FMU runs in its own worker process.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_BATCH_HPP_
+#define FMU_BATCH_HPP_
+
+#include <stdio.h>
+#include <fmi_cosim.h>
+
+#define FMU_BATCH_NAME_SIZE 64
+
+// one FMU of a batch, times are in seconds since the batch was created
+typedef struct {
+	const char* fmuPath;     // path of the FMU archive
+	FMU fmu;                 // model description and functions, valid after loading
+	char* tmpPath;           // extraction directory, NULL if loaded from memory
+	fmiComponent c;          // instance, NULL until initialized
+	char instanceName[FMU_BATCH_NAME_SIZE];
+	int ok;                  // 1 as long as all phases succeeded
+	double tLoadQueued, tLoadStart, tLoadEnd;
+	double tInitQueued, tInitStart, tInstantiated, tInitEnd;
+} FmuSlot;
+
+typedef struct {
+	FmuSlot* slots;
+	int n;
+	int nThreads;            // size of the thread pool
+	int loadFlags;           // FMU_LOAD_ flags passed to tryLoadFMU
+	double t0;               // creation time of the batch
+	fmiReal tStart, tStop;   // simulation interval passed to initializeSlave
+	fmiReal tStep, hStep;    // current step passed to doStep
+} FmuBatch;
+
+// nThreads <= 0 selects one thread per online processor,
+// loadFlags is a combination of the FMU_LOAD_ flags of support_cosim.hpp
+// Returns NULL to indicate failure
+FmuBatch* fmuBatchNew(const char** fmuPaths, int n, int nThreads,
+		int loadFlags);
+
+// Returns the number of FMUs that could not be loaded
+int fmuBatchLoad(FmuBatch* b);
+
+// Instantiate and initialize all loaded FMUs.
+// Returns the number of FMUs that are not initialized
+int fmuBatchInit(FmuBatch* b, fmiReal tStart, fmiReal tStop);
+
+// Do one communication step from t to t + h with all initialized FMUs.
+// Returns the number of FMUs that are not initialized or failed
+int fmuBatchDoStep(FmuBatch* b, fmiReal t, fmiReal h);
+
+// Print the phases of every FMU and the critical path of the startup
+void fmuBatchReport(FmuBatch* b, FILE* file);
+
+// Terminate and free all instances and unload all FMUs
+void fmuBatchFree(FmuBatch* b);
+
+#endif /* FMU_BATCH_HPP_ */
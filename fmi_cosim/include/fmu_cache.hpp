@@ -0,0 +1,46 @@
+/**
+* @file fmu_cache.hpp
+*
+* @brief Persistent cache of unpacked FMUs shared by concurrent processes.
+* An entry is keyed by a hash of the archive and the guid of its model description,
+* so repeated loads of the same FMU skip extraction entirely. Entries in use are
+* protected by shared file locks, unused entries are evicted in LRU order when the
+* cache grows beyond its size budget. Precompiled model descriptions, see md_image.hpp,
+* are kept in the cache as well and count against the same budget.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_CACHE_HPP_
+#define FMU_CACHE_HPP_
+
+#define FMU_CACHE_DEFAULT_BUDGET (1024UL * 1024 * 1024) // bytes
+
+// Enable the cache in directory dir with the given size budget in bytes.
+// The cache is also enabled when the environment variable FMU_CACHE_DIR is set,
+// FMU_CACHE_BUDGET_MB then overrides the default budget. Call it before any
+// thread loads FMUs, getFmuCacheDir() is safe to call from several threads.
+void setFmuCacheDir(const char* dir, unsigned long budget);
+
+// Returns NULL if the cache is disabled
+const char* getFmuCacheDir();
+
+// Returns the path of an unpacked copy of the FMU, ending with '/',
+// extracting it first if it is not in the cache yet. The entry stays locked
+// against eviction until fmuCacheRelease() is called for the returned path.
+// Returns NULL to indicate failure
+char* fmuCacheAcquire(const char* fmuPath);
+
+// Returns 1 if path was returned by fmuCacheAcquire(), 0 otherwise
+int fmuCacheRelease(const char* path);
+
+// Returns the path of the image of the model description with the given CRC-32
+// and size in the cache, NULL if the cache is disabled. The receiver must free it
+// and should set its modification time whenever it uses the image.
+char* fmuCacheImagePath(unsigned long crc, unsigned long size);
+
+// Evict entries and images until the cache fits its budget again, call it after
+// adding an image
+void fmuCacheTrim();
+
+#endif /* FMU_CACHE_HPP_ */
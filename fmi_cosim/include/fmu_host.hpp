@@ -0,0 +1,35 @@
+/**
+* @file fmu_host.hpp
+*
+* @brief Hosting of an FMU in a worker process.
+* The worker loads the shared library of the FMU, the master gets an FMU function table
+* of stubs that pass every call to the worker through a shared-memory ring. An FMU that
+* is not thread-safe can so be scaled across cores as processes, and a crash of the FMU
+* only terminates its worker: the calls of the master then return fmiFatal.
+* Log messages of the FMU are printed by the worker, the callback functions passed to
+* instantiateSlave are not called. Asynchronous doStep is not supported.
+* The worker is the executable fmu_worker, found through the environment variable
+* FMU_WORKER or else in the directory of the executable of the master.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_HOST_HPP_
+#define FMU_HOST_HPP_
+
+#include <fmi_cosim.h>
+
+// Start a worker process that loads the FMU at fmuPath with the given
+// FMU_LOAD_ flags, and set the functions of fmu to stubs calling the worker.
+// The model description of fmu must be set before.
+// Returns 0 to indicate failure
+int fmuHostStart(const char* fmuPath, FMU* fmu, int flags);
+
+// Stop the worker of fmu. Instances must be freed before.
+void fmuHostStop(FMU* fmu);
+
+// Main function of fmu_worker: serve the master through the channel passed
+// as file descriptor 3, see fmuHostStart()
+int fmuHostWorker(int argc, char* argv[]);
+
+#endif /* FMU_HOST_HPP_ */
@@ -0,0 +1,56 @@
+/**
+* @file fmu_pool.hpp
+*
+* @brief Pool of warm instances of one FMU for back-to-back simulation runs.
+* The FMU is loaded once and its instances are kept instantiated. A released instance
+* is recycled with resetSlave, so the next run only has to set its parameters and
+* initialize it. If the FMU does not support resetSlave, the instance is freed and
+* instantiated again instead, which still avoids loading the FMU for every run.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_POOL_HPP_
+#define FMU_POOL_HPP_
+
+#include <pthread.h>
+#include <fmi_cosim.h>
+
+#define FMU_POOL_NAME_SIZE 64
+
+typedef struct {
+	fmiComponent c;          // NULL if the instance has to be created again
+	int inUse;
+	char instanceName[FMU_POOL_NAME_SIZE];
+} PooledInstance;
+
+typedef struct {
+	FMU fmu;
+	char* tmpPath;           // see tryLoadFMU()
+	PooledInstance* instances;
+	int n;
+	int resetSupported;      // 0 once resetSlave failed
+	int instantiated;        // number of calls of instantiateSlave
+	int reused;              // number of instances recycled with resetSlave
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+} FmuPool;
+
+// Load the FMU with the given FMU_LOAD_ flags and instantiate n instances.
+// n is reduced to 1 if the FMU can be instantiated only once per process.
+// Returns NULL to indicate failure
+FmuPool* fmuPoolNew(const char* fmuPath, int n, int loadFlags);
+
+// Returns an instantiated, not yet initialized instance, waiting while all are
+// in use. The caller sets the parameters and calls initializeSlave.
+// Returns NULL to indicate failure
+fmiComponent fmuPoolAcquire(FmuPool* p);
+
+// Return an instance after terminateSlave, as instead of freeSlaveInstance.
+// It is reset for the next run or, if that fails, instantiated again.
+void fmuPoolRelease(FmuPool* p, fmiComponent c);
+
+// Free all instances and unload the FMU. No instance may be in use.
+void fmuPoolFree(FmuPool* p);
+
+#endif /* FMU_POOL_HPP_ */
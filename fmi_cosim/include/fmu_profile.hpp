@@ -0,0 +1,56 @@
+/**
+* @file fmu_profile.hpp
+*
+* @brief Timers for the phases of loading and initializing an FMU.
+* Every FMU records the time spent in each phase together with the number of bytes
+* extracted, variables parsed and functions resolved. The profile can be printed as
+* JSON or as a one-line summary.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_PROFILE_HPP_
+#define FMU_PROFILE_HPP_
+
+#include <stdio.h>
+
+typedef enum {
+	phase_extract,     // unzip, cache lookup or inflating into memory
+	phase_parse,       // parsing the model description
+	phase_dlopen,      // loading the shared library
+	phase_bind,        // resolving the functions of the shared library
+	phase_instantiate,
+	phase_initialize,
+	SIZEOF_PHASE
+} FmuPhase;
+
+typedef struct {
+	double seconds[SIZEOF_PHASE];
+	double total;          // wall time of loading plus initializing
+	long bytesExtracted;
+	int variables;         // scalar variables parsed
+	long astBytes;         // memory of the parsed model description
+	int symbols;           // functions resolved in the shared library
+} FmuProfile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const char* fmuPhaseNames[SIZEOF_PHASE];
+
+// monotonic time in seconds
+double fmuProfileNow();
+
+// add the time since start to the given phase, returns the current time
+double fmuProfileAdd(FmuProfile* p, FmuPhase phase, double start);
+
+void fmuProfileJson(const FmuProfile* p, const char* name, FILE* file);
+
+void fmuProfileSummary(const FmuProfile* p, const char* name, FILE* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FMU_PROFILE_HPP_ */
@@ -0,0 +1,36 @@
+/**
+* @file fmu_server.hpp
+*
+* @brief Simulation server keeping FMUs and their instances resident.
+* The server listens on a Unix domain socket. Every connection sends jobs, one per line:
+*
+*   run fmu=PATH [priority=N] [start=T] [stop=T] [step=H]
+*       [param:NAME=VALUE]... [input:NAME=VALUE]... [output:NAME]...
+*   load fmu=PATH
+*
+* A NAME with '*' or '?' stands for all variables matching it component by component,
+* e.g. output:heatingResistor.* or input:*.u=1.
+* Parameters are set before initializeSlave, inputs before every step. Jobs of all
+* connections are executed by a pool of worker threads, higher priority first. The
+* result of a run is streamed back while it is simulated:
+*
+*   columns time NAME...
+*   t TIME VALUE...      after initialization and after every step
+*   done STEPS
+*
+* or "error MESSAGE" if the job failed. A connection gets the result of a job before
+* its next job is read. Paths and values must not contain white space.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_SERVER_HPP_
+#define FMU_SERVER_HPP_
+
+// Serve jobs on socketPath with nThreads worker threads, nThreads <= 0 selects
+// one thread per online processor. FMUs are loaded with the given FMU_LOAD_
+// flags at their first use and stay loaded.
+// Returns only to indicate failure, with 0
+int fmuServerRun(const char* socketPath, int nThreads, int loadFlags);
+
+#endif /* FMU_SERVER_HPP_ */
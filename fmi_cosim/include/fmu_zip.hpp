@@ -0,0 +1,61 @@
+/**
+* @file fmu_zip.hpp
+*
+* @brief In-process reader for FMU archives. An FMU is a ZIP file; this reader understands
+* stored and deflate compressed entries, which is what FMU exporters produce, and extracts
+* single entries to a file descriptor or to memory without spawning an external unzip tool.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef FMU_ZIP_HPP_
+#define FMU_ZIP_HPP_
+
+#include <stddef.h>
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATE 8
+
+// one entry of the central directory
+typedef struct {
+	char* name;                 // path of the entry inside the archive, '\0' terminated
+	int method;                 // ZIP_METHOD_STORED or ZIP_METHOD_DEFLATE
+	unsigned long crc;          // CRC-32 of the uncompressed data
+	unsigned long compSize;     // size of the data as stored in the archive
+	unsigned long size;         // size of the uncompressed data
+	unsigned long headerOffset; // offset of the local file header in the archive
+} ZipEntry;
+
+typedef struct {
+	int fd;             // open archive
+	ZipEntry* entries;  // entries in central directory order
+	int n;              // number of entries
+} ZipArchive;
+
+// Returns NULL to indicate failure
+ZipArchive* zipOpen(const char* zipPath);
+void zipClose(ZipArchive* za);
+
+// Returns NULL if the archive has no entry with the given name
+ZipEntry* zipFind(ZipArchive* za, const char* name);
+
+// Inflate the entry and write it to fd.
+// Returns the number of bytes written, or -1 to indicate failure
+long zipExtractToFd(ZipArchive* za, ZipEntry* e, int fd);
+
+// Inflate the entry into a '\0' terminated heap buffer, size excludes the terminator.
+// The receiver must free the buffer. Returns NULL to indicate failure
+char* zipExtractToMemory(ZipArchive* za, ZipEntry* e, size_t* size);
+
+// Read the e->compSize bytes of the entry as stored in the archive, without
+// inflating or checking them. The receiver must free the buffer.
+// Returns NULL to indicate failure
+char* zipReadStored(ZipArchive* za, ZipEntry* e);
+
+// Extract all entries selected by the NULL terminated list of patterns into outPath,
+// which must end with a path separator. A pattern ending with '/' selects all entries
+// below that directory, any other pattern selects the entry with exactly that name.
+// Returns the number of bytes written, or -1 to indicate failure
+long zipExtract(ZipArchive* za, const char* outPath, const char** patterns);
+
+#endif /* FMU_ZIP_HPP_ */
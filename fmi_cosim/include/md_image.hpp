@@ -0,0 +1,51 @@
+/**
+* @file md_image.hpp
+*
+* @brief Precompiled model descriptions, stored as binary images and mapped into memory.
+* An image holds the complete AST of a parsed model description, including units, types,
+* variables with their decoded attributes, capabilities and the variable indexes. It is
+* keyed by the modelDescription.xml it was made from, as stored in the FMU: the image
+* keeps the stored bytes and is used only if they are equal. Loading an image maps it
+* read-only at the address it was written for, so it is used in place without parsing
+* or allocating anything. If that address is taken, the image is mapped elsewhere and
+* its pointers are relocated. A checksum over the image and a bounds check of all its
+* pointers reject damaged images.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef MD_IMAGE_HPP_
+#define MD_IMAGE_HPP_
+
+#include <stddef.h>
+#include <xml_parser.hpp>
+
+#define MD_IMAGE_VERSION 9
+
+// the modelDescription.xml an image is made from, as stored in the FMU
+typedef struct {
+	unsigned long crc;      // CRC-32 of the XML file
+	unsigned long size;     // size of the XML file
+	const char* stored;     // the bytes of the XML file as stored in the archive
+	size_t storedSize;
+} MdImageKey;
+
+// Write md to path, replacing an existing image atomically.
+// Returns 0 to indicate failure
+int mdImageSave(const char* path, ModelDescription* md, const MdImageKey* key);
+
+// Returns NULL if there is no image at path, if it was made for another
+// modelDescription.xml or by another version of the parser, or if it is damaged.
+// The receiver must call freeElement() to unmap the image.
+ModelDescription* mdImageLoad(const char* path, const MdImageKey* key);
+
+// Returns 1 if md was loaded with mdImageLoad(), 0 if it was parsed
+int mdIsImage(ModelDescription* md);
+
+// Returns the size of the image of md in bytes
+size_t mdImageSize(ModelDescription* md);
+
+// Unmap the image of md, see freeElement()
+void mdImageFree(ModelDescription* md);
+
+#endif /* MD_IMAGE_HPP_ */
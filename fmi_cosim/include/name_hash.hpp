@@ -0,0 +1,61 @@
+/**
+* @file name_hash.hpp
+*
+* @brief Perfect hash tables for a fixed vocabulary, generated by the compiler.
+* makeNameHash() searches a seed for which the hash maps every name of the vocabulary
+* to a slot of its own, so a lookup hashes the name once and compares it with at most
+* one candidate. The search runs at compile time, see the tables of xml_parser.cpp.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef NAME_HASH_HPP_
+#define NAME_HASH_HPP_
+
+#include <string.h>
+
+#define NAME_HASH_MAX_SEED 100000
+
+// SIZE is a power of two, at least twice the size of the vocabulary
+template<int SIZE>
+struct NameHash {
+	unsigned seed;           // NAME_HASH_MAX_SEED if no perfect hash was found
+	signed char slot[SIZE];  // index of the name hashed to the slot, -1 if none
+};
+
+// FNV-1a, the seed changes the offset basis
+constexpr unsigned nameHash(unsigned seed, const char* s) {
+	unsigned h = 2166136261u ^ (seed * 0x9e3779b9u);
+	for (; *s; s++)
+		h = (h ^ (unsigned char) *s) * 16777619u;
+	return h ^ (h >> 15);
+}
+
+template<int SIZE>
+constexpr NameHash<SIZE> makeNameHash(const char* const names[], int n) {
+	NameHash<SIZE> t = { };
+	for (t.seed = 0; t.seed < NAME_HASH_MAX_SEED; t.seed++) {
+		int i = 0;
+		for (int k = 0; k < SIZE; k++)
+			t.slot[k] = -1;
+		for (; i < n; i++) {
+			unsigned k = nameHash(t.seed, names[i]) & (SIZE - 1);
+			if (t.slot[k] != -1)
+				break; // collision, try the next seed
+			t.slot[k] = i;
+		}
+		if (i == n)
+			return t;
+	}
+	return t;
+}
+
+// Returns the index of name in names, -1 if it is not in the vocabulary
+template<int SIZE>
+inline int lookupName(const NameHash<SIZE>& t, const char* const names[],
+		const char* name) {
+	int i = t.slot[nameHash(t.seed, name) & (SIZE - 1)];
+	return i != -1 && !strcmp(name, names[i]) ? i : -1;
+}
+
+#endif /* NAME_HASH_HPP_ */
@@ -0,0 +1,50 @@
+/**
+* @file name_trie.hpp
+*
+* @brief Queries of the variables of a model by the structure of their names.
+* With variableNamingConvention="structured", names such as heatingResistor.R and
+* onOffController.reference are paths of components separated by '.'. validate()
+* builds a NameTrie of these components, so that all variables under a component,
+* or all variables matching a pattern, are found without comparing every name.
+* The trie stores each component once, however many names share it, and the names
+* of the variables are kept there only: getVariableName() rebuilds them.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef NAME_TRIE_HPP_
+#define NAME_TRIE_HPP_
+
+#include <xml_parser.hpp>
+
+// Build md->names from the names of the modelVariables
+// Returns 0 to indicate failure
+int buildNameTrie(ModelDescription* md);
+
+// Copy the name of the variable at position i of the modelVariables to name,
+// which has room for size chars, truncated as by snprintf(). name may be NULL
+// if size is 0.
+// Returns the length of the name
+int getVariableName(ModelDescription* md, int i, char* name, int size);
+
+// Returns a copy of the name of the variable at position i, NULL to indicate
+// failure. The receiver must call free() to release it.
+char* newVariableName(ModelDescription* md, int i);
+
+// Returns 1 if the variable at position i is named name
+int isVariableName(ModelDescription* md, int i, const char* name);
+
+// Returns the number of variables whose name starts with prefix and sets
+// *positions to their positions, sorted by component. "heatingResistor."
+// selects everything under heatingResistor, "heating" also heatingResistor.
+int findByPrefix(ModelDescription* md, const char* prefix,
+		const int** positions);
+
+// Store the positions of the variables whose name matches pattern in
+// positions, which has room for all variables. Patterns are matched
+// component by component, '*' matches any sequence of chars and '?' any
+// char within a component, e.g. *.R or heatingResistor.*
+// Returns the number of variables
+int findByPattern(ModelDescription* md, const char* pattern, int* positions);
+
+#endif /* NAME_TRIE_HPP_ */
@@ -10,6 +10,8 @@
 *
 **/
 
+// On Windows the FMU is unzipped with the 7z command line tool.
+// Elsewhere it is extracted in-process, see fmu_zip.hpp.
 // Used 7z options, version 4.57:
 // -x   Extracts files from an archive with their full paths in the current dir, or in an output dir if specified
 // -aoa Overwrite All existing files without prompt
@@ -65,13 +67,33 @@ extern "C" {
 #endif
 
 int unzip(const char *zipPath, const char *outPath);
+void setFmuWorkspace(const char* dir);
+const char* getFmuWorkspace();
+int removeTmpDir(const char* tmpPath);
+void setFmuMemoryLoading(int on);
 void fmuLogger(fmiComponent c, fmiString instanceName, fmiStatus status,
 		fmiString category, fmiString message, ...);
 ScalarVariable* getSV(FMU* fmu, char type, fmiValueReference vr);
 ScalarVariable* getSV_CS(FMU* fmu, char type, fmiValueReference vr);
 const char* fmiStatusToString(fmiStatus status);
 const char* fmiStatusToString_CS(fmiStatus status);
+// Returns the directory the FMU was extracted to, or NULL if it was loaded from memory
 char* loadFMU(char* fmuFileName, FMU *fmu);
+// flags of tryLoadFMU()
+#define FMU_LOAD_VERBOSE 1 // print the model description and the library path
+#define FMU_LOAD_PRIVATE 2 // private copy of the library with its own globals
+#define FMU_LOAD_HOSTED 4  // library loaded by a worker process, see fmu_host.hpp
+#define FMU_LOAD_PARALLEL_PARSE 8 // large model descriptions parsed on one thread
+                                  // per processor, see parseBufferParallel()
+int tryLoadFMU(const char* fmuFileName, FMU *fmu, char** tmpPath, int flags);
+// Returns 1 if md declares canBeInstantiatedOnlyOncePerProcess="true"
+int onlyOncePerProcess(ModelDescription* md);
+void freeFMU(FMU *fmu, char* tmpPath);
+void registerInstance(const char* instanceName, FMU* fmu);
+void unregisterInstance(const char* instanceName);
+FMU* getInstanceFMU(const char* instanceName);
+ModelDescription* inspectFMU(const char* fmuPath, const VarFilter* filter);
+void printInspection(const char* fmuPath, ModelDescription* md);
 
 #ifndef _MSC_VER
 typedef int boolean;
@@ -0,0 +1,58 @@
+/**
+* @file var_reader.hpp
+*
+* @brief Reading the values of a set of variables with few calls into the FMU.
+* Aliases share the value reference of their base variable, negated aliases with the
+* opposite sign. A VarReader gets every distinct value reference once, with one
+* fmiGet call per base type, and gives every variable its value, negated as needed,
+* see canonical and negated of VarTable.
+* This package is one of the different packages of hysim - hybrid simulation
+*
+**/
+
+#ifndef VAR_READER_HPP_
+#define VAR_READER_HPP_
+
+#include <fmi_cosim.h>
+
+// fmiGet calls of a VarReader
+#define READ_REAL    0
+#define READ_INTEGER 1 // also Enumeration
+#define READ_BOOLEAN 2
+#define READ_STRING  3
+#define READ_CALLS   4
+
+// value of a variable of any base type
+typedef union {
+	fmiReal r;
+	fmiInteger i;
+	fmiBoolean b;
+	fmiString s;
+} VarValue;
+
+typedef struct {
+	int n;                  // number of variables
+	unsigned char* call;    // READ_REAL etc. of each variable, READ_CALLS if none
+	int* slot;              // index of the value of each variable in its call
+	unsigned char* negated; // 1 if the value of the variable is negated
+	int nRefs[READ_CALLS];  // distinct value references of each call
+	fmiValueReference* refs[READ_CALLS];
+	fmiReal* reals;         // values of the last call, by slot
+	fmiInteger* integers;
+	fmiBoolean* booleans;
+	fmiString* strings;
+} VarReader;
+
+// Prepare the reading of the n variables of md at the given positions
+// Returns NULL to indicate failure
+VarReader* varReaderNew(ModelDescription* md, const int* positions, int n);
+
+// Store the values of the variables of r in values, which has room for r->n.
+// Values of variables of a failed call are undefined.
+// Returns the worst status of the calls
+fmiStatus varReaderGet(VarReader* r, FMU* fmu, fmiComponent c,
+		VarValue* values);
+
+void varReaderFree(VarReader* r);
+
+#endif /* VAR_READER_HPP_ */
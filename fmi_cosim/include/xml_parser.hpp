@@ -13,6 +13,8 @@
 #define XML_STATIC 
 #include "expat.h"
 #include "stack.hpp"
+#include "arena.hpp"
+#include <stddef.h>
 
 #ifndef fmiModelTypes_h
 #ifndef fmiPlatformTypes_h
@@ -22,13 +24,13 @@ typedef unsigned int fmiValueReference;
 #define fmiUndefinedValueReference (fmiValueReference)(-1)
 
 #define SIZEOF_ELM 31
-extern const char *elmNames[SIZEOF_ELM];
+extern const char* const elmNames[SIZEOF_ELM];
 
 #define SIZEOF_ATT 47
-extern const char *attNames[SIZEOF_ATT];
+extern const char* const attNames[SIZEOF_ATT];
 
 #define SIZEOF_ENU 13
-extern const char *enuNames[SIZEOF_ENU];
+extern const char* const enuNames[SIZEOF_ENU];
 
 // Elements
 typedef enum {
@@ -111,6 +113,7 @@ typedef enum {
 	att_canSignalEvents,
 	att_canBeInstantiatedOnlyOncePerProcess,
 	att_canNotUseMemoryManagementFunctions,
+	att_file,
 	att_entryPoint,
 	att_manualStart,
 	att_type
@@ -141,6 +144,7 @@ typedef struct {
 	Elm type;          // element type
 	const char** attributes; // null or n attribute value strings
 	int n;             // size of attributes, even number
+	unsigned long long attMask; // bit a is set if attribute a is present
 } Element;
 
 // AST node for element that has a list of elements 
@@ -149,6 +153,7 @@ typedef struct {
 	Elm type;          // element type
 	const char** attributes; // null or n attribute value strings
 	int n;             // size of attributes, even number
+	unsigned long long attMask; // bit a is set if attribute a is present
 	Element** list;   // null-terminated array of pointers to elements, not null
 } ListElement;
 
@@ -157,16 +162,38 @@ typedef struct {
 	Elm type;          // element type
 	const char** attributes; // null or n attribute value strings
 	int n;             // size of attributes, an even number
+	unsigned long long attMask; // bit a is set if attribute a is present
 	Element* typeSpec; // one of RealType, IntegerType etc.
 } Type;
 
+// Attributes of a ScalarVariable, decoded once after parsing, see validate()
+#define VAR_START   1
+#define VAR_NOMINAL 2
+#define VAR_MIN     4
+#define VAR_MAX     8
+
+typedef struct {
+	fmiValueReference vr;
+	Elm baseType;      // type of the typeSpec, elm_Real, elm_Integer etc.
+	Enu causality;     // the defaults of getEnumValue() if missing
+	Enu variability;
+	Enu alias;
+	int defined;       // VAR_START etc. for the values below that are defined
+	double start;      // of the variable, Boolean start values as 0 or 1
+	double nominal;    // of the variable or its declared type, else 1
+	double min;        // of the variable or its declared type
+	double max;
+} VarInfo;
+
 // AST node for element ScalarVariable
 typedef struct {
 	Elm type;          // element type
 	const char** attributes; // null or n attribute value strings
 	int n;             // size of attributes, even number
+	unsigned long long attMask; // bit a is set if attribute a is present
 	Element* typeSpec; // one of Real, Integer, etc
 	Element** directDependencies; // null or null-terminated list of Name
+	VarInfo info;      // typed attributes
 } ScalarVariable;
 
 // AST node for element CoSimulation_StandAlone and CoSimulation_Tool
@@ -174,21 +201,108 @@ typedef struct {
 	Elm type; // one of elm_CoSimulation_StandAlone and elm_CoSimulation_Tool
 	const char** attributes; // null or n attribute value strings
 	int n;                   // size of attributes, even number
+	unsigned long long attMask; // bit a is set if attribute a is present
 	Element* capabilities;   // a set of capability attributes
 	ListElement* model; // non-NULL to support tool coupling, NULL for standalone
 } CoSimulation;
 
+// Open addressing hash tables of the model variables, built by validate().
+// Slots hold the position of a variable in modelVariables plus 1, 0 if free,
+// and are probed linearly.
+typedef struct {
+	unsigned mask;     // number of slots - 1, at least twice the variables
+	unsigned* byName;
+	unsigned* byRef;   // by base type and vr, the first of aliases wins
+	unsigned typeMask; // the same for the position in typeDefinitions
+	unsigned* byType;  // by name
+} VarIndex;
+
+// Columns of the model variables by their position in modelVariables, built
+// by validate(), so that variables are selected by scans of small contiguous
+// arrays instead of visiting every node, see selectVariables()
+typedef struct {
+	int n;                      // number of variables
+	fmiValueReference* vr;
+	unsigned char* type;        // Elm of the base type, elm_Real etc.
+	unsigned char* causality;   // Enu, enu_input etc.
+	unsigned char* variability;
+	unsigned char* alias;
+	int* canonical;             // variable of the same value reference that is
+	                            // noAlias, else the first of them
+	unsigned char* negated;     // 1 if the value is minus that of the reference
+	int* declaredType;          // position in typeDefinitions, -1 if none
+	// attributes of the variable or else its declared type, see VarInfo
+	unsigned char* defined;     // VAR_NOMINAL etc. for the values defined
+	double* nominal;
+	double* min;
+	double* max;
+	int* unit;                  // position in units, -1 if none
+	int* displayUnit;
+	int nUnits;
+	const char** units;         // distinct units and display units
+} VarTable;
+
+// Direct dependencies of the outputs on the inputs in compressed sparse rows,
+// one row per variable by position in modelVariables, built by validate().
+// An output without DirectDependency depends on every input, its row is
+// empty and flagged in all, see getDependencies() in dep_graph.hpp.
+typedef struct {
+	int n;              // number of rows, the number of variables
+	int* start;         // n + 1 offsets, row o is deps[start[o]..start[o + 1]-1]
+	int* deps;          // positions of inputs, ascending in each row
+	unsigned char* all; // 1 for outputs that depend on every input
+	int nInputs;
+	int* inputs;        // positions of all inputs, ascending
+} DepGraph;
+
+// Trie of the components of the variable names, e.g. heatingResistor and R of
+// heatingResistor.R, built by validate(). The children of a node are sorted
+// by label and the variables under a node are a range of order, so that a
+// prefix selects a range, see name_trie.hpp. The trie holds the only copy of
+// the variable names, the path from the root to node[i] names variable i.
+typedef struct {
+	int n;                 // number of variables
+	int* order;            // positions of the variables sorted by component
+	int* node;             // node of the variable at each position
+	int nNodes;            // node 0 is the root, the empty name
+	int* first;            // children of node k are first[k]..first[k]+count[k]-1
+	int* count;
+	int* parent;           // -1 for the root
+	int* lo;               // variables under node k are order[lo[k]..lo[k]+size[k]-1]
+	int* size;
+	int* label;            // nNodes + 1 offsets, node k is labeled with
+	                       // labels[label[k]..label[k+1]-1]
+	char* labels;          // the labels of all nodes, not terminated
+	unsigned char* isVariable; // 1 if the path to node k names order[lo[k]]
+} NameTrie;
+
+// Selects variables by the columns of a VarTable. A column matches if the
+// bit of its value is set, e.g. 1 << elm_Real, no bits match any value.
+typedef struct {
+	unsigned types;
+	unsigned causalities;
+	unsigned variabilities;
+	unsigned aliases;
+} VarQuery;
+
 // AST node for element ModelDescription
 typedef struct {
 	Elm type;          // element type
 	const char** attributes; // null or n attribute value strings
 	int n;             // size of attributes, even number
+	unsigned long long attMask; // bit a is set if attribute a is present
 	ListElement** unitDefinitions;  // NULL or null-terminated list of BaseUnits
 	Type** typeDefinitions;    // NULL or null-terminated list of Types
 	Element* defaultExperiment;  // NULL or DefaultExperiment
 	ListElement** vendorAnnotations;  // NULL or null-terminated list of Tools
 	ScalarVariable** modelVariables; // NULL or null-terminated list of ScalarVariable
 	CoSimulation* cosimulation; // NULL if this ModelDescription is for model exchange only
+	Arena* arena;               // owns all nodes and strings of the AST
+	VarIndex* index;            // hash indexes of the modelVariables
+	VarTable* table;            // columns of the modelVariables
+	DepGraph* deps;             // direct dependencies of the outputs
+	NameTrie* names;            // components of the variable names
+	int filtered;               // 1 if parsed with a VarFilter, see parseFiltered()
 } ModelDescription;
 
 // types of AST nodes used to represent an element
@@ -201,6 +315,16 @@ typedef enum {
 	astModelDescription
 } AstNodeType;
 
+// Selects the ScalarVariables built by parseFiltered(). A variable is selected
+// if it matches every criterion given. The parser skips the others without
+// allocating anything, so the AST grows with the selection only.
+typedef struct {
+	int causalities;    // bits 1 << enu_input etc., 0 for any causality
+	int variabilities;  // bits 1 << enu_parameter etc., 0 for any variability
+	const char* name;   // NULL or pattern, '*' matches any sequence, '?' one char
+	int noDependencies; // 1 to skip the DirectDependency of selected variables
+} VarFilter;
+
 // Possible results when retrieving an attribute value from an element
 typedef enum {
 	valueMissing, valueDefined, valueIllegal
@@ -208,6 +332,16 @@ typedef enum {
 
 // Public methods: Parsing and low-level AST access
 ModelDescription* parse(const char* xmlPath);
+ModelDescription* parseBuffer(const char* xml, size_t size, const char* name);
+ModelDescription* parseFiltered(const char* xmlPath, const VarFilter* filter);
+ModelDescription* parseBufferFiltered(const char* xml, size_t size,
+		const char* name, const VarFilter* filter);
+ModelDescription* parseParallel(const char* xmlPath, int nThreads);
+ModelDescription* parseBufferParallel(const char* xml, size_t size,
+		const char* name, int nThreads);
+ModelDescription* parseBufferInSitu(char* xml, size_t size, const char* name,
+		const VarFilter* filter, int nThreads);
+int matchName(const char* pattern, const char* name);
 const char* getString(void* element, Att a);
 double getDouble(void* element, Att a, ValueStatus* vs);
 int getInt(void* element, Att a, ValueStatus* vs);
@@ -215,6 +349,8 @@ unsigned int getUInt(void* element, Att a, ValueStatus* vs);
 char getBoolean(void* element, Att a, ValueStatus* vs);
 Enu getEnumValue(void* element, Att a, ValueStatus* vs);
 void freeElement(void* element);
+AstNodeType getAstNodeType(Elm e);
+int getAstNodeSize(Elm e);
 
 // Convenience methods for AST access. To be used afer successful validation only.
 const char* getModelIdentifier(ModelDescription* md);
@@ -226,8 +362,11 @@ Enu getVariability(void* scalarVariable);
 Enu getAlias(void* scalarVariable);
 fmiValueReference getValueReference(void* scalarVariable);
 ScalarVariable* getVariableByName(ModelDescription* md, const char* name);
+int getVariablePosition(ModelDescription* md, const char* name);
 ScalarVariable* getVariable(ModelDescription* md, fmiValueReference vr,
 		Elm type);
+int getReferencePosition(ModelDescription* md, fmiValueReference vr,
+		Elm type);
 Type* getDeclaredType(ModelDescription* md, const char* declaredType);
 const char* getString2(ModelDescription* md, void* sv, Att a);
 const char * getDescription(ModelDescription* md, ScalarVariable* sv);
@@ -236,6 +375,7 @@ const char * getVariableAttributeString(ModelDescription* md,
 double getVariableAttributeDouble(ModelDescription* md, fmiValueReference vr,
 		Elm type, Att a, ValueStatus* vs);
 double getNominal(ModelDescription* md, fmiValueReference vr);
+int selectVariables(ModelDescription* md, const VarQuery* q, int* positions);
 
 #endif // xml_parser_h
 
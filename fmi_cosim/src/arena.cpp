@@ -0,0 +1,134 @@
+/*
+ * arena.cpp
+ *
+ * Allocations larger than a quarter block get a block of their own, which is
+ * put behind the current block, so the rest of the current block is not wasted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <arena.hpp>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#endif
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK 4096
+#define ALIGNED(n) (((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+#define HEADER_SIZE ALIGNED(sizeof(ArenaBlock))
+
+// Returns NULL to indicate failure
+static ArenaBlock* newBlock(Arena* a, size_t size) {
+	ArenaBlock* b = (ArenaBlock*) calloc(1, HEADER_SIZE + size);
+	if (!b)
+		return NULL;
+	b->size = size;
+	a->footprint += HEADER_SIZE + size;
+	return b;
+}
+
+Arena* arenaNew(size_t blockSize) {
+	Arena* a = (Arena*) calloc(1, sizeof(Arena));
+	if (!a)
+		return NULL;
+	if (blockSize < ARENA_MIN_BLOCK)
+		blockSize = blockSize ? ARENA_MIN_BLOCK : 64 * 1024;
+	a->blockSize = blockSize < ARENA_MAX_BLOCK ? blockSize : ARENA_MAX_BLOCK;
+	a->footprint = sizeof(Arena);
+	return a;
+}
+
+void* arenaAlloc(Arena* a, size_t size) {
+	ArenaBlock* b = a->blocks;
+	size = ALIGNED(size ? size : 1);
+	if (!b || b->size - b->used < size) {
+		if (size > a->blockSize / 4) {
+			// dedicated block, keep allocating from the current one
+			ArenaBlock* big = newBlock(a, size);
+			if (!big)
+				return NULL;
+			big->used = size;
+			if (b) {
+				big->next = b->next;
+				b->next = big;
+			} else
+				a->blocks = big;
+			a->used += size;
+			a->allocations++;
+			return (char*) big + HEADER_SIZE;
+		}
+		b = newBlock(a, a->blockSize);
+		if (!b)
+			return NULL;
+		b->next = a->blocks;
+		a->blocks = b;
+		if (a->blockSize < ARENA_MAX_BLOCK)
+			a->blockSize *= 2;
+	}
+	b->used += size;
+	a->used += size;
+	a->allocations++;
+	return (char*) b + HEADER_SIZE + b->used - size;
+}
+
+char* arenaStrndup(Arena* a, const char* s, size_t n) {
+	char* copy = (char*) arenaAlloc(a, n + 1);
+	if (copy)
+		memcpy(copy, s, n); // terminated, arena memory is zeroed
+	return copy;
+}
+
+char* arenaStrdup(Arena* a, const char* s) {
+	return arenaStrndup(a, s, strlen(s));
+}
+
+void arenaAdopt(Arena* a, void* buffer, size_t size, int mapped) {
+	assert(!a->buffer);
+	a->buffer = buffer;
+	a->bufferSize = size;
+	a->mapped = mapped;
+}
+
+void arenaRelease(void* buffer, size_t size, int mapped) {
+	if (!buffer)
+		return;
+#ifndef _MSC_VER
+	if (mapped) {
+		munmap(buffer, size);
+		return;
+	}
+#endif
+	free(buffer);
+}
+
+void arenaMerge(Arena* a, Arena* other) {
+	ArenaBlock** tail = a->blocks ? &a->blocks->next : &a->blocks;
+	ArenaBlock* last;
+	if (!other)
+		return;
+	if (other->blocks) {
+		for (last = other->blocks; last->next; last = last->next)
+			;
+		last->next = *tail;
+		*tail = other->blocks;
+	}
+	a->footprint += other->footprint - sizeof(Arena);
+	a->used += other->used;
+	a->allocations += other->allocations;
+	if (other->buffer)
+		arenaAdopt(a, other->buffer, other->bufferSize, other->mapped);
+	free(other);
+}
+
+void arenaFree(Arena* a) {
+	ArenaBlock* b;
+	if (!a)
+		return;
+	while ((b = a->blocks)) {
+		a->blocks = b->next;
+		free(b);
+	}
+	arenaRelease(a->buffer, a->bufferSize, a->mapped);
+	free(a);
+}
@@ -7,9 +7,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
 #include <iostream>
 #include <string>
 #include <cosim.hpp>
+#include <fmu_cache.hpp>
+#include <fmu_host.hpp>
+#include <var_reader.hpp>
+#include <name_trie.hpp>
 
 
 fmiStatus fmi_cosim::unloadFMU() {
@@ -19,14 +25,25 @@ fmiStatus fmi_cosim::unloadFMU() {
 
 	fmu_g.terminateSlave(c);
 	fmu_g.freeSlaveInstance(c);
-	dlclose(fmu_g.dllHandle);
+	if (fmu_g.host)
+		fmuHostStop(&fmu_g);
+	else
+		dlclose(fmu_g.dllHandle);
+	if (fmu_g.dllFd >= 0)
+		close(fmu_g.dllFd);
 	rm_tmpFMU(tmp_FMU_Path);
 #endif
+	varReaderFree(reader);
+	free(readerValues);
+	readerVars = NULL;
+	reader = NULL;
+	readerValues = NULL;
 	return fmiOK;
 }
 
 fmi_cosim::~fmi_cosim() {
-
+	varReaderFree(reader);
+	free(readerValues);
 }
 ;
 
@@ -65,9 +82,15 @@ void replaceRefsInMessage(const char* msg, char* buffer, int nBuffer,
 				if (nvr == 1) {
 					// vr of type detected, e.g. #r12#
 					ScalarVariable* sv = getSV_CS(fmu, type, vr);
-					const char* name = sv ? getName(sv) : "?";
-					sprintf(buffer + k, "%s", name);
-					k += strlen(name);
+					int position = sv ? getReferencePosition(
+							fmu->modelDescription, vr, sv->info.baseType) : -1;
+					if (position == -1)
+						k += snprintf(buffer + k, nBuffer - k, "?");
+					else
+						k += getVariableName(fmu->modelDescription, position,
+								buffer + k, nBuffer - k);
+					if (k > nBuffer - 1)
+						k = nBuffer - 1; // truncated
 					i += (n + 1);
 					c = msg[i];
 				} else {
@@ -88,6 +111,7 @@ void fmuLogger(fmiComponent c, fmiString instanceName, fmiStatus status,
 		fmiString category, fmiString message, ...) {
 	char msg[MAX_MSG_SIZE];
 	char* copy;
+	FMU* fmu;
 	va_list argp;
 
 	// replace C format strings
@@ -97,41 +121,49 @@ void fmuLogger(fmiComponent c, fmiString instanceName, fmiStatus status,
 	// replace e.g. ## and #r12#
 	copy = strdup(msg);
 
-	replaceRefsInMessage(copy, msg, MAX_MSG_SIZE, &fmi_cosim::fmu_g);
+	if (!instanceName)
+		instanceName = "?";
+	fmu = getInstanceFMU(instanceName);
+	replaceRefsInMessage(copy, msg, MAX_MSG_SIZE,
+			fmu ? fmu : &fmi_cosim::fmu_g);
 	free(copy);
 
 	// print the final message
-	if (!instanceName)
-		instanceName = "?";
 	if (!category)
 		category = "?";
 	printf("%s %s (%s): %s\n", fmiStatusToString_CS(status), instanceName,
 			category, msg);
 }
 
+// resolve the vr and type of v by its name, once
+// Returns the position of v, -1 if not found
+static int findVariable(var* v) {
+	ModelDescription* md = fmi_cosim::fmu_g.modelDescription;
+	int i = getVariablePosition(md, v->name);
+	if (i != -1) {
+		v->vr = md->table->vr[i];
+		v->variableParsed = true;
+		v->negated = md->table->negated[i];
+		v->type = (Elm) md->table->type[i];
+	}
+	return i;
+}
+
 fmiStatus fmi_cosim::setInput(var* tmp_in) {
 
-	ScalarVariable** vars = fmu_g.modelDescription->modelVariables;
-	fmiValueReference vr;
-	ScalarVariable* sv;
-	if (tmp_in->variableParsed == false) {
-		for (int k = 0; vars[k]; k++) {
-			sv = vars[k];
-			char* s = strdup(getName(sv));
-			if (strcmp(s, tmp_in->name) == 0) {
-				tmp_in->vr = getValueReference(sv);
-				tmp_in->variableParsed = true;
-				tmp_in->type = sv->typeSpec->type;
-			}
-		}
-	}
+	fmiReal r;
+	fmiInteger i;
+	if (tmp_in->variableParsed == false)
+		findVariable(tmp_in);
 	switch (tmp_in->type) {
 	case elm_Real:
-		tmp_in->stat = fmu_g.setReal(c, &tmp_in->vr, 1, &tmp_in->value.r);
+		r = tmp_in->negated ? -tmp_in->value.r : tmp_in->value.r;
+		tmp_in->stat = fmu_g.setReal(c, &tmp_in->vr, 1, &r);
 		break;
 	case elm_Integer:
 	case elm_Enumeration:
-		tmp_in->stat = fmu_g.setInteger(c, &tmp_in->vr, 1, &tmp_in->value.i);
+		i = tmp_in->negated ? -tmp_in->value.i : tmp_in->value.i;
+		tmp_in->stat = fmu_g.setInteger(c, &tmp_in->vr, 1, &i);
 		break;
 	case elm_Boolean:
 		tmp_in->stat = fmu_g.setBoolean(c, &tmp_in->vr, 1, &tmp_in->value.b);
@@ -140,7 +172,7 @@ fmiStatus fmi_cosim::setInput(var* tmp_in) {
 		tmp_in->stat = fmu_g.setString(c, &tmp_in->vr, 1, &tmp_in->value.s);
 		break;
 	default:
-		printf("Unexpected Type error %d", sv->typeSpec->type);
+		printf("Unexpected Type error %d", tmp_in->type);
 
 	}
 	return fmiOK;
@@ -158,27 +190,19 @@ fmiStatus fmi_cosim::getParam(var *tmp_in) {
 }
 fmiStatus fmi_cosim::getOutput(var* tmp_in) {
 
-	ScalarVariable** vars = fmu_g.modelDescription->modelVariables;
-	fmiValueReference vr;
-	ScalarVariable* sv;
-	if (tmp_in->variableParsed == false) {
-		for (int k = 0; vars[k]; k++) {
-			sv = vars[k];
-			char* s = strdup(getName(sv));
-			if (strcmp(s, tmp_in->name) == 0) {
-				tmp_in->vr = getValueReference(sv);
-				tmp_in->variableParsed = true;
-				tmp_in->type = sv->typeSpec->type;
-			}
-		}
-	}
+	if (tmp_in->variableParsed == false)
+		findVariable(tmp_in);
 	switch (tmp_in->type) {
 	case elm_Real:
 		tmp_in->stat = fmu_g.getReal(c, &tmp_in->vr, 1, &tmp_in->value.r);
+		if (tmp_in->negated)
+			tmp_in->value.r = -tmp_in->value.r;
 		break;
 	case elm_Integer:
 	case elm_Enumeration:
 		tmp_in->stat = fmu_g.getInteger(c, &tmp_in->vr, 1, &tmp_in->value.i);
+		if (tmp_in->negated)
+			tmp_in->value.i = -tmp_in->value.i;
 		break;
 	case elm_Boolean:
 		tmp_in->stat = fmu_g.getBoolean(c, &tmp_in->vr, 1, &tmp_in->value.b);
@@ -187,11 +211,74 @@ fmiStatus fmi_cosim::getOutput(var* tmp_in) {
 		tmp_in->stat = fmu_g.getString(c, &tmp_in->vr, 1, &tmp_in->value.s);
 		break;
 	default:
-		printf("Unexpected Type error %d", sv->typeSpec->type);
+		printf("Unexpected Type error %d", tmp_in->type);
 	}
 	return fmiOK;
 }
 
+// Returns a reader of the n variables vars, NULL to indicate failure
+static VarReader* newReader(var* vars, int n) {
+	int* positions = (int*) malloc((n ? n : 1) * sizeof(int));
+	VarReader* r = NULL;
+	int k;
+	for (k = 0; positions && k < n; k++) {
+		positions[k] = findVariable(&vars[k]);
+		if (positions[k] == -1) {
+			printf("Unknown variable %s\n", vars[k].name);
+			break;
+		}
+	}
+	if (positions && k == n)
+		r = varReaderNew(fmi_cosim::fmu_g.modelDescription, positions, n);
+	free(positions);
+	return r;
+}
+
+fmiStatus fmi_cosim::getOutputs(var* outVars, int n) {
+	VarValue* values;
+	fmiStatus status = fmiError;
+	int k;
+	if (!reader || readerVars != outVars || reader->n != n) {
+		// the variables are resolved once, like variableParsed of getOutput()
+		varReaderFree(reader);
+		free(readerValues);
+		reader = newReader(outVars, n);
+		readerValues = (VarValue*) malloc((n ? n : 1) * sizeof(VarValue));
+		readerVars = outVars;
+		if (!reader || !readerValues) {
+			varReaderFree(reader);
+			free(readerValues);
+			reader = NULL;
+			readerValues = NULL;
+		}
+	}
+	values = readerValues;
+	if (reader) {
+		status = varReaderGet(reader, &fmu_g, c, values);
+		for (k = 0; k < n; k++) {
+			switch (outVars[k].type) {
+			case elm_Real:
+				outVars[k].value.r = values[k].r;
+				break;
+			case elm_Integer:
+			case elm_Enumeration:
+				outVars[k].value.i = values[k].i;
+				break;
+			case elm_Boolean:
+				outVars[k].value.b = values[k].b;
+				break;
+			case elm_String:
+				outVars[k].value.s = values[k].s;
+				break;
+			default:
+				break;
+			}
+			outVars[k].stat = status;
+		}
+	}
+	return status;
+}
+
 int fmi_cosim::initFMU(double currTime, double endTime) {
 
 	const char* guid;                // global unique id of the fmu
@@ -203,6 +290,8 @@ int fmi_cosim::initFMU(double currTime, double endTime) {
 	fmiBoolean visible = fmiFalse;   // no simulator user interface
 	fmiBoolean interactive = fmiFalse; // simulation run without user interaction
 	fmiCallbackFunctions callbacks;  // called by the model during simulation
+	double t0 = fmuProfileNow();     // start of the instantiate phase
+	double start;
 
 // instantiate and initialize the fmu
 	md = fmu_g.modelDescription;
@@ -214,10 +303,13 @@ int fmi_cosim::initFMU(double currTime, double endTime) {
 	callbacks.stepFinished = NULL; // fmiDoStep has to be carried out synchronously
 	c = fmu_g.instantiateSlave(getModelIdentifier(md), guid, fmuLocation,
 			mimeType, timeout, visible, interactive, callbacks, fmiTrue);
+	start = fmuProfileAdd(&fmu_g.profile, phase_instantiate, t0);
 	if (!c)
 		return error("could not instantiate model");
 
 	fmiFlag = fmu_g.initializeSlave(c, currTime, fmiTrue, endTime);
+	fmu_g.profile.total += fmuProfileAdd(&fmu_g.profile, phase_initialize,
+			start) - t0;
 	if (fmiFlag > fmiWarning)
 		return error("could not initialize model");
 	return fmiOK;
@@ -236,10 +328,16 @@ int fmi_cosim::simulateFMU(double currTime, double deltaTime, double endTime) {
 }
 
 void fmi_cosim::rm_tmpFMU(const char* tmpPath) {
-	const char* fmt_cmd = "rm -rf";
-	char rmcmd[50];
-	sprintf(rmcmd, "%s %s", fmt_cmd, tmpPath);/*safe*/
-	system(rmcmd);
+	if (!tmpPath)
+		return; // loaded from memory, nothing was extracted
+	if (fmuCacheRelease(tmpPath)) {
+		printf("\n released cached FMU %s\n", tmpPath);
+		return; // the unpacked FMU stays in the cache
+	}
+	if (!removeTmpDir(tmpPath)) {
+		printf("\n could not remove temporary folder %s\n", tmpPath);
+		return;
+	}
 	printf("\n temporary folder for FMU unzip is removed\n");
 }
 
@@ -0,0 +1,169 @@
+/*
+ * dep_graph.cpp
+ *
+ * The rows are counted first, so the graph takes two arrays of the arena.
+ * Outputs that depend on every input share the list of all inputs instead
+ * of a row of their own, which would grow with outputs times inputs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dep_graph.hpp>
+
+static int compareInts(const void* a, const void* b) {
+	return *(const int*) a - *(const int*) b;
+}
+
+// Sort row [deps, deps + n) and remove duplicates
+// Returns the new length
+static int sortRow(int* deps, int n) {
+	int i, k = 0;
+	qsort(deps, n, sizeof(int), compareInts);
+	for (i = 0; i < n; i++)
+		if (!k || deps[k - 1] != deps[i])
+			deps[k++] = deps[i];
+	return k;
+}
+
+// Resolve the Names of the output at position o into deps. A filtered md
+// lacks the variables its VarFilter skipped, their Names stay unresolved.
+// Returns the length of its row, -1 if it depends on every input
+static int resolveRow(ModelDescription* md, int o, int* deps) {
+	ScalarVariable* sv = md->modelVariables[o];
+	Element** names = sv->directDependencies;
+	int n = 0, k, i;
+	if (!names)
+		return -1; // no DirectDependency element
+	for (k = 0; names[k]; k++) {
+		const char* name = getString(names[k], att_input);
+		i = name ? getVariablePosition(md, name) : -1;
+		if (i == -1 && name && md->filtered)
+			continue; // skipped by the filter
+		if (i == -1 || md->table->causality[i] != enu_input) {
+			printf("Warning: Output %s depends on %s, which is not an input\n",
+					getName(sv), name ? name : "?");
+			return -1;
+		}
+		deps[n++] = i;
+	}
+	return sortRow(deps, n);
+}
+
+int buildDepGraph(ModelDescription* md) {
+	VarTable* t = md->table;
+	DepGraph* g = (DepGraph*) arenaAlloc(md->arena, sizeof(DepGraph));
+	int edges = 0, o, k, n;
+	if (!g)
+		return 0;
+	g->n = t->n;
+	for (o = 0; o < t->n; o++) {
+		ScalarVariable* sv = md->modelVariables[o];
+		if (t->causality[o] == enu_input)
+			g->nInputs++;
+		for (k = 0; t->causality[o] == enu_output && sv->directDependencies
+				&& sv->directDependencies[k]; k++)
+			edges++;
+	}
+	g->start = (int*) arenaAlloc(md->arena, (t->n + 1) * sizeof(int));
+	g->deps = (int*) arenaAlloc(md->arena, edges * sizeof(int));
+	g->all = (unsigned char*) arenaAlloc(md->arena, t->n);
+	g->inputs = (int*) arenaAlloc(md->arena, g->nInputs * sizeof(int));
+	if (!g->start || !g->deps || !g->all || !g->inputs)
+		return 0;
+	for (o = 0, k = 0, edges = 0; o < t->n; o++) {
+		g->start[o] = edges;
+		if (t->causality[o] == enu_input)
+			g->inputs[k++] = o;
+		if (t->causality[o] != enu_output)
+			continue;
+		n = resolveRow(md, o, g->deps + edges);
+		if (n == -1)
+			g->all[o] = 1;
+		else
+			edges += n;
+	}
+	g->start[t->n] = edges;
+	md->deps = g;
+	return 1;
+}
+
+int getDependencies(ModelDescription* md, int o, const int** inputs) {
+	DepGraph* g = md->deps;
+	if (g->all[o]) {
+		*inputs = g->inputs;
+		return g->nInputs;
+	}
+	*inputs = g->deps + g->start[o];
+	return g->start[o + 1] - g->start[o];
+}
+
+int dependsOn(ModelDescription* md, int o, int i) {
+	const int* deps;
+	int lo = 0, hi = getDependencies(md, o, &deps);
+	while (lo < hi) { // binary search, rows are ascending
+		int mid = (lo + hi) / 2;
+		if (deps[mid] == i)
+			return 1;
+		if (deps[mid] < i)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+int hasFeedthrough(ModelDescription* md, int o) {
+	const int* deps;
+	return getDependencies(md, o, &deps) > 0;
+}
+
+int reachableOutputs(ModelDescription* md, const int* inputs, int n,
+		int* outputs) {
+	DepGraph* g = md->deps;
+	unsigned char* changed = (unsigned char*) calloc(g->n ? g->n : 1, 1);
+	const int* deps;
+	int count = 0, any = 0, o, k, m;
+	if (!changed)
+		return -1;
+	for (k = 0; k < n; k++)
+		if (md->table->causality[inputs[k]] == enu_input)
+			any = changed[inputs[k]] = 1;
+	for (o = 0; o < g->n; o++) {
+		if (md->table->causality[o] != enu_output)
+			continue;
+		if (g->all[o]) {
+			if (any)
+				outputs[count++] = o;
+			continue;
+		}
+		m = getDependencies(md, o, &deps);
+		for (k = 0; k < m && !changed[deps[k]]; k++)
+			;
+		if (k < m)
+			outputs[count++] = o;
+	}
+	free(changed);
+	return count;
+}
+
+int reachableInputs(ModelDescription* md, const int* outputs, int n,
+		int* inputs) {
+	DepGraph* g = md->deps;
+	unsigned char* used = (unsigned char*) calloc(g->n ? g->n : 1, 1);
+	const int* deps;
+	int count = 0, i, k, m;
+	if (!used)
+		return -1;
+	for (k = 0; k < n; k++) {
+		m = getDependencies(md, outputs[k], &deps);
+		for (i = 0; i < m && !g->all[outputs[k]]; i++)
+			used[deps[i]] = 1;
+		if (g->all[outputs[k]])
+			break; // every input is reached
+	}
+	for (i = 0; i < g->nInputs; i++)
+		if (k < n || used[g->inputs[i]])
+			inputs[count++] = g->inputs[i];
+	free(used);
+	return count;
+}
@@ -0,0 +1,277 @@
+/*
+ * fmu_batch.cpp
+ *
+ * Work items are handed to the threads of the pool through a shared counter.
+ * The load phase has one work item per FMU. The init phase has one work item
+ * per shared library, which instantiates and initializes all FMUs using that
+ * library in order, because instances of one library may share global state.
+ * Stepping is parallelized the same way. With FMU_LOAD_PRIVATE every FMU has
+ * its own copy of the library, so all work items are independent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fmi_cosim.h>
+#include <support_cosim.hpp>
+#include <fmu_batch.hpp>
+
+typedef void (*BatchTask)(FmuBatch* b, int i);
+
+typedef struct {
+	FmuBatch* b;
+	BatchTask task;
+	int* items;       // argument of task for each work item
+	int nItems;
+	int next;         // next work item to be taken
+} WorkQueue;
+
+static void* worker(void* arg) {
+	WorkQueue* q = (WorkQueue*) arg;
+	int i;
+	while ((i = __sync_fetch_and_add(&q->next, 1)) < q->nItems)
+		q->task(q->b, q->items[i]);
+	return NULL;
+}
+
+// run task for all items on the thread pool, returns when all are done
+static void runParallel(FmuBatch* b, BatchTask task, int* items, int nItems) {
+	WorkQueue q = { b, task, items, nItems, 0 };
+	int nThreads = b->nThreads < nItems ? b->nThreads : nItems;
+	pthread_t* threads = (pthread_t*) calloc(nThreads, sizeof(pthread_t));
+	int i, started = 0;
+	for (i = 0; threads && i < nThreads; i++)
+		if (pthread_create(&threads[i], NULL, worker, &q) == 0)
+			started++;
+	if (started == 0)
+		worker(&q); // no threads available, run in the calling thread
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+FmuBatch* fmuBatchNew(const char** fmuPaths, int n, int nThreads,
+		int loadFlags) {
+	FmuBatch* b = (FmuBatch*) calloc(1, sizeof(FmuBatch));
+	int i;
+	if (!b)
+		return NULL;
+	b->slots = (FmuSlot*) calloc(n, sizeof(FmuSlot));
+	if (!b->slots) {
+		free(b);
+		return NULL;
+	}
+	if (nThreads <= 0)
+		nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	b->nThreads = nThreads > 0 ? nThreads : 1;
+	b->n = n;
+	b->loadFlags = loadFlags;
+	for (i = 0; i < n; i++)
+		b->slots[i].fmuPath = fmuPaths[i];
+	b->t0 = fmuProfileNow();
+	return b;
+}
+
+static void loadSlot(FmuBatch* b, int i) {
+	FmuSlot* s = &b->slots[i];
+	s->tLoadStart = fmuProfileNow() - b->t0;
+	s->ok = tryLoadFMU(s->fmuPath, &s->fmu, &s->tmpPath, b->loadFlags);
+	s->tLoadEnd = fmuProfileNow() - b->t0;
+	if (!s->ok)
+		printf("error: could not load %s\n", s->fmuPath);
+	else
+		snprintf(s->instanceName, FMU_BATCH_NAME_SIZE, "%s_%d",
+				getModelIdentifier(s->fmu.modelDescription), i);
+}
+
+int fmuBatchLoad(FmuBatch* b) {
+	int* items = (int*) calloc(b->n, sizeof(int));
+	int i, failed = 0;
+	if (!items)
+		return b->n;
+	getFmuWorkspace(); // initialize the settings before the threads start
+	for (i = 0; i < b->n; i++) {
+		items[i] = i;
+		b->slots[i].tLoadQueued = fmuProfileNow() - b->t0;
+	}
+	runParallel(b, loadSlot, items, b->n);
+	free(items);
+	for (i = 0; i < b->n; i++)
+		failed += !b->slots[i].ok;
+	return failed;
+}
+
+static void initSlot(FmuBatch* b, FmuSlot* s) {
+	fmiCallbackFunctions callbacks;
+	fmiStatus fmiFlag;
+	ModelDescription* md = s->fmu.modelDescription;
+
+	callbacks.logger = (fmiCallbackLogger) (&fmuLogger);
+	callbacks.allocateMemory = calloc;
+	callbacks.freeMemory = free;
+	callbacks.stepFinished = NULL; // fmiDoStep has to be carried out synchronously
+	registerInstance(s->instanceName, &s->fmu);
+	s->tInitStart = fmuProfileNow() - b->t0;
+	s->c = s->fmu.instantiateSlave(s->instanceName, getString(md, att_guid),
+			NULL, "application/x-fmu-sharedlibrary", 1000, fmiFalse,
+			fmiFalse, callbacks, fmiTrue);
+	s->tInstantiated = fmuProfileNow() - b->t0;
+	s->fmu.profile.seconds[phase_instantiate] += s->tInstantiated
+			- s->tInitStart;
+	if (!s->c) {
+		printf("error: could not instantiate %s\n", s->instanceName);
+		s->ok = 0;
+		s->tInitEnd = s->tInstantiated;
+		return;
+	}
+	fmiFlag = s->fmu.initializeSlave(s->c, b->tStart, fmiTrue, b->tStop);
+	s->tInitEnd = fmuProfileNow() - b->t0;
+	s->fmu.profile.seconds[phase_initialize] += s->tInitEnd - s->tInstantiated;
+	s->fmu.profile.total += s->tInitEnd - s->tInitStart;
+	if (fmiFlag > fmiWarning) {
+		printf("error: could not initialize %s\n", s->instanceName);
+		s->ok = 0;
+	}
+}
+
+// 1 if the FMUs of both slots call the same library in the same process
+static int sharesLibrary(FmuSlot* a, FmuSlot* b) {
+	return a->fmu.dllHandle == b->fmu.dllHandle && a->fmu.host == b->fmu.host;
+}
+
+// initialize all slots sharing the shared library of slot i
+static void initGroup(FmuBatch* b, int i) {
+	int once = onlyOncePerProcess(b->slots[i].fmu.modelDescription);
+	int k, instances = 0;
+	for (k = i; k < b->n; k++) {
+		FmuSlot* s = &b->slots[k];
+		if (!s->ok || s->c || !sharesLibrary(s, &b->slots[i]))
+			continue;
+		if (once && instances > 0) {
+			printf(
+					"error: %s can be instantiated only once per process, %s not instantiated\n",
+					s->fmuPath, s->instanceName);
+			s->ok = 0;
+			continue;
+		}
+		initSlot(b, s);
+		instances++;
+	}
+}
+
+// Store one work item per shared library in items, the first slot using it.
+// Only slots that are ok and, if instantiated is set, have an instance count.
+// Returns the number of work items
+static int collectGroups(FmuBatch* b, int* items, int instantiated) {
+	int i, k, nItems = 0;
+	for (i = 0; i < b->n; i++) {
+		FmuSlot* s = &b->slots[i];
+		if (!s->ok || (s->c != NULL) != instantiated)
+			continue;
+		for (k = 0; k < i; k++)
+			if (b->slots[k].ok && sharesLibrary(&b->slots[k], s))
+				break;
+		if (k == i)
+			items[nItems++] = i;
+	}
+	return nItems;
+}
+
+int fmuBatchInit(FmuBatch* b, fmiReal tStart, fmiReal tStop) {
+	int* items = (int*) calloc(b->n, sizeof(int));
+	int i, nItems, failed = 0;
+	if (!items)
+		return b->n;
+	for (i = 0; i < b->n; i++)
+		b->slots[i].tInitQueued = fmuProfileNow() - b->t0;
+	nItems = collectGroups(b, items, 0);
+	b->tStart = tStart;
+	b->tStop = tStop;
+	runParallel(b, initGroup, items, nItems);
+	free(items);
+	for (i = 0; i < b->n; i++)
+		failed += !b->slots[i].c || !b->slots[i].ok;
+	return failed;
+}
+
+// step all instances sharing the shared library of slot i
+static void stepGroup(FmuBatch* b, int i) {
+	int k;
+	for (k = i; k < b->n; k++) {
+		FmuSlot* s = &b->slots[k];
+		if (!s->ok || !s->c || !sharesLibrary(s, &b->slots[i]))
+			continue;
+		if (s->fmu.doStep(s->c, b->tStep, b->hStep, fmiTrue) > fmiWarning) {
+			printf("error: could not complete the step of %s at t = %g\n",
+					s->instanceName, b->tStep);
+			s->ok = 0;
+		}
+	}
+}
+
+int fmuBatchDoStep(FmuBatch* b, fmiReal t, fmiReal h) {
+	int* items = (int*) calloc(b->n, sizeof(int));
+	int i, nItems, failed = 0;
+	if (!items)
+		return b->n;
+	nItems = collectGroups(b, items, 1);
+	b->tStep = t;
+	b->hStep = h;
+	runParallel(b, stepGroup, items, nItems);
+	free(items);
+	for (i = 0; i < b->n; i++)
+		failed += !b->slots[i].c || !b->slots[i].ok;
+	return failed;
+}
+
+void fmuBatchReport(FmuBatch* b, FILE* file) {
+	int i, critical = -1;
+	double end, criticalEnd = 0;
+	fprintf(file, "%-24s %9s %9s %9s %9s %9s %9s\n", "instance", "queued",
+			"load", "wait", "instant.", "init", "end");
+	for (i = 0; i < b->n; i++) {
+		FmuSlot* s = &b->slots[i];
+		end = s->c ? s->tInitEnd : s->tLoadEnd;
+		fprintf(file, "%-24s %9.6f %9.6f %9.6f %9.6f %9.6f %9.6f%s\n",
+				s->instanceName[0] ? s->instanceName : s->fmuPath,
+				s->tLoadStart - s->tLoadQueued, s->tLoadEnd - s->tLoadStart,
+				s->c ? s->tInitStart - s->tLoadEnd : 0,
+				s->c ? s->tInstantiated - s->tInitStart : 0,
+				s->c ? s->tInitEnd - s->tInstantiated : 0, end,
+				s->ok ? "" : " failed");
+		if (critical < 0 || end > criticalEnd) {
+			critical = i;
+			criticalEnd = end;
+		}
+	}
+	if (critical >= 0) {
+		FmuSlot* s = &b->slots[critical];
+		fprintf(file,
+				"critical path: %s, %d FMUs ready after %.6f s on %d threads\n",
+				s->instanceName[0] ? s->instanceName : s->fmuPath, b->n,
+				criticalEnd, b->nThreads);
+	}
+}
+
+void fmuBatchFree(FmuBatch* b) {
+	int i;
+	if (!b)
+		return;
+	for (i = 0; i < b->n; i++) {
+		FmuSlot* s = &b->slots[i];
+		if (s->c) {
+			s->fmu.terminateSlave(s->c);
+			s->fmu.freeSlaveInstance(s->c);
+			s->c = NULL;
+		}
+		if (s->instanceName[0])
+			unregisterInstance(s->instanceName);
+		if (s->fmu.modelDescription)
+			freeFMU(&s->fmu, s->tmpPath);
+		s->tmpPath = NULL;
+	}
+	free(b->slots);
+	free(b);
+}
@@ -0,0 +1,459 @@
+/*
+ * fmu_cache.cpp
+ *
+ * Layout of the cache directory:
+ *   .lock           exclusive while an entry is added or entries are evicted,
+ *                   shared while an entry is looked up
+ *   .tmpXXXXXX/     entry being extracted, renamed to its key when complete
+ *   <key>/          unpacked FMU, key = <crc32 and size of archive>-<guid>
+ *   <key>/.inuse    shared lock held by every process using the entry,
+ *                   its modification time records the last use for LRU eviction
+ *   <key>/.size     number of bytes extracted
+ *   .images/        precompiled model descriptions, see md_image.hpp, their
+ *                   modification time records the last use
+ * Entries and images share the budget and are evicted together in LRU order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <fmi_cosim.h>
+#include <support_cosim.hpp>
+#include <fmu_zip.hpp>
+#include <fmu_cache.hpp>
+
+#define CACHE_KEY_SIZE 128
+#define CACHE_IMAGES ".images"
+
+static char* cacheDir = NULL;
+static unsigned long cacheBudget = FMU_CACHE_DEFAULT_BUDGET;
+static int cacheConfigured = 0;
+static pthread_once_t cacheOnce = PTHREAD_ONCE_INIT;
+
+// entries acquired by this process, see fmuCacheRelease()
+typedef struct HeldEntry {
+	char* path;
+	int fd; // open .inuse file holding the shared lock
+	struct HeldEntry* next;
+} HeldEntry;
+static HeldEntry* held = NULL;
+static pthread_mutex_t heldLock = PTHREAD_MUTEX_INITIALIZER;
+
+void setFmuCacheDir(const char* dir, unsigned long budget) {
+	free(cacheDir);
+	cacheDir = dir ? strdup(dir) : NULL;
+	cacheBudget = budget;
+	cacheConfigured = 1;
+	if (cacheDir)
+		mkdir(cacheDir, 0755);
+}
+
+// Configure the cache from the environment unless setFmuCacheDir() was
+// called before, once, see getFmuCacheDir()
+static void configureCache() {
+	if (!cacheConfigured) {
+		const char* dir = getenv("FMU_CACHE_DIR");
+		const char* mb = getenv("FMU_CACHE_BUDGET_MB");
+		unsigned long budget = FMU_CACHE_DEFAULT_BUDGET;
+		if (mb && *mb)
+			budget = strtoul(mb, NULL, 10) * 1024 * 1024;
+		setFmuCacheDir(dir && *dir ? dir : NULL, budget);
+	}
+}
+
+// Loader threads call this concurrently, the first call configures the cache
+const char* getFmuCacheDir() {
+	pthread_once(&cacheOnce, configureCache);
+	return cacheDir;
+}
+
+// Returns 0 to indicate error
+static int hashArchive(const char* fmuPath, unsigned long* crc,
+		unsigned long* size) {
+	struct stat st;
+	void* p;
+	int fd = open(fmuPath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return 0;
+	*crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*) p, st.st_size);
+	*size = st.st_size;
+	munmap(p, st.st_size);
+	return 1;
+}
+
+// Copy the guid attribute of the root element of the model description into guid.
+// Returns 0 if not found or if it contains characters unsafe for a file name.
+static int scanGuid(const char* xml, char* guid, int n) {
+	const char* p = strstr(xml, "<fmiModelDescription");
+	const char* end = p ? strchr(p, '>') : NULL;
+	int k = 0;
+	char quote;
+	if (!end)
+		return 0;
+	for (; p < end; p++)
+		if ((p[0] == ' ' || p[0] == '\t' || p[0] == '\n' || p[0] == '\r')
+				&& !strncmp(p + 1, "guid=", 5))
+			break;
+	if (p >= end)
+		return 0;
+	p += 6;
+	quote = *p++;
+	while (p < end && *p != quote && k < n - 1) {
+		char c = *p++;
+		if (c == '/' || c == '.' || c == '\\' || c < ' ')
+			return 0;
+		guid[k++] = c;
+	}
+	guid[k] = '\0';
+	return k > 0 && *p == quote;
+}
+
+// Returns 0 to indicate error
+static int getCacheKey(const char* fmuPath, char* key) {
+	unsigned long crc, size;
+	char guid[CACHE_KEY_SIZE / 2];
+	char* xml;
+	ZipEntry* e;
+	ZipArchive* za;
+	int ok;
+	if (!hashArchive(fmuPath, &crc, &size))
+		return 0;
+	za = zipOpen(fmuPath);
+	if (!za)
+		return 0;
+	e = zipFind(za, XML_FILE);
+	xml = e ? zipExtractToMemory(za, e, NULL) : NULL;
+	zipClose(za);
+	ok = xml && scanGuid(xml, guid, sizeof(guid));
+	free(xml);
+	if (!ok) {
+		printf("error: no guid found in %s of %s\n", XML_FILE, fmuPath);
+		return 0;
+	}
+	sprintf(key, "%08lx%08lx-%s", crc & 0xFFFFFFFFUL, size & 0xFFFFFFFFUL,
+			guid);
+	return 1;
+}
+
+// room is left for appending a trailing '/'
+static char* joinPath(const char* dir, const char* name, const char* suffix) {
+	char* path = (char*) calloc(sizeof(char),
+			strlen(dir) + strlen(name) + strlen(suffix) + 3);
+	if (path)
+		sprintf(path, "%s/%s%s", dir, name, suffix);
+	return path;
+}
+
+// Open the .inuse file of the entry at entryPath (ending with '/') and take
+// a lock of the given kind. Returns -1 if the entry does not exist or is locked.
+static int lockEntry(const char* entryPath, int operation) {
+	char* path = joinPath(entryPath, "", ".inuse");
+	int fd = path ? open(path, O_RDWR | O_CLOEXEC) : -1;
+	free(path);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, operation) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static unsigned long readEntrySize(const char* entryPath) {
+	unsigned long size = 0;
+	char* path = joinPath(entryPath, "", ".size");
+	FILE* file = path ? fopen(path, "r") : NULL;
+	free(path);
+	if (file) {
+		if (fscanf(file, "%lu", &size) != 1)
+			size = 0;
+		fclose(file);
+	}
+	return size;
+}
+
+// Extract the FMU into a temporary directory of the cache and publish it
+// as entry key. Must be called with the cache lock held exclusively.
+// Returns 0 to indicate error
+static int addEntry(const char* fmuPath, const char* key) {
+	char* tmpPath = joinPath(cacheDir, ".tmpXXXXXX", "");
+	char* entryPath = joinPath(cacheDir, key, "");
+	char* path;
+	FILE* file;
+	long n;
+	int fd, ok = 0;
+	if (!tmpPath || !entryPath || !mkdtemp(tmpPath))
+		goto done;
+	strcat(tmpPath, "/");
+	path = joinPath(tmpPath, "", ".inuse");
+	fd = path ? open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644) : -1;
+	free(path);
+	if (fd < 0)
+		goto done;
+	close(fd);
+	{
+		const char* selected[] = { XML_FILE, DLL_DIR, DLL_DIR2, NULL };
+		ZipArchive* za = zipOpen(fmuPath);
+		n = za ? zipExtract(za, tmpPath, selected) : -1;
+		zipClose(za);
+	}
+	if (n < 0)
+		goto done;
+	path = joinPath(tmpPath, "", ".size");
+	file = path ? fopen(path, "w") : NULL;
+	free(path);
+	if (!file)
+		goto done;
+	fprintf(file, "%ld\n", n);
+	fclose(file);
+	tmpPath[strlen(tmpPath) - 1] = '\0'; // rename does not like the trailing '/'
+	ok = rename(tmpPath, entryPath) == 0;
+	done: if (!ok && tmpPath) {
+		printf("error: could not add %s to the FMU cache %s\n", fmuPath,
+				cacheDir);
+		removeTmpDir(tmpPath);
+	}
+	free(tmpPath);
+	free(entryPath);
+	return ok;
+}
+
+// an entry or an image that may be evicted
+typedef struct {
+	char* path;
+	double used;            // time of the last use
+	unsigned long size;
+	int isImage;            // removed without a lock, mappings keep their pages
+} Evictable;
+
+// Returns the modification time of st in seconds
+static double modified(struct stat* st) {
+	return st->st_mtim.tv_sec + 1e-9 * st->st_mtim.tv_nsec;
+}
+
+// Append the images of the cache to *list, which has room for n elements and
+// grows as needed. Returns the new number of elements
+static int listImages(Evictable** list, int n, unsigned long* total) {
+	struct dirent** names;
+	char* dir = joinPath(cacheDir, CACHE_IMAGES, "");
+	Evictable* grown;
+	int i, m = dir ? scandir(dir, &names, NULL, NULL) : -1;
+	if (m < 0) {
+		free(dir);
+		return n;
+	}
+	grown = (Evictable*) realloc(*list, (n + m) * sizeof(Evictable));
+	for (i = 0; i < m; i++) {
+		struct stat st;
+		char* path;
+		if (grown && names[i]->d_name[0] != '.') {
+			// also half written images of crashed processes, see mdImageSave()
+			path = joinPath(dir, names[i]->d_name, "");
+			if (path && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+				grown[n].path = path;
+				grown[n].used = modified(&st);
+				grown[n].size = st.st_size;
+				grown[n++].isImage = 1;
+				*total += st.st_size;
+			} else
+				free(path);
+		}
+		free(names[i]);
+	}
+	free(names);
+	free(dir);
+	if (grown)
+		*list = grown;
+	return n;
+}
+
+// Remove stale temporary directories and evict unused entries and images,
+// least recently used first, until the cache fits its budget.
+// Must be called with the cache lock held exclusively.
+static void evictEntries() {
+	struct dirent** names;
+	Evictable* list;
+	unsigned long total = 0;
+	int i, k = 0, n = scandir(cacheDir, &names, NULL, NULL);
+	if (n < 0)
+		return;
+	list = (Evictable*) calloc(n ? n : 1, sizeof(Evictable));
+	for (i = 0; list && i < n; i++) {
+		const char* name = names[i]->d_name;
+		struct stat st;
+		char* path;
+		char* inuse;
+		if (!strncmp(name, ".tmp", 4)) {
+			char* tmp = joinPath(cacheDir, name, "");
+			removeTmpDir(tmp); // left behind by a crashed process
+			free(tmp);
+			continue;
+		}
+		if (name[0] == '.')
+			continue;
+		path = joinPath(cacheDir, name, "/");
+		inuse = joinPath(cacheDir, name, "/.inuse");
+		if (path && inuse && stat(inuse, &st) == 0) {
+			list[k].path = path;
+			list[k].used = modified(&st);
+			list[k].size = readEntrySize(path);
+			list[k].isImage = 0;
+			total += list[k++].size;
+		} else
+			free(path);
+		free(inuse);
+	}
+	if (list)
+		k = listImages(&list, k, &total);
+	while (list && total > cacheBudget) {
+		int oldest = -1, fd;
+		for (i = 0; i < k; i++)
+			if (list[i].path && (oldest < 0 || list[i].used < list[oldest].used))
+				oldest = i;
+		if (oldest < 0)
+			break; // everything left is in use
+		if (list[oldest].isImage) {
+			if (unlink(list[oldest].path) == 0)
+				total -= list[oldest].size;
+		} else {
+			fd = lockEntry(list[oldest].path, LOCK_EX | LOCK_NB);
+			if (fd >= 0) {
+				removeTmpDir(list[oldest].path);
+				close(fd);
+				total -= list[oldest].size;
+			}
+		}
+		free(list[oldest].path);
+		list[oldest].path = NULL;
+	}
+	for (i = 0; list && i < k; i++)
+		free(list[i].path);
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	free(list);
+}
+
+// Returns the open cache lock, -1 to indicate failure
+static int openCacheLock() {
+	char* lockPath = joinPath(cacheDir, ".lock", "");
+	int lockFd = lockPath ?
+			open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+	free(lockPath);
+	return lockFd;
+}
+
+char* fmuCacheImagePath(unsigned long crc, unsigned long size) {
+	char* path;
+	if (!getFmuCacheDir())
+		return NULL;
+	path = joinPath(cacheDir, CACHE_IMAGES, "/0123456789abcdef.mdi");
+	if (!path)
+		return NULL;
+	sprintf(path, "%s/%s", cacheDir, CACHE_IMAGES);
+	mkdir(path, 0755);
+	sprintf(path, "%s/%s/%08lx%08lx.mdi", cacheDir, CACHE_IMAGES,
+			crc & 0xFFFFFFFFUL, size & 0xFFFFFFFFUL);
+	return path;
+}
+
+void fmuCacheTrim() {
+	int lockFd;
+	if (!getFmuCacheDir())
+		return;
+	lockFd = openCacheLock();
+	if (lockFd < 0)
+		return;
+	flock(lockFd, LOCK_EX);
+	evictEntries();
+	flock(lockFd, LOCK_UN);
+	close(lockFd);
+}
+
+char* fmuCacheAcquire(const char* fmuPath) {
+	char key[CACHE_KEY_SIZE];
+	char* entryPath;
+	HeldEntry* h;
+	int lockFd, fd;
+	if (!getFmuCacheDir() || !getCacheKey(fmuPath, key))
+		return NULL;
+	entryPath = joinPath(cacheDir, key, "/");
+	lockFd = openCacheLock();
+	if (lockFd < 0 || !entryPath) {
+		printf("error: could not open the FMU cache %s\n", cacheDir);
+		if (lockFd >= 0)
+			close(lockFd);
+		free(entryPath);
+		return NULL;
+	}
+
+	// fast path: the entry exists, lookups of other processes may run concurrently
+	flock(lockFd, LOCK_SH);
+	fd = lockEntry(entryPath, LOCK_SH);
+	if (fd < 0) {
+		// slow path: extract the FMU, one process at a time
+		flock(lockFd, LOCK_EX);
+		fd = lockEntry(entryPath, LOCK_SH); // maybe added in the meantime
+		if (fd < 0 && addEntry(fmuPath, key)) {
+			fd = lockEntry(entryPath, LOCK_SH);
+			evictEntries();
+		}
+	}
+	if (fd >= 0)
+		futimens(fd, NULL); // mark as recently used
+	flock(lockFd, LOCK_UN);
+	close(lockFd);
+	if (fd < 0) {
+		free(entryPath);
+		return NULL;
+	}
+
+	h = (HeldEntry*) calloc(1, sizeof(HeldEntry));
+	if (!h) {
+		close(fd);
+		free(entryPath);
+		return NULL;
+	}
+	h->path = entryPath;
+	h->fd = fd;
+	pthread_mutex_lock(&heldLock);
+	h->next = held;
+	held = h;
+	pthread_mutex_unlock(&heldLock);
+	return strdup(entryPath);
+}
+
+int fmuCacheRelease(const char* path) {
+	HeldEntry** p;
+	HeldEntry* h = NULL;
+	pthread_mutex_lock(&heldLock);
+	for (p = &held; *p; p = &(*p)->next)
+		if (!strcmp((*p)->path, path)) {
+			h = *p;
+			*p = h->next;
+			break;
+		}
+	pthread_mutex_unlock(&heldLock);
+	if (!h)
+		return 0;
+	close(h->fd); // drops the shared lock
+	free(h->path);
+	free(h);
+	return 1;
+}
@@ -0,0 +1,1000 @@
+/*
+ * fmu_host.cpp
+ *
+ * The master and the worker share one HostChannel in a memory file. The
+ * worker is the separate executable fmu_worker, started with posix_spawn and
+ * given the memory file as HOST_CHANNEL_FD: fmuHostStart() runs on threads of
+ * a pool, and a forked copy of a threaded process may only call functions
+ * that are async-signal-safe, which loading an FMU is not.
+ * The master posts calls into a ring of slots and advances head, the worker
+ * executes them in order and advances tail. Both sides poll for a while
+ * before they sleep on a futex, and the other side only makes the wake-up
+ * system call when it sees the sleeping flag, so calls in quick succession
+ * cost no system call at all. Calls that only pass values into the FMU are
+ * not waited for; their worst status is returned by the next call the
+ * master waits for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+#include <fmi_cosim.h>
+#include <support_cosim.hpp>
+#include <fmu_host.hpp>
+
+#define HOST_RING_SIZE 16  // calls posted without waiting for the worker
+#define HOST_VALUES 64     // values per call, larger calls are split
+#define HOST_STRINGS 4096  // bytes of strings per call
+#define HOST_SPIN 20000    // polls before sleeping on the futex
+#define HOST_POLL_MS 100   // period of the check whether the peer is alive
+#define HOST_CHANNEL_FD 3  // the memory file of the channel in the worker
+#define HOST_WORKER "fmu_worker"
+
+extern char** environ;
+
+// operations of HostCall
+enum {
+	opExit,
+	opInstantiate,
+	opInitialize,
+	opTerminate,
+	opReset,
+	opFree,
+	opSetDebugLogging,
+	opSetReal,
+	opSetInteger,
+	opSetBoolean,
+	opSetString,
+	opGetReal,
+	opGetInteger,
+	opGetBoolean,
+	opGetString,
+	opSetRealInputDerivatives,
+	opGetRealOutputDerivatives,
+	opDoStep,
+	opCancelStep,
+	opGetStatus,
+	opGetRealStatus,
+	opGetIntegerStatus,
+	opGetBooleanStatus,
+	opGetStringStatus
+};
+
+typedef struct {
+	int op;
+	int async;              // 1 if the master does not wait for the result
+	int n;                  // number of values, of strings returned by getString
+	int flag;               // boolean arguments, status kind
+	uint64_t component;     // fmiComponent in the worker
+	fmiStatus status;
+	fmiReal t, h;           // times, timeout
+	fmiValueReference vr[HOST_VALUES];
+	fmiInteger i[HOST_VALUES];  // integers, derivative orders, status values
+	fmiReal r[HOST_VALUES];
+	fmiBoolean b[HOST_VALUES];
+	char s[HOST_STRINGS];   // strings, each terminated by '\0'
+} HostCall;
+
+typedef struct {
+	volatile unsigned head;     // number of calls posted by the master
+	volatile unsigned tail;     // number of calls completed by the worker
+	volatile unsigned ready;    // 1 when the worker loaded the FMU, 2 if it failed
+	volatile int masterSleeping;
+	volatile int workerSleeping;
+	volatile int deferred;      // worst status of the calls not waited for
+	HostCall calls[HOST_RING_SIZE];
+} HostChannel;
+
+struct FmuHost {
+	HostChannel* ch;
+	pid_t pid;
+	int dead;                   // 1 once the worker terminated
+	pthread_mutex_t lock;       // serializes the master threads using the worker
+	char* fmuPath;
+	char* guid;
+	struct FmuHost* next;
+};
+
+// fmiComponent of the stubs
+typedef struct {
+	FmuHost* host;
+	uint64_t component;         // fmiComponent in the worker
+	char* instanceName;
+	char* strings;              // returned by getString, valid until the next call
+	char* statusString;         // returned by getStringStatus
+} HostInstance;
+
+// all running workers of this process, see findHost()
+static FmuHost* hosts = NULL;
+static pthread_mutex_t hostsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void futexWait(volatile unsigned* word, unsigned old, int ms) {
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	syscall(SYS_futex, (unsigned*) word, FUTEX_WAIT, old, &ts, NULL, 0);
+}
+
+static void futexWake(volatile unsigned* word) {
+	syscall(SYS_futex, (unsigned*) word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+// In the worker, peer is the master: it is alive as long as it is the parent.
+// In the master, peer is the worker: it is alive as long as it is not reaped.
+static int peerAlive(pid_t peer) {
+	if (peer == getppid())
+		return 1;
+	return waitpid(peer, NULL, WNOHANG) == 0;
+}
+
+// Polling only pays off if the peer runs on another processor meanwhile.
+static int spinLimit() {
+	static int limit = -1;
+	if (limit < 0)
+		limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? HOST_SPIN : 0;
+	return limit;
+}
+
+// Wait until *word differs from old.
+// Returns 0 if the peer process terminated before.
+static int waitChange(volatile unsigned* word, unsigned old,
+		volatile int* sleeping, pid_t peer) {
+	int i, n = spinLimit();
+	for (i = 0; i < n; i++) {
+		if (*word != old)
+			return 1;
+		cpuRelax();
+	}
+	while (*word == old) {
+		*sleeping = 1;
+		__sync_synchronize();
+		if (*word == old)
+			futexWait(word, old, HOST_POLL_MS);
+		*sleeping = 0;
+		if (*word == old && !peerAlive(peer))
+			return 0;
+	}
+	return 1;
+}
+
+// publish a new value of *word, written before
+static void signalChange(volatile unsigned* word, volatile int* sleeping) {
+	__sync_synchronize();
+	if (*sleeping)
+		futexWake(word);
+}
+
+static void hostDied(FmuHost* h) {
+	if (!h->dead)
+		printf("error: the worker process %d of %s terminated\n", (int) h->pid,
+				h->fmuPath);
+	h->dead = 1;
+}
+
+// Returns the slot of the next call, waiting while the ring is full,
+// or NULL if the worker terminated. Must be called with h->lock held.
+static HostCall* nextCall(FmuHost* h) {
+	HostChannel* ch = h->ch;
+	unsigned tail;
+	while (!h->dead && ch->head - (tail = ch->tail) >= HOST_RING_SIZE)
+		if (!waitChange(&ch->tail, tail, &ch->masterSleeping, h->pid))
+			hostDied(h);
+	return h->dead ? NULL : &ch->calls[ch->head % HOST_RING_SIZE];
+}
+
+// Post the call returned by nextCall(). Unless async is set, wait for the
+// worker to complete it. Must be called with h->lock held.
+static fmiStatus post(FmuHost* h, HostCall* call, int async) {
+	HostChannel* ch = h->ch;
+	unsigned head = ch->head + 1;
+	unsigned tail;
+	fmiStatus status;
+	int deferred;
+	call->async = async;
+	__sync_synchronize();
+	ch->head = head;
+	signalChange(&ch->head, &ch->workerSleeping);
+	if (async)
+		return fmiOK;
+	while (!h->dead && (int) ((tail = ch->tail) - head) < 0)
+		if (!waitChange(&ch->tail, tail, &ch->masterSleeping, h->pid))
+			hostDied(h);
+	if (h->dead)
+		return fmiFatal;
+	__sync_synchronize();
+	status = call->status;
+	deferred = __sync_lock_test_and_set(&ch->deferred, fmiOK);
+	return deferred > status ? (fmiStatus) deferred : status;
+}
+
+// ---------------------------------------------------------------------------
+// worker
+
+static fmiBoolean flagBit(HostCall* call, int bit) {
+	return (call->flag & bit) ? fmiTrue : fmiFalse;
+}
+
+// unpack n strings packed one after the other into s
+static void unpackStrings(char* s, int n, fmiString* values) {
+	int k;
+	for (k = 0; k < n; k++) {
+		values[k] = s;
+		s += strlen(s) + 1;
+	}
+}
+
+static void execute(FMU* fmu, HostCall* call) {
+	fmiComponent c = (fmiComponent) (uintptr_t) call->component;
+	fmiString values[HOST_VALUES];
+	fmiString str;
+	fmiStatus status;
+	int k, used;
+	switch (call->op) {
+	case opInstantiate: {
+		fmiCallbackFunctions callbacks;
+		unpackStrings(call->s, 4, values);
+		callbacks.logger = (fmiCallbackLogger) (&fmuLogger);
+		callbacks.allocateMemory = calloc;
+		callbacks.freeMemory = free;
+		callbacks.stepFinished = NULL;
+		registerInstance(values[0], fmu);
+		c = fmu->instantiateSlave(values[0], values[1],
+				*values[2] ? values[2] : NULL, values[3], call->t,
+				flagBit(call, 1), flagBit(call, 2), callbacks, flagBit(call, 4));
+		if (!c)
+			unregisterInstance(values[0]);
+		call->component = (uintptr_t) c;
+		call->status = c ? fmiOK : fmiError;
+		break;
+	}
+	case opInitialize:
+		call->status = fmu->initializeSlave(c, call->t, flagBit(call, 1),
+				call->h);
+		break;
+	case opTerminate:
+		call->status = fmu->terminateSlave(c);
+		break;
+	case opReset:
+		call->status = fmu->resetSlave(c);
+		break;
+	case opFree:
+		fmu->freeSlaveInstance(c);
+		unregisterInstance(call->s);
+		call->status = fmiOK;
+		break;
+	case opSetDebugLogging:
+		call->status = fmu->setDebugLogging(c, flagBit(call, 1));
+		break;
+	case opSetReal:
+		call->status = fmu->setReal(c, call->vr, call->n, call->r);
+		break;
+	case opSetInteger:
+		call->status = fmu->setInteger(c, call->vr, call->n, call->i);
+		break;
+	case opSetBoolean:
+		call->status = fmu->setBoolean(c, call->vr, call->n, call->b);
+		break;
+	case opSetString:
+		unpackStrings(call->s, call->n, values);
+		call->status = fmu->setString(c, call->vr, call->n, values);
+		break;
+	case opGetReal:
+		call->status = fmu->getReal(c, call->vr, call->n, call->r);
+		break;
+	case opGetInteger:
+		call->status = fmu->getInteger(c, call->vr, call->n, call->i);
+		break;
+	case opGetBoolean:
+		call->status = fmu->getBoolean(c, call->vr, call->n, call->b);
+		break;
+	case opGetString:
+		// return as many strings as fit, the master asks for the rest
+		call->status = fmu->getString(c, call->vr, call->n, values);
+		for (k = 0, used = 0; call->status <= fmiWarning && k < call->n; k++) {
+			str = values[k] ? values[k] : "";
+			if (used + strlen(str) + 1 > HOST_STRINGS)
+				break;
+			strcpy(call->s + used, str);
+			used += strlen(str) + 1;
+		}
+		if (k == 0 && call->n > 0 && call->status <= fmiWarning) {
+			printf("error: string of %u longer than %d bytes\n", call->vr[0],
+					HOST_STRINGS - 1);
+			call->status = fmiError;
+		}
+		call->n = k;
+		break;
+	case opSetRealInputDerivatives:
+		call->status = fmu->setRealInputDerivatives(c, call->vr, call->n,
+				call->i, call->r);
+		break;
+	case opGetRealOutputDerivatives:
+		call->status = fmu->getRealOutputDerivatives(c, call->vr, call->n,
+				call->i, call->r);
+		break;
+	case opDoStep:
+		call->status = fmu->doStep(c, call->t, call->h, flagBit(call, 1));
+		break;
+	case opCancelStep:
+		call->status = fmu->cancelStep(c);
+		break;
+	case opGetStatus:
+		call->status = fmu->getStatus(c, (fmiStatusKind) call->flag, &status);
+		call->i[0] = status;
+		break;
+	case opGetRealStatus:
+		call->status = fmu->getRealStatus(c, (fmiStatusKind) call->flag,
+				call->r);
+		break;
+	case opGetIntegerStatus:
+		call->status = fmu->getIntegerStatus(c, (fmiStatusKind) call->flag,
+				call->i);
+		break;
+	case opGetBooleanStatus:
+		call->status = fmu->getBooleanStatus(c, (fmiStatusKind) call->flag,
+				call->b);
+		break;
+	case opGetStringStatus:
+		str = NULL;
+		call->status = fmu->getStringStatus(c, (fmiStatusKind) call->flag,
+				&str);
+		strncpy(call->s, str ? str : "", HOST_STRINGS - 1);
+		call->s[HOST_STRINGS - 1] = '\0';
+		break;
+	default:
+		call->status = fmiFatal;
+	}
+}
+
+// execute the calls of the master until it asks to exit or terminates
+static void serve(HostChannel* ch, FMU* fmu, pid_t master) {
+	unsigned tail = ch->tail;
+	HostCall* call;
+	int deferred;
+	for (;;) {
+		if (ch->head == tail
+				&& !waitChange(&ch->head, tail, &ch->workerSleeping, master))
+			return;
+		__sync_synchronize();
+		call = &ch->calls[tail % HOST_RING_SIZE];
+		if (call->op == opExit)
+			return;
+		execute(fmu, call);
+		while (call->async && call->status > (deferred = ch->deferred))
+			if (__sync_bool_compare_and_swap(&ch->deferred, deferred,
+					call->status))
+				break;
+		__sync_synchronize();
+		ch->tail = ++tail;
+		signalChange(&ch->tail, &ch->masterSleeping);
+	}
+}
+
+static void runWorker(HostChannel* ch, const char* fmuPath, int flags,
+		pid_t master) {
+	FMU fmu;
+	char* tmpPath;
+	int ok = tryLoadFMU(fmuPath, &fmu, &tmpPath, flags);
+	ch->ready = ok ? 1 : 2;
+	signalChange(&ch->ready, &ch->masterSleeping);
+	if (!ok)
+		return;
+	serve(ch, &fmu, master);
+	freeFMU(&fmu, tmpPath);
+}
+
+// arguments: pid of the master, FMU_LOAD_ flags, path of the FMU
+int fmuHostWorker(int argc, char* argv[]) {
+	HostChannel* ch;
+	pid_t master;
+	if (argc != 4) {
+		printf("usage: %s masterPid flags fmuPath\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	ch = (HostChannel*) mmap(NULL, sizeof(HostChannel),
+			PROT_READ | PROT_WRITE, MAP_SHARED, HOST_CHANNEL_FD, 0);
+	close(HOST_CHANNEL_FD);
+	if (ch == MAP_FAILED) {
+		printf("error: %s has no channel to the master\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	// no PR_SET_PDEATHSIG: it fires when the spawning thread exits, which may
+	// be a thread of a pool. The worker polls for the master instead.
+	master = (pid_t) atol(argv[1]);
+	if (getppid() == master)
+		runWorker(ch, argv[3], atoi(argv[2]), master);
+	fflush(stdout);
+	return EXIT_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------
+// stubs of the master
+
+// Returns the worker for a new instance: the one of the FMU registered for
+// instanceName, else the most recently started worker for the guid.
+static FmuHost* findHost(fmiString instanceName, fmiString guid) {
+	FMU* fmu = getInstanceFMU(instanceName);
+	FmuHost* h;
+	if (fmu && fmu->host)
+		return fmu->host;
+	pthread_mutex_lock(&hostsLock);
+	for (h = hosts; h; h = h->next)
+		if (!strcmp(h->guid, guid))
+			break;
+	pthread_mutex_unlock(&hostsLock);
+	return h;
+}
+
+// pack the strings into s, returns the number of bytes used
+// or -1 if they do not fit into size bytes
+static int packStrings(char* s, int size, fmiString* values, int n) {
+	int k, len, used = 0;
+	for (k = 0; k < n; k++) {
+		const char* str = values[k] ? values[k] : "";
+		len = strlen(str) + 1;
+		if (used + len > size)
+			return -1;
+		memcpy(s + used, str, len);
+		used += len;
+	}
+	return used;
+}
+
+static void* valuesOf(HostCall* call, int op) {
+	switch (op) {
+	case opSetReal:
+	case opGetReal:
+		return call->r;
+	case opSetInteger:
+	case opGetInteger:
+		return call->i;
+	default:
+		return call->b;
+	}
+}
+
+// pass the values of a set or get call in chunks of at most HOST_VALUES
+static fmiStatus callValues(fmiComponent c, int op, const fmiValueReference vr[],
+		size_t nvr, void* values, size_t size, int set) {
+	HostInstance* hi = (HostInstance*) c;
+	FmuHost* h = hi->host;
+	fmiStatus s, status = fmiOK;
+	HostCall* call;
+	size_t k, n;
+	pthread_mutex_lock(&h->lock);
+	for (k = 0; k < nvr && status <= fmiWarning; k += n) {
+		call = nextCall(h);
+		if (!call) {
+			status = fmiFatal;
+			break;
+		}
+		n = nvr - k < HOST_VALUES ? nvr - k : HOST_VALUES;
+		call->op = op;
+		call->component = hi->component;
+		call->n = n;
+		memcpy(call->vr, vr + k, n * sizeof(fmiValueReference));
+		if (set)
+			memcpy(valuesOf(call, op), (char*) values + k * size, n * size);
+		s = post(h, call, set);
+		if (!set)
+			memcpy((char*) values + k * size, valuesOf(call, op), n * size);
+		status = s > status ? s : status;
+	}
+	pthread_mutex_unlock(&h->lock);
+	return status;
+}
+
+// a call without values, result receives the value of the get*Status calls
+static fmiStatus simpleCall(fmiComponent c, int op, fmiReal t, fmiReal h,
+		int flag, void* result) {
+	HostInstance* hi = (HostInstance*) c;
+	HostCall* call;
+	fmiStatus status = fmiFatal;
+	pthread_mutex_lock(&hi->host->lock);
+	call = nextCall(hi->host);
+	if (call) {
+		call->op = op;
+		call->component = hi->component;
+		call->t = t;
+		call->h = h;
+		call->flag = flag;
+		status = post(hi->host, call, 0);
+	}
+	if (call && !hi->host->dead)
+		switch (op) {
+		case opGetStatus:
+			*(fmiStatus*) result = (fmiStatus) call->i[0];
+			break;
+		case opGetRealStatus:
+			*(fmiReal*) result = call->r[0];
+			break;
+		case opGetIntegerStatus:
+			*(fmiInteger*) result = call->i[0];
+			break;
+		case opGetBooleanStatus:
+			*(fmiBoolean*) result = call->b[0];
+			break;
+		case opGetStringStatus:
+			free(hi->statusString);
+			hi->statusString = strdup(call->s);
+			*(fmiString*) result = hi->statusString;
+			break;
+		}
+	pthread_mutex_unlock(&hi->host->lock);
+	return status;
+}
+
+static const char* hostGetTypesPlatform() {
+	return fmiPlatform;
+}
+
+static const char* hostGetVersion() {
+	return fmiVersion;
+}
+
+static fmiComponent hostInstantiateSlave(fmiString instanceName,
+		fmiString fmuGUID, fmiString fmuLocation, fmiString mimeType,
+		fmiReal timeout, fmiBoolean visible, fmiBoolean interactive,
+		fmiCallbackFunctions functions, fmiBoolean loggingOn) {
+	FmuHost* h = findHost(instanceName, fmuGUID);
+	HostInstance* hi;
+	HostCall* call;
+	fmiString strings[4] = { instanceName, fmuGUID, fmuLocation, mimeType };
+	fmiStatus status = fmiFatal;
+	(void) functions; // cannot be called from the worker, see fmu_host.hpp
+	if (!h) {
+		printf("error: no worker process for %s\n", instanceName);
+		return NULL;
+	}
+	hi = (HostInstance*) calloc(1, sizeof(HostInstance));
+	if (!hi)
+		return NULL;
+	hi->host = h;
+	hi->instanceName = strdup(instanceName);
+	pthread_mutex_lock(&h->lock);
+	call = nextCall(h);
+	if (call && packStrings(call->s, HOST_STRINGS, strings, 4) >= 0) {
+		call->op = opInstantiate;
+		call->t = timeout;
+		call->flag = (visible ? 1 : 0) | (interactive ? 2 : 0)
+				| (loggingOn ? 4 : 0);
+		status = post(h, call, 0);
+		hi->component = call->component;
+	}
+	pthread_mutex_unlock(&h->lock);
+	if (status > fmiWarning || !hi->component) {
+		free(hi->instanceName);
+		free(hi);
+		return NULL;
+	}
+	return hi;
+}
+
+static void hostFreeSlaveInstance(fmiComponent c) {
+	HostInstance* hi = (HostInstance*) c;
+	HostCall* call;
+	pthread_mutex_lock(&hi->host->lock);
+	call = nextCall(hi->host);
+	if (call) {
+		call->op = opFree;
+		call->component = hi->component;
+		strncpy(call->s, hi->instanceName, HOST_STRINGS - 1);
+		call->s[HOST_STRINGS - 1] = '\0';
+		post(hi->host, call, 0);
+	}
+	pthread_mutex_unlock(&hi->host->lock);
+	free(hi->instanceName);
+	free(hi->strings);
+	free(hi->statusString);
+	free(hi);
+}
+
+static fmiStatus hostInitializeSlave(fmiComponent c, fmiReal tStart,
+		fmiBoolean stopTimeDefined, fmiReal tStop) {
+	return simpleCall(c, opInitialize, tStart, tStop, stopTimeDefined ? 1 : 0, NULL);
+}
+
+static fmiStatus hostTerminateSlave(fmiComponent c) {
+	return simpleCall(c, opTerminate, 0, 0, 0, NULL);
+}
+
+static fmiStatus hostResetSlave(fmiComponent c) {
+	return simpleCall(c, opReset, 0, 0, 0, NULL);
+}
+
+static fmiStatus hostSetDebugLogging(fmiComponent c, fmiBoolean loggingOn) {
+	return simpleCall(c, opSetDebugLogging, 0, 0, loggingOn ? 1 : 0, NULL);
+}
+
+static fmiStatus hostDoStep(fmiComponent c, fmiReal t, fmiReal h,
+		fmiBoolean newStep) {
+	return simpleCall(c, opDoStep, t, h, newStep ? 1 : 0, NULL);
+}
+
+static fmiStatus hostCancelStep(fmiComponent c) {
+	return simpleCall(c, opCancelStep, 0, 0, 0, NULL);
+}
+
+static fmiStatus hostSetReal(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, const fmiReal value[]) {
+	return callValues(c, opSetReal, vr, nvr, (void*) value, sizeof(fmiReal), 1);
+}
+
+static fmiStatus hostSetInteger(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, const fmiInteger value[]) {
+	return callValues(c, opSetInteger, vr, nvr, (void*) value,
+			sizeof(fmiInteger), 1);
+}
+
+static fmiStatus hostSetBoolean(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, const fmiBoolean value[]) {
+	return callValues(c, opSetBoolean, vr, nvr, (void*) value,
+			sizeof(fmiBoolean), 1);
+}
+
+static fmiStatus hostGetReal(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, fmiReal value[]) {
+	return callValues(c, opGetReal, vr, nvr, value, sizeof(fmiReal), 0);
+}
+
+static fmiStatus hostGetInteger(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, fmiInteger value[]) {
+	return callValues(c, opGetInteger, vr, nvr, value, sizeof(fmiInteger), 0);
+}
+
+static fmiStatus hostGetBoolean(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, fmiBoolean value[]) {
+	return callValues(c, opGetBoolean, vr, nvr, value, sizeof(fmiBoolean), 0);
+}
+
+static fmiStatus hostSetString(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, const fmiString value[]) {
+	HostInstance* hi = (HostInstance*) c;
+	FmuHost* h = hi->host;
+	fmiStatus status = fmiOK;
+	HostCall* call;
+	size_t k, n;
+	int used, len;
+	pthread_mutex_lock(&h->lock);
+	for (k = 0; k < nvr; k += n) {
+		call = nextCall(h);
+		if (!call) {
+			status = fmiFatal;
+			break;
+		}
+		for (n = 0, used = 0; k + n < nvr && n < HOST_VALUES; n++) {
+			len = packStrings(call->s + used, HOST_STRINGS - used,
+					(fmiString*) value + k + n, 1);
+			if (len < 0)
+				break;
+			call->vr[n] = vr[k + n];
+			used += len;
+		}
+		if (n == 0) {
+			printf("error: string of %u longer than %d bytes\n", vr[k],
+					HOST_STRINGS - 1);
+			status = fmiError;
+			break;
+		}
+		call->op = opSetString;
+		call->component = hi->component;
+		call->n = n;
+		post(h, call, 1);
+	}
+	pthread_mutex_unlock(&h->lock);
+	return status;
+}
+
+// The strings stay valid until the next call of getString for the instance.
+static fmiStatus hostGetString(fmiComponent c, const fmiValueReference vr[],
+		size_t nvr, fmiString value[]) {
+	HostInstance* hi = (HostInstance*) c;
+	FmuHost* h = hi->host;
+	fmiStatus s, status = fmiOK;
+	HostCall* call;
+	size_t* offsets = (size_t*) calloc(nvr + 1, sizeof(size_t));
+	size_t k, n, size = 0, len;
+	char* strings = NULL;
+	char* p;
+	if (!offsets)
+		return fmiError;
+	pthread_mutex_lock(&h->lock);
+	for (k = 0; k < nvr && status <= fmiWarning; k += n) {
+		call = nextCall(h);
+		if (!call) {
+			status = fmiFatal;
+			break;
+		}
+		n = nvr - k < HOST_VALUES ? nvr - k : HOST_VALUES;
+		call->op = opGetString;
+		call->component = hi->component;
+		call->n = n;
+		memcpy(call->vr, vr + k, n * sizeof(fmiValueReference));
+		s = post(h, call, 0);
+		status = s > status ? s : status;
+		n = call->n;
+		if (status > fmiWarning || n == 0)
+			break;
+		// append the returned strings
+		for (len = 0, p = call->s; len < n; len++)
+			p += strlen(p) + 1;
+		p = (char*) realloc(strings, size + (p - call->s));
+		if (!p) {
+			status = fmiError;
+			break;
+		}
+		strings = p;
+		for (len = 0, p = call->s; len < n; len++) {
+			offsets[k + len] = size;
+			strcpy(strings + size, p);
+			size += strlen(p) + 1;
+			p += strlen(p) + 1;
+		}
+	}
+	pthread_mutex_unlock(&h->lock);
+	if (status <= fmiWarning)
+		for (k = 0; k < nvr; k++)
+			value[k] = strings + offsets[k];
+	free(hi->strings);
+	hi->strings = strings;
+	free(offsets);
+	return status;
+}
+
+static fmiStatus derivatives(fmiComponent c, int op,
+		const fmiValueReference vr[], size_t nvr, const fmiInteger order[],
+		fmiReal value[]) {
+	HostInstance* hi = (HostInstance*) c;
+	FmuHost* h = hi->host;
+	fmiStatus s, status = fmiOK;
+	HostCall* call;
+	size_t k, n;
+	pthread_mutex_lock(&h->lock);
+	for (k = 0; k < nvr && status <= fmiWarning; k += n) {
+		call = nextCall(h);
+		if (!call) {
+			status = fmiFatal;
+			break;
+		}
+		n = nvr - k < HOST_VALUES ? nvr - k : HOST_VALUES;
+		call->op = op;
+		call->component = hi->component;
+		call->n = n;
+		memcpy(call->vr, vr + k, n * sizeof(fmiValueReference));
+		memcpy(call->i, order + k, n * sizeof(fmiInteger));
+		if (op == opSetRealInputDerivatives)
+			memcpy(call->r, value + k, n * sizeof(fmiReal));
+		s = post(h, call, 0);
+		if (op == opGetRealOutputDerivatives)
+			memcpy(value + k, call->r, n * sizeof(fmiReal));
+		status = s > status ? s : status;
+	}
+	pthread_mutex_unlock(&h->lock);
+	return status;
+}
+
+static fmiStatus hostSetRealInputDerivatives(fmiComponent c,
+		const fmiValueReference vr[], size_t nvr, const fmiInteger order[],
+		const fmiReal value[]) {
+	return derivatives(c, opSetRealInputDerivatives, vr, nvr, order,
+			(fmiReal*) value);
+}
+
+static fmiStatus hostGetRealOutputDerivatives(fmiComponent c,
+		const fmiValueReference vr[], size_t nvr, const fmiInteger order[],
+		fmiReal value[]) {
+	return derivatives(c, opGetRealOutputDerivatives, vr, nvr, order, value);
+}
+
+static fmiStatus hostGetStatus(fmiComponent c, const fmiStatusKind s,
+		fmiStatus* value) {
+	return simpleCall(c, opGetStatus, 0, 0, s, value);
+}
+
+static fmiStatus hostGetRealStatus(fmiComponent c, const fmiStatusKind s,
+		fmiReal* value) {
+	return simpleCall(c, opGetRealStatus, 0, 0, s, value);
+}
+
+static fmiStatus hostGetIntegerStatus(fmiComponent c, const fmiStatusKind s,
+		fmiInteger* value) {
+	return simpleCall(c, opGetIntegerStatus, 0, 0, s, value);
+}
+
+static fmiStatus hostGetBooleanStatus(fmiComponent c, const fmiStatusKind s,
+		fmiBoolean* value) {
+	return simpleCall(c, opGetBooleanStatus, 0, 0, s, value);
+}
+
+static fmiStatus hostGetStringStatus(fmiComponent c, const fmiStatusKind s,
+		fmiString* value) {
+	return simpleCall(c, opGetStringStatus, 0, 0, s, value);
+}
+
+static void bindStubs(FMU* fmu) {
+	fmu->getTypesPlatform = hostGetTypesPlatform;
+	fmu->getVersion = hostGetVersion;
+	fmu->setDebugLogging = hostSetDebugLogging;
+	fmu->setReal = hostSetReal;
+	fmu->setInteger = hostSetInteger;
+	fmu->setBoolean = hostSetBoolean;
+	fmu->setString = hostSetString;
+	fmu->getReal = hostGetReal;
+	fmu->getInteger = hostGetInteger;
+	fmu->getBoolean = hostGetBoolean;
+	fmu->getString = hostGetString;
+	fmu->instantiateSlave = hostInstantiateSlave;
+	fmu->initializeSlave = hostInitializeSlave;
+	fmu->terminateSlave = hostTerminateSlave;
+	fmu->resetSlave = hostResetSlave;
+	fmu->freeSlaveInstance = hostFreeSlaveInstance;
+	fmu->getRealOutputDerivatives = hostGetRealOutputDerivatives;
+	fmu->setRealInputDerivatives = hostSetRealInputDerivatives;
+	fmu->doStep = hostDoStep;
+	fmu->cancelStep = hostCancelStep;
+	fmu->getStatus = hostGetStatus;
+	fmu->getRealStatus = hostGetRealStatus;
+	fmu->getIntegerStatus = hostGetIntegerStatus;
+	fmu->getBooleanStatus = hostGetBooleanStatus;
+	fmu->getStringStatus = hostGetStringStatus;
+}
+
+static void freeHost(FmuHost* h) {
+	munmap(h->ch, sizeof(HostChannel));
+	pthread_mutex_destroy(&h->lock);
+	free(h->fmuPath);
+	free(h->guid);
+	free(h);
+}
+
+// The worker executable is $FMU_WORKER if set, else HOST_WORKER in the
+// directory of the executable of this process
+// Returns NULL to indicate failure
+static char* getWorkerPath() {
+	const char* env = getenv("FMU_WORKER");
+	char exe[PATH_MAX];
+	char* slash;
+	char* path;
+	ssize_t n;
+	if (env && *env)
+		return strdup(env);
+	n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+	if (n <= 0)
+		return NULL;
+	exe[n] = '\0';
+	slash = strrchr(exe, '/');
+	if (!slash)
+		return NULL;
+	slash[1] = '\0';
+	path = (char*) malloc(strlen(exe) + strlen(HOST_WORKER) + 1);
+	if (path)
+		sprintf(path, "%s%s", exe, HOST_WORKER);
+	return path;
+}
+
+// Start the worker executable with the memory file fd of the channel
+// Returns 0 to indicate failure
+static int spawnWorker(FmuHost* h, int fd, int flags) {
+	posix_spawn_file_actions_t actions;
+	char* worker = getWorkerPath();
+	char master[24];
+	char flagsArg[24];
+	char* argv[5];
+	int err;
+	if (!worker)
+		return 0;
+	sprintf(master, "%ld", (long) getpid());
+	sprintf(flagsArg, "%d", flags);
+	argv[0] = worker;
+	argv[1] = master;
+	argv[2] = flagsArg;
+	argv[3] = h->fmuPath;
+	argv[4] = NULL;
+	fflush(stdout); // keep the order of the output of master and worker
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fd, HOST_CHANNEL_FD);
+	err = posix_spawn(&h->pid, worker, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (err)
+		printf("error: could not start %s: %s\n", worker, strerror(err));
+	free(worker);
+	return !err;
+}
+
+int fmuHostStart(const char* fmuPath, FMU* fmu, int flags) {
+	FmuHost* h = (FmuHost*) calloc(1, sizeof(FmuHost));
+	unsigned ready;
+	int fd;
+	if (!h)
+		return 0;
+	// close-on-exec, so that workers spawned meanwhile by other threads do
+	// not inherit it, the worker gets its copy as HOST_CHANNEL_FD
+	fd = memfd_create("fmu_host", MFD_CLOEXEC);
+	if (fd == HOST_CHANNEL_FD) {
+		// dup2 onto itself would keep close-on-exec set
+		int copy = fcntl(fd, F_DUPFD_CLOEXEC, HOST_CHANNEL_FD + 1);
+		close(fd);
+		fd = copy;
+	}
+	if (fd < 0 || ftruncate(fd, sizeof(HostChannel)) != 0) {
+		if (fd >= 0)
+			close(fd);
+		free(h);
+		return 0;
+	}
+	h->ch = (HostChannel*) mmap(NULL, sizeof(HostChannel),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h->ch == MAP_FAILED) {
+		close(fd);
+		free(h);
+		return 0;
+	}
+	pthread_mutex_init(&h->lock, NULL);
+	h->fmuPath = strdup(fmuPath);
+	h->guid = strdup(getString(fmu->modelDescription, att_guid));
+	if (!spawnWorker(h, fd, flags)) {
+		printf("error: could not start a worker process for %s\n", fmuPath);
+		close(fd);
+		freeHost(h);
+		return 0;
+	}
+	close(fd); // the mappings keep the memory file alive
+	while ((ready = h->ch->ready) == 0)
+		if (!waitChange(&h->ch->ready, 0, &h->ch->masterSleeping, h->pid))
+			break;
+	if (h->ch->ready != 1) {
+		printf("error: the worker process could not load %s\n", fmuPath);
+		waitpid(h->pid, NULL, 0);
+		freeHost(h);
+		return 0;
+	}
+	bindStubs(fmu);
+	fmu->host = h;
+	pthread_mutex_lock(&hostsLock);
+	h->next = hosts;
+	hosts = h;
+	pthread_mutex_unlock(&hostsLock);
+	return 1;
+}
+
+void fmuHostStop(FMU* fmu) {
+	FmuHost* h = fmu->host;
+	FmuHost** p;
+	HostCall* call;
+	if (!h)
+		return;
+	pthread_mutex_lock(&hostsLock);
+	for (p = &hosts; *p; p = &(*p)->next)
+		if (*p == h) {
+			*p = h->next;
+			break;
+		}
+	pthread_mutex_unlock(&hostsLock);
+	pthread_mutex_lock(&h->lock);
+	call = nextCall(h);
+	if (call) {
+		call->op = opExit;
+		post(h, call, 1);
+	}
+	pthread_mutex_unlock(&h->lock);
+	if (!h->dead)
+		waitpid(h->pid, NULL, 0);
+	freeHost(h);
+	fmu->host = NULL;
+}
@@ -0,0 +1,142 @@
+/*
+ * fmu_pool.cpp
+ *
+ * Instances are reset or created again outside of the lock of the pool,
+ * while they are still marked as in use, so concurrent runs only wait for
+ * the lock to take or return an instance.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fmi_cosim.h>
+#include <support_cosim.hpp>
+#include <fmu_pool.hpp>
+
+// Returns 0 to indicate failure
+static int instantiate(FmuPool* p, PooledInstance* pi) {
+	fmiCallbackFunctions callbacks;
+	ModelDescription* md = p->fmu.modelDescription;
+	callbacks.logger = (fmiCallbackLogger) (&fmuLogger);
+	callbacks.allocateMemory = calloc;
+	callbacks.freeMemory = free;
+	callbacks.stepFinished = NULL; // fmiDoStep has to be carried out synchronously
+	pi->c = p->fmu.instantiateSlave(pi->instanceName, getString(md, att_guid),
+			NULL, "application/x-fmu-sharedlibrary", 1000, fmiFalse, fmiFalse,
+			callbacks, fmiTrue);
+	if (!pi->c) {
+		printf("error: could not instantiate %s\n", pi->instanceName);
+		return 0;
+	}
+	__sync_fetch_and_add(&p->instantiated, 1);
+	return 1;
+}
+
+FmuPool* fmuPoolNew(const char* fmuPath, int n, int loadFlags) {
+	FmuPool* p = (FmuPool*) calloc(1, sizeof(FmuPool));
+	const char* modelId;
+	int i;
+	if (!p)
+		return NULL;
+	if (!tryLoadFMU(fmuPath, &p->fmu, &p->tmpPath, loadFlags)) {
+		free(p);
+		return NULL;
+	}
+	if (n > 1 && onlyOncePerProcess(p->fmu.modelDescription)) {
+		printf("warning: %s can be instantiated only once per process, "
+				"pool reduced to 1 instance\n", fmuPath);
+		n = 1;
+	}
+	p->instances = (PooledInstance*) calloc(n > 0 ? n : 1,
+			sizeof(PooledInstance));
+	if (!p->instances) {
+		freeFMU(&p->fmu, p->tmpPath);
+		free(p);
+		return NULL;
+	}
+	p->n = n > 0 ? n : 1;
+	p->resetSupported = 1;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->released, NULL);
+	modelId = getModelIdentifier(p->fmu.modelDescription);
+	for (i = 0; i < p->n; i++) {
+		PooledInstance* pi = &p->instances[i];
+		snprintf(pi->instanceName, FMU_POOL_NAME_SIZE, "%s_pool%d", modelId, i);
+		registerInstance(pi->instanceName, &p->fmu);
+		if (!instantiate(p, pi)) {
+			fmuPoolFree(p);
+			return NULL;
+		}
+	}
+	return p;
+}
+
+fmiComponent fmuPoolAcquire(FmuPool* p) {
+	PooledInstance* pi = NULL;
+	int i;
+	pthread_mutex_lock(&p->lock);
+	while (!pi) {
+		for (i = 0; i < p->n && !pi; i++)
+			if (!p->instances[i].inUse)
+				pi = &p->instances[i];
+		if (!pi)
+			pthread_cond_wait(&p->released, &p->lock);
+	}
+	pi->inUse = 1;
+	pthread_mutex_unlock(&p->lock);
+	// freed by a failed release, create it again
+	if (!pi->c && !instantiate(p, pi)) {
+		pthread_mutex_lock(&p->lock);
+		pi->inUse = 0;
+		pthread_cond_signal(&p->released);
+		pthread_mutex_unlock(&p->lock);
+		return NULL;
+	}
+	return pi->c;
+}
+
+void fmuPoolRelease(FmuPool* p, fmiComponent c) {
+	PooledInstance* pi = NULL;
+	int i;
+	pthread_mutex_lock(&p->lock);
+	for (i = 0; i < p->n && !pi; i++)
+		if (p->instances[i].inUse && p->instances[i].c == c)
+			pi = &p->instances[i];
+	pthread_mutex_unlock(&p->lock);
+	if (!pi) {
+		printf("error: instance not acquired from the pool of %s\n",
+				getModelIdentifier(p->fmu.modelDescription));
+		return;
+	}
+	if (p->resetSupported && p->fmu.resetSlave
+			&& p->fmu.resetSlave(c) <= fmiWarning)
+		__sync_fetch_and_add(&p->reused, 1);
+	else {
+		// reset not supported, create the instance anew at the next acquire
+		p->resetSupported = 0;
+		p->fmu.freeSlaveInstance(c);
+		pi->c = NULL;
+	}
+	pthread_mutex_lock(&p->lock);
+	pi->inUse = 0;
+	pthread_cond_signal(&p->released);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void fmuPoolFree(FmuPool* p) {
+	int i;
+	if (!p)
+		return;
+	for (i = 0; i < p->n; i++) {
+		PooledInstance* pi = &p->instances[i];
+		if (pi->c)
+			p->fmu.freeSlaveInstance(pi->c);
+		if (pi->instanceName[0])
+			unregisterInstance(pi->instanceName);
+	}
+	freeFMU(&p->fmu, p->tmpPath);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->released);
+	free(p->instances);
+	free(p);
+}
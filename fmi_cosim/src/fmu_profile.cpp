@@ -0,0 +1,63 @@
+/*
+ * fmu_profile.cpp
+ *
+ * Times are measured with the monotonic clock and reported in milliseconds.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <fmu_profile.hpp>
+
+const char* fmuPhaseNames[SIZEOF_PHASE] = { "extract", "parse", "dlopen",
+		"bind", "instantiate", "initialize" };
+
+double fmuProfileNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+double fmuProfileAdd(FmuProfile* p, FmuPhase phase, double start) {
+	double t = fmuProfileNow();
+	if (p)
+		p->seconds[phase] += t - start;
+	return t;
+}
+
+// print s as a JSON string, Windows paths contain backslashes
+static void printJsonString(const char* s, FILE* file) {
+	fputc('"', file);
+	for (; *s; s++)
+		if (*s == '"' || *s == '\\')
+			fprintf(file, "\\%c", *s);
+		else if ((unsigned char) *s < ' ')
+			fprintf(file, "\\u%04x", *s);
+		else
+			fputc(*s, file);
+	fputc('"', file);
+}
+
+void fmuProfileJson(const FmuProfile* p, const char* name, FILE* file) {
+	int i;
+	fprintf(file, "{\"fmu\": ");
+	printJsonString(name, file);
+	fprintf(file, ", \"totalMs\": %.3f, \"phasesMs\": {", 1e3 * p->total);
+	for (i = 0; i < SIZEOF_PHASE; i++)
+		fprintf(file, "%s\"%s\": %.3f", i ? ", " : "", fmuPhaseNames[i],
+				1e3 * p->seconds[i]);
+	fprintf(file,
+			"}, \"bytesExtracted\": %ld, \"variables\": %d, \"astBytes\": %ld, "
+					"\"symbols\": %d}\n", p->bytesExtracted, p->variables,
+			p->astBytes, p->symbols);
+}
+
+void fmuProfileSummary(const FmuProfile* p, const char* name, FILE* file) {
+	int i;
+	fprintf(file, "%s: %.3f ms (", name, 1e3 * p->total);
+	for (i = 0; i < SIZEOF_PHASE; i++)
+		fprintf(file, "%s%s %.3f", i ? ", " : "", fmuPhaseNames[i],
+				1e3 * p->seconds[i]);
+	fprintf(file, "), %ld bytes extracted, %d variables in %ld bytes, "
+			"%d symbols\n", p->bytesExtracted, p->variables, p->astBytes,
+			p->symbols);
+}
@@ -0,0 +1,674 @@
+/*
+ * fmu_server.cpp
+ *
+ * One thread per connection reads the jobs of the connection and queues them.
+ * Worker threads take the job with the highest priority, oldest first, from a
+ * binary heap and write its results directly to the connection. Every FMU
+ * gets a pool with one instance per worker thread at its first use, so a job
+ * for a resident FMU starts without loading or instantiating anything.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fmi_cosim.h>
+#include <support_cosim.hpp>
+#include <fmu_pool.hpp>
+#include <fmu_server.hpp>
+#include <name_trie.hpp>
+#include <var_reader.hpp>
+
+#define SERVER_LINE_SIZE 8192
+#define SERVER_MAX_TOKENS 512
+#define SERVER_MAX_CONNECTIONS 1024
+
+typedef struct {
+	char line[SERVER_LINE_SIZE];    // the tokens point into line
+	char* tokens[SERVER_MAX_TOKENS];
+	int nTokens;
+	int fd;                         // connection receiving the results
+	int priority;
+	unsigned long seq;              // orders jobs of equal priority
+	int done;
+} Job;
+
+// a line of results, which has no size limit as patterns may select any
+// number of outputs
+typedef struct {
+	char* data;
+	int length;
+	int size;
+} ResultLine;
+
+// value of a param:, input: or output: token
+typedef struct {
+	fmiValueReference vr;
+	Elm type;
+	int negated;        // 1 for negated aliases
+	int position;       // in the modelVariables
+	const char* name;   // NULL if matched by a pattern, see appendName()
+	const char* value;  // NULL for outputs
+} JobVariable;
+
+// loaded FMUs, keyed by the path given in the jobs
+typedef struct ResidentFmu {
+	char* fmuPath;
+	FmuPool* pool;                  // NULL until loaded
+	pthread_mutex_t lock;           // held while loading
+	struct ResidentFmu* next;
+} ResidentFmu;
+
+static ResidentFmu* residents = NULL;
+static pthread_mutex_t residentsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// queued jobs, a binary heap ordered by before()
+static Job* queue[SERVER_MAX_CONNECTIONS];
+static int queueSize = 0;
+static int connections = 0;
+static unsigned long jobSeq = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+
+static int serverThreads;
+static int serverLoadFlags;
+
+// Send the n bytes of buffer to the client.
+// Returns 0 if the client closed the connection
+static int sendAll(int fd, const char* buffer, int n) {
+	ssize_t sent;
+	int k = 0;
+	while (k < n) {
+		sent = send(fd, buffer + k, n - k, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return 0;
+		k += sent;
+	}
+	return 1;
+}
+
+// Send the formatted line to the client.
+// Returns 0 if the client closed the connection
+static int reply(int fd, const char* format, ...) {
+	char buffer[SERVER_LINE_SIZE];
+	va_list args;
+	int n;
+	va_start(args, format);
+	n = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (n >= (int) sizeof(buffer))
+		n = sizeof(buffer) - 1;
+	return sendAll(fd, buffer, n);
+}
+
+// Append the formatted text to line, growing it as needed.
+// Returns 0 to indicate failure
+static int append(ResultLine* line, const char* format, ...) {
+	va_list args;
+	char* grown;
+	int n, size;
+	for (;;) {
+		va_start(args, format);
+		n = vsnprintf(line->data + line->length, line->size - line->length,
+				format, args);
+		va_end(args);
+		if (n < 0)
+			return 0;
+		if (line->length + n < line->size)
+			break;
+		size = 2 * line->size > line->length + n + 1 ?
+				2 * line->size : line->length + n + 1;
+		grown = (char*) realloc(line->data, size);
+		if (!grown)
+			return 0;
+		line->data = grown;
+		line->size = size;
+	}
+	line->length += n;
+	return 1;
+}
+
+// 1 if job a is taken before job b
+static int before(Job* a, Job* b) {
+	return a->priority > b->priority
+			|| (a->priority == b->priority && a->seq < b->seq);
+}
+
+// Must be called with queueLock held. The queue has room for all jobs, as
+// every connection queues at most one job at a time.
+static void pushJob(Job* job) {
+	int i = queueSize++;
+	job->seq = jobSeq++;
+	while (i > 0 && before(job, queue[(i - 1) / 2])) {
+		queue[i] = queue[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	queue[i] = job;
+}
+
+// Must be called with queueLock held and a non-empty queue
+static Job* popJob() {
+	Job* top = queue[0];
+	Job* last = queue[--queueSize];
+	int i = 0, k;
+	while ((k = 2 * i + 1) < queueSize) {
+		if (k + 1 < queueSize && before(queue[k + 1], queue[k]))
+			k++;
+		if (!before(queue[k], last))
+			break;
+		queue[i] = queue[k];
+		i = k;
+	}
+	queue[i] = last;
+	return top;
+}
+
+// Returns the pool of the FMU, loading it at the first use.
+// Returns NULL to indicate failure
+static FmuPool* getPool(const char* fmuPath) {
+	ResidentFmu* r;
+	FmuPool* pool;
+	pthread_mutex_lock(&residentsLock);
+	for (r = residents; r; r = r->next)
+		if (!strcmp(r->fmuPath, fmuPath))
+			break;
+	if (!r) {
+		r = (ResidentFmu*) calloc(1, sizeof(ResidentFmu));
+		if (r) {
+			r->fmuPath = strdup(fmuPath);
+			pthread_mutex_init(&r->lock, NULL);
+			r->next = residents;
+			residents = r;
+		}
+	}
+	pthread_mutex_unlock(&residentsLock);
+	if (!r)
+		return NULL;
+	pthread_mutex_lock(&r->lock);
+	if (!r->pool)
+		r->pool = fmuPoolNew(fmuPath, serverThreads, serverLoadFlags);
+	pool = r->pool;
+	pthread_mutex_unlock(&r->lock);
+	return pool;
+}
+
+// Returns the value of the token key=value in job, or NULL
+static const char* findToken(Job* job, const char* key) {
+	int i, n = strlen(key);
+	for (i = 1; i < job->nTokens; i++)
+		if (!strncmp(job->tokens[i], key, n) && job->tokens[i][n] == '=')
+			return job->tokens[i] + n + 1;
+	return NULL;
+}
+
+static void setJobVariable(ModelDescription* md, int position,
+		const char* name, const char* value, JobVariable* v) {
+	v->vr = md->table->vr[position];
+	v->type = (Elm) md->table->type[position];
+	v->negated = md->table->negated[position];
+	v->position = position;
+	v->name = name;
+	v->value = value;
+}
+
+// Append the variables that match the pattern of a token to *vars, which
+// has room for size variables and grows as needed
+// Returns the new number of variables, -1 to indicate failure
+static int matchVariables(ModelDescription* md, const char* pattern,
+		const char* value, JobVariable** vars, int* size, int n) {
+	int* positions = (int*) malloc((md->table->n + 1) * sizeof(int));
+	JobVariable* grown;
+	int m, i;
+	if (!positions)
+		return -1;
+	m = findByPattern(md, pattern, positions);
+	grown = (JobVariable*) realloc(*vars, (*size + m) * sizeof(JobVariable));
+	if (!grown) {
+		free(positions);
+		return -1;
+	}
+	*vars = grown;
+	*size += m;
+	for (i = 0; i < m; i++, n++)
+		setJobVariable(md, positions[i], NULL, value, &grown[n]);
+	free(positions);
+	return n;
+}
+
+// Resolve the variables of all tokens prefix:NAME[=VALUE] of job into *vars,
+// which is allocated. A NAME with '*' or '?' selects all variables matching
+// it, see findByPattern().
+// Returns the number of variables, -1 if a variable does not exist
+static int findVariables(Job* job, ModelDescription* md, const char* prefix,
+		JobVariable** vars) {
+	int i, n = 0, k = strlen(prefix), size = job->nTokens, position;
+	char* name;
+	char* value;
+	*vars = (JobVariable*) calloc(size, sizeof(JobVariable));
+	if (!*vars) {
+		reply(job->fd, "error out of memory\n");
+		return -1;
+	}
+	for (i = 1; i < job->nTokens; i++) {
+		if (strncmp(job->tokens[i], prefix, k))
+			continue;
+		name = job->tokens[i] + k;
+		value = strchr(name, '=');
+		if (value)
+			*value++ = '\0';
+		if (strpbrk(name, "*?")) {
+			n = matchVariables(md, name, value, vars, &size, n);
+			if (n < 0) {
+				reply(job->fd, "error out of memory\n");
+				return -1;
+			}
+			continue;
+		}
+		position = getVariablePosition(md, name);
+		if (position == -1) {
+			reply(job->fd, "error unknown variable %s\n", name);
+			return -1;
+		}
+		setJobVariable(md, position, name, value, &(*vars)[n++]);
+	}
+	return n;
+}
+
+// Append " NAME" of v to line. The names of variables matched by a pattern
+// are rebuilt from the name trie, in place at the end of line.
+// Returns 0 to indicate failure
+static int appendName(ResultLine* line, ModelDescription* md, JobVariable* v) {
+	int n;
+	if (v->name)
+		return append(line, " %s", v->name);
+	n = getVariableName(md, v->position, NULL, 0);
+	if (!append(line, " %*s", n, ""))
+		return 0;
+	getVariableName(md, v->position, line->data + line->length - n, n + 1);
+	return 1;
+}
+
+static void replyNotSet(Job* job, ModelDescription* md, JobVariable* v) {
+	char* name = v->name ? NULL : newVariableName(md, v->position);
+	reply(job->fd, "error could not set %s\n",
+			v->name ? v->name : name ? name : "?");
+	free(name);
+}
+
+static fmiStatus setVariable(FMU* fmu, fmiComponent c, JobVariable* v) {
+	fmiReal r;
+	fmiInteger i;
+	fmiBoolean b;
+	fmiString s = v->value ? v->value : "";
+	switch (v->type) {
+	case elm_Real:
+		r = v->negated ? -strtod(s, NULL) : strtod(s, NULL);
+		return fmu->setReal(c, &v->vr, 1, &r);
+	case elm_Integer:
+	case elm_Enumeration:
+		i = v->negated ? -strtol(s, NULL, 10) : strtol(s, NULL, 10);
+		return fmu->setInteger(c, &v->vr, 1, &i);
+	case elm_Boolean:
+		b = !strcmp(s, "true") || !strcmp(s, "1");
+		return fmu->setBoolean(c, &v->vr, 1, &b);
+	case elm_String:
+		return fmu->setString(c, &v->vr, 1, &s);
+	default:
+		return fmiError;
+	}
+}
+
+// Append " value" of a variable of the given type to line.
+// Returns 0 to indicate failure
+static int formatValue(Elm type, VarValue* v, ResultLine* line) {
+	switch (type) {
+	case elm_Real:
+		return append(line, " %.17g", v->r);
+	case elm_Integer:
+	case elm_Enumeration:
+		return append(line, " %d", v->i);
+	case elm_Boolean:
+		return append(line, " %d", v->b ? 1 : 0);
+	case elm_String:
+		return append(line, " %s", v->s ? v->s : "");
+	default:
+		return 1;
+	}
+}
+
+// Send the line, or an error if it could not be formatted.
+// Returns 0 if the client closed the connection or the line is incomplete
+static int sendLine(Job* job, ResultLine* line, int ok) {
+	if (!ok || !append(line, "\n")) {
+		reply(job->fd, "error out of memory\n");
+		return 0;
+	}
+	return sendAll(job->fd, line->data, line->length);
+}
+
+// Returns 0 if the client closed the connection or a call failed
+static int sendRow(Job* job, FMU* fmu, fmiComponent c, fmiReal t,
+		JobVariable* outputs, VarReader* reader, VarValue* values,
+		ResultLine* line) {
+	int i, ok;
+	if (varReaderGet(reader, fmu, c, values) > fmiWarning) {
+		reply(job->fd, "error could not get the outputs\n");
+		return 0;
+	}
+	line->length = 0;
+	ok = append(line, "t %.17g", t);
+	for (i = 0; ok && i < reader->n; i++)
+		ok = formatValue(outputs[i].type, &values[i], line);
+	return sendLine(job, line, ok);
+}
+
+// Returns a reader of the n outputs, NULL to indicate failure
+static VarReader* newReader(ModelDescription* md, JobVariable* outputs, int n) {
+	int* positions = (int*) malloc((n ? n : 1) * sizeof(int));
+	VarReader* r = NULL;
+	int i;
+	if (!positions)
+		return NULL;
+	for (i = 0; i < n; i++)
+		positions[i] = outputs[i].position;
+	r = varReaderNew(md, positions, n);
+	free(positions);
+	return r;
+}
+
+static void runJob(Job* job) {
+	const char* fmuPath = findToken(job, "fmu");
+	const char* value;
+	fmiReal start = 0, stop = 1, step = 0.1, t;
+	JobVariable* params = NULL;
+	JobVariable* inputs = NULL;
+	JobVariable* outputs = NULL;
+	int nParams, nInputs, nOutputs, i, steps = 0, ok;
+	VarReader* reader = NULL;
+	VarValue* values = NULL;
+	FmuPool* pool;
+	FMU* fmu;
+	fmiComponent c;
+	ResultLine line = { NULL, 0, 0 };
+
+	if (!fmuPath) {
+		reply(job->fd, "error fmu=PATH missing\n");
+		return;
+	}
+	pool = getPool(fmuPath);
+	if (!pool) {
+		reply(job->fd, "error could not load %s\n", fmuPath);
+		return;
+	}
+	if (!strcmp(job->tokens[0], "load")) {
+		reply(job->fd, "done 0\n");
+		return;
+	}
+	if ((value = findToken(job, "start")))
+		start = strtod(value, NULL);
+	if ((value = findToken(job, "stop")))
+		stop = strtod(value, NULL);
+	if ((value = findToken(job, "step")))
+		step = strtod(value, NULL);
+	if (step <= 0 || stop < start) {
+		reply(job->fd, "error invalid interval\n");
+		return;
+	}
+
+	fmu = &pool->fmu;
+	nParams = findVariables(job, fmu->modelDescription, "param:", &params);
+	nInputs = nParams < 0 ? -1 :
+			findVariables(job, fmu->modelDescription, "input:", &inputs);
+	nOutputs = nInputs < 0 ? -1 :
+			findVariables(job, fmu->modelDescription, "output:", &outputs);
+	if (nOutputs >= 0) {
+		// aliases among the outputs are read once
+		reader = newReader(fmu->modelDescription, outputs, nOutputs);
+		values = (VarValue*) malloc((nOutputs ? nOutputs : 1) * sizeof(VarValue));
+		line.size = SERVER_LINE_SIZE;
+		line.data = (char*) malloc(line.size);
+		if (!reader || !values || !line.data) {
+			reply(job->fd, "error out of memory\n");
+			nOutputs = -1;
+		}
+	}
+	if (nOutputs < 0) {
+		free(params);
+		free(inputs);
+		free(outputs);
+		varReaderFree(reader);
+		free(values);
+		free(line.data);
+		return;
+	}
+
+	c = fmuPoolAcquire(pool);
+	ok = c != NULL;
+	if (!ok)
+		reply(job->fd, "error could not instantiate %s\n", fmuPath);
+	for (i = 0; ok && i < nParams; i++)
+		if (setVariable(fmu, c, &params[i]) > fmiWarning) {
+			replyNotSet(job, fmu->modelDescription, &params[i]);
+			ok = 0;
+		}
+	if (ok && fmu->initializeSlave(c, start, fmiTrue, stop) > fmiWarning) {
+		reply(job->fd, "error could not initialize %s\n", fmuPath);
+		ok = 0;
+	}
+	if (ok) {
+		ok = append(&line, "columns time");
+		for (i = 0; ok && i < nOutputs; i++)
+			ok = appendName(&line, fmu->modelDescription, &outputs[i]);
+		ok = sendLine(job, &line, ok)
+				&& sendRow(job, fmu, c, start, outputs, reader, values, &line);
+	}
+	// the last step ends at stop, also if step does not divide the interval
+	for (t = start; ok && t < stop - 1e-9 * step; t += step, steps++) {
+		fmiReal h = t + step > stop ? stop - t : step;
+		for (i = 0; ok && i < nInputs; i++)
+			if (setVariable(fmu, c, &inputs[i]) > fmiWarning) {
+				replyNotSet(job, fmu->modelDescription, &inputs[i]);
+				ok = 0;
+			}
+		if (ok && fmu->doStep(c, t, h, fmiTrue) > fmiWarning) {
+			reply(job->fd, "error could not complete the step at t = %g\n", t);
+			ok = 0;
+		}
+		ok = ok && sendRow(job, fmu, c, t + h, outputs, reader, values, &line);
+	}
+	if (c) {
+		fmu->terminateSlave(c);
+		fmuPoolRelease(pool, c);
+	}
+	if (ok)
+		reply(job->fd, "done %d\n", steps);
+	free(params);
+	free(inputs);
+	free(outputs);
+	varReaderFree(reader);
+	free(values);
+	free(line.data);
+}
+
+static void* worker(void* arg) {
+	Job* job;
+	(void) arg; // all workers take their jobs from the queue
+	for (;;) {
+		pthread_mutex_lock(&queueLock);
+		while (queueSize == 0)
+			pthread_cond_wait(&jobQueued, &queueLock);
+		job = popJob();
+		pthread_mutex_unlock(&queueLock);
+		runJob(job);
+		pthread_mutex_lock(&queueLock);
+		job->done = 1;
+		pthread_cond_broadcast(&jobDone);
+		pthread_mutex_unlock(&queueLock);
+	}
+	return NULL;
+}
+
+// split line at white space into job->tokens
+// Returns 0 if the line has more than SERVER_MAX_TOKENS tokens
+static int tokenize(Job* job) {
+	char* save;
+	char* token = strtok_r(job->line, " \t\r\n", &save);
+	job->nTokens = 0;
+	while (token) {
+		if (job->nTokens == SERVER_MAX_TOKENS)
+			return 0;
+		job->tokens[job->nTokens++] = token;
+		token = strtok_r(NULL, " \t\r\n", &save);
+	}
+	return 1;
+}
+
+// read the jobs of one connection, one at a time
+static void* serveConnection(void* arg) {
+	int fd = (int) (intptr_t) arg;
+	int in = dup(fd);
+	FILE* file = in >= 0 ? fdopen(in, "r") : NULL;
+	Job* job = (Job*) calloc(1, sizeof(Job));
+	const char* priority;
+	int c;
+	while (file && job && fgets(job->line, SERVER_LINE_SIZE, file)) {
+		if (!strchr(job->line, '\n') && !feof(file)) {
+			while ((c = fgetc(file)) != EOF && c != '\n')
+				;
+			reply(fd, "error line longer than %d bytes\n", SERVER_LINE_SIZE);
+			continue;
+		}
+		if (!tokenize(job)) {
+			reply(fd, "error too many tokens, at most %d\n", SERVER_MAX_TOKENS);
+			continue;
+		}
+		if (job->nTokens == 0)
+			continue;
+		if (strcmp(job->tokens[0], "run") && strcmp(job->tokens[0], "load")) {
+			reply(fd, "error unknown command %s\n", job->tokens[0]);
+			continue;
+		}
+		priority = findToken(job, "priority");
+		job->priority = priority ? atoi(priority) : 0;
+		job->fd = fd;
+		job->done = 0;
+		pthread_mutex_lock(&queueLock);
+		pushJob(job);
+		pthread_cond_signal(&jobQueued);
+		while (!job->done)
+			pthread_cond_wait(&jobDone, &queueLock);
+		pthread_mutex_unlock(&queueLock);
+	}
+	if (file)
+		fclose(file);
+	else if (in >= 0)
+		close(in);
+	close(fd);
+	free(job);
+	pthread_mutex_lock(&queueLock);
+	connections--;
+	pthread_mutex_unlock(&queueLock);
+	return NULL;
+}
+
+// Connect to the socket at addr to find out whether a server listens on it
+// Returns 1 if one does, 0 if the socket is stale, -1 if that is unknown
+static int probeSocket(const struct sockaddr_un* addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int n;
+	if (fd < 0)
+		return -1;
+	n = connect(fd, (const struct sockaddr*) addr, sizeof(*addr));
+	n = n == 0 ? 1 : errno == ECONNREFUSED ? 0 : -1;
+	close(fd);
+	return n;
+}
+
+int fmuServerRun(const char* socketPath, int nThreads, int loadFlags) {
+	struct sockaddr_un addr;
+	pthread_attr_t attr;
+	pthread_t thread;
+	struct stat st;
+	int fd, client, i;
+
+	if (nThreads <= 0)
+		nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	serverThreads = nThreads > 0 ? nThreads : 1;
+	serverLoadFlags = loadFlags;
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		printf("error: socket path %s too long\n", socketPath);
+		return 0;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		printf("error: could not create socket %s\n", socketPath);
+		return 0;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+	// a socket left behind by a previous server refuses connections and is
+	// replaced; other files are kept and make bind() fail
+	if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		i = probeSocket(&addr);
+		if (i == 1) {
+			printf("error: %s is already serving\n", socketPath);
+			close(fd);
+			return 0;
+		}
+		if (i == 0)
+			unlink(socketPath);
+	}
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+			|| listen(fd, 64) != 0) {
+		printf("error: could not listen on %s: %s\n", socketPath,
+				strerror(errno));
+		close(fd);
+		return 0;
+	}
+	getFmuWorkspace(); // initialize the settings before the threads start
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < serverThreads; i++)
+		if (pthread_create(&thread, &attr, worker, NULL) != 0) {
+			printf("error: could not start worker threads\n");
+			close(fd);
+			return 0;
+		}
+	printf("serving on %s with %d threads\n", socketPath, serverThreads);
+	fflush(stdout);
+	for (;;) {
+		client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			printf("error: accept failed: %s\n", strerror(errno));
+			break;
+		}
+		// at most one queued job per connection, see pushJob()
+		pthread_mutex_lock(&queueLock);
+		i = connections < SERVER_MAX_CONNECTIONS;
+		connections += i;
+		pthread_mutex_unlock(&queueLock);
+		if (!i || pthread_create(&thread, &attr, serveConnection,
+				(void*) (intptr_t) client) != 0) {
+			reply(client, "error server busy\n");
+			close(client);
+			pthread_mutex_lock(&queueLock);
+			connections -= i;
+			pthread_mutex_unlock(&queueLock);
+		}
+	}
+	close(fd);
+	return 0;
+}
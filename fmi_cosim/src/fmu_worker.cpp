@@ -0,0 +1,11 @@
+/*
+ * fmu_worker.cpp
+ *
+ * Worker process hosting one FMU for a master, see fmu_host.hpp.
+ */
+
+#include <fmu_host.hpp>
+
+int main(int argc, char* argv[]) {
+	return fmuHostWorker(argc, argv);
+}
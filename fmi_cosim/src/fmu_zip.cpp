@@ -0,0 +1,400 @@
+/*
+ * fmu_zip.cpp
+ *
+ * Minimal streaming ZIP reader used to unpack FMUs in-process.
+ * Only the central directory is kept in memory, entry data is read with pread()
+ * in chunks and inflated with zlib, so memory use does not depend on the entry size.
+ * Not supported: ZIP64, encryption, spanned archives.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <fmu_zip.hpp>
+
+#define ZIP_CHUNK 16384
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP_CDIR_SIG 0x02014b50
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CDIR_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_MAX_COMMENT 65535
+
+static unsigned int get16(const unsigned char* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned long get32(const unsigned char* p) {
+	return (unsigned long) p[0] | ((unsigned long) p[1] << 8)
+			| ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+// Returns 0 to indicate error
+static int readAt(int fd, void* buf, size_t n, off_t offset) {
+	char* p = (char*) buf;
+	while (n > 0) {
+		ssize_t r = pread(fd, p, n, offset);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return 0; // error or unexpected end of file
+		p += r;
+		n -= r;
+		offset += r;
+	}
+	return 1; // success
+}
+
+// Returns 0 to indicate error
+static int writeAll(int fd, const char* p, size_t n) {
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return 0; // error
+		p += w;
+		n -= w;
+	}
+	return 1; // success
+}
+
+// Locate the end of central directory record and read all central directory entries
+static int readCentralDirectory(ZipArchive* za) {
+	struct stat st;
+	unsigned char* tail;
+	unsigned char* cdir;
+	unsigned char* p;
+	long tailSize, i;
+	unsigned long cdirSize, cdirOffset;
+	int n, k;
+
+	if (fstat(za->fd, &st) != 0 || st.st_size < ZIP_EOCD_SIZE)
+		return 0;
+	tailSize = st.st_size < ZIP_EOCD_SIZE + ZIP_MAX_COMMENT ?
+			st.st_size : ZIP_EOCD_SIZE + ZIP_MAX_COMMENT;
+	tail = (unsigned char*) malloc(tailSize);
+	if (!tail || !readAt(za->fd, tail, tailSize, st.st_size - tailSize)) {
+		free(tail);
+		return 0;
+	}
+	// the record is followed by a comment of variable length, search backwards
+	for (i = tailSize - ZIP_EOCD_SIZE; i >= 0; i--)
+		if (get32(tail + i) == ZIP_EOCD_SIG)
+			break;
+	if (i < 0) {
+		printf("error: end of central directory not found\n");
+		free(tail);
+		return 0;
+	}
+	n = get16(tail + i + 10);
+	cdirSize = get32(tail + i + 12);
+	cdirOffset = get32(tail + i + 16);
+	free(tail);
+	if (n == 0xFFFF || cdirOffset == 0xFFFFFFFF
+			|| cdirOffset + cdirSize > (unsigned long) st.st_size) {
+		printf("error: ZIP64 or corrupt archive not supported\n");
+		return 0;
+	}
+
+	cdir = (unsigned char*) malloc(cdirSize + 1);
+	za->entries = (ZipEntry*) calloc(n + 1, sizeof(ZipEntry));
+	if (!cdir || !za->entries || !readAt(za->fd, cdir, cdirSize, cdirOffset)) {
+		free(cdir);
+		return 0;
+	}
+	p = cdir;
+	for (k = 0; k < n; k++) {
+		ZipEntry* e = &za->entries[k];
+		unsigned int nameLen, extraLen, commentLen;
+		if (p + ZIP_CDIR_SIZE > cdir + cdirSize || get32(p) != ZIP_CDIR_SIG)
+			break;
+		nameLen = get16(p + 28);
+		extraLen = get16(p + 30);
+		commentLen = get16(p + 32);
+		if (p + ZIP_CDIR_SIZE + nameLen > cdir + cdirSize)
+			break;
+		e->method = get16(p + 10);
+		if (get16(p + 8) & 1)
+			e->method = -1; // encrypted, cannot be extracted
+		e->crc = get32(p + 16);
+		e->compSize = get32(p + 20);
+		e->size = get32(p + 24);
+		e->headerOffset = get32(p + 42);
+		e->name = (char*) calloc(nameLen + 1, sizeof(char));
+		if (!e->name)
+			break;
+		memcpy(e->name, p + ZIP_CDIR_SIZE, nameLen);
+		za->n = k + 1;
+		p += ZIP_CDIR_SIZE + nameLen + extraLen + commentLen;
+	}
+	free(cdir);
+	if (za->n != n) {
+		printf("error: corrupt central directory\n");
+		return 0;
+	}
+	return 1; // success
+}
+
+ZipArchive* zipOpen(const char* zipPath) {
+	ZipArchive* za = (ZipArchive*) calloc(1, sizeof(ZipArchive));
+	if (!za)
+		return NULL;
+	za->fd = open(zipPath, O_RDONLY | O_CLOEXEC);
+	if (za->fd < 0) {
+		printf("error: Cannot open archive '%s'\n", zipPath);
+		free(za);
+		return NULL;
+	}
+	if (!readCentralDirectory(za)) {
+		printf("error: '%s' is not a readable ZIP archive\n", zipPath);
+		zipClose(za);
+		return NULL;
+	}
+	return za;
+}
+
+void zipClose(ZipArchive* za) {
+	int i;
+	if (!za)
+		return;
+	for (i = 0; i < za->n; i++)
+		free(za->entries[i].name);
+	free(za->entries);
+	if (za->fd >= 0)
+		close(za->fd);
+	free(za);
+}
+
+ZipEntry* zipFind(ZipArchive* za, const char* name) {
+	int i;
+	for (i = 0; i < za->n; i++)
+		if (!strcmp(za->entries[i].name, name))
+			return &za->entries[i];
+	return NULL;
+}
+
+// receives the inflated data of an entry
+typedef struct {
+	int fd;          // write to fd if >= 0
+	char* buffer;    // otherwise append to buffer
+	size_t size;
+	size_t capacity;
+} ZipSink;
+
+static int sinkWrite(ZipSink* sink, const char* p, size_t n) {
+	if (sink->fd >= 0) {
+		if (!writeAll(sink->fd, p, n))
+			return 0;
+	} else {
+		if (sink->size + n + 1 > sink->capacity)
+			return 0; // more data than the central directory announced
+		memcpy(sink->buffer + sink->size, p, n);
+	}
+	sink->size += n;
+	return 1;
+}
+
+// Returns the offset of the data of e in the archive, -1 to indicate error
+static off_t dataOffset(ZipArchive* za, ZipEntry* e) {
+	unsigned char header[ZIP_LOCAL_SIZE];
+	if (!readAt(za->fd, header, ZIP_LOCAL_SIZE, e->headerOffset)
+			|| get32(header) != ZIP_LOCAL_SIG) {
+		printf("error: corrupt local header for %s\n", e->name);
+		return -1;
+	}
+	return e->headerOffset + ZIP_LOCAL_SIZE + get16(header + 26)
+			+ get16(header + 28);
+}
+
+// Stream the data of e into sink, verifying size and CRC.
+// Returns 0 to indicate error
+static int zipInflate(ZipArchive* za, ZipEntry* e, ZipSink* sink) {
+	unsigned char in[ZIP_CHUNK];
+	unsigned char out[ZIP_CHUNK];
+	unsigned long crc = crc32(0L, Z_NULL, 0);
+	unsigned long remaining = e->compSize;
+	off_t offset;
+	z_stream zs;
+	int ret = Z_OK;
+
+	if (e->method != ZIP_METHOD_STORED && e->method != ZIP_METHOD_DEFLATE) {
+		printf("error: unsupported compression method %d for %s\n", e->method,
+				e->name);
+		return 0;
+	}
+	offset = dataOffset(za, e);
+	if (offset < 0)
+		return 0;
+
+	if (e->method == ZIP_METHOD_STORED) {
+		while (remaining > 0) {
+			size_t n = remaining < ZIP_CHUNK ? remaining : ZIP_CHUNK;
+			if (!readAt(za->fd, in, n, offset) || !sinkWrite(sink, (char*) in, n))
+				return 0;
+			crc = crc32(crc, in, n);
+			offset += n;
+			remaining -= n;
+		}
+	} else {
+		memset(&zs, 0, sizeof(zs));
+		if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) // raw deflate, no zlib header
+			return 0;
+		while (ret != Z_STREAM_END) {
+			if (zs.avail_in == 0 && remaining > 0) {
+				size_t n = remaining < ZIP_CHUNK ? remaining : ZIP_CHUNK;
+				if (!readAt(za->fd, in, n, offset))
+					break;
+				offset += n;
+				remaining -= n;
+				zs.next_in = in;
+				zs.avail_in = n;
+			}
+			// output may still be pending after the last input is consumed,
+			// the data is truncated only if inflate makes no progress then
+			zs.next_out = out;
+			zs.avail_out = ZIP_CHUNK;
+			ret = inflate(&zs, Z_NO_FLUSH);
+			if (ret == Z_BUF_ERROR && zs.avail_in == 0 && remaining == 0)
+				break; // truncated data
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+				break;
+			crc = crc32(crc, out, ZIP_CHUNK - zs.avail_out);
+			if (!sinkWrite(sink, (char*) out, ZIP_CHUNK - zs.avail_out)) {
+				ret = Z_ERRNO;
+				break;
+			}
+		}
+		inflateEnd(&zs);
+		if (ret != Z_STREAM_END) {
+			printf("error: could not inflate %s\n", e->name);
+			return 0;
+		}
+	}
+	if (sink->size != e->size || crc != e->crc) {
+		printf("error: size or CRC mismatch for %s\n", e->name);
+		return 0;
+	}
+	return 1; // success
+}
+
+long zipExtractToFd(ZipArchive* za, ZipEntry* e, int fd) {
+	ZipSink sink = { fd, NULL, 0, 0 };
+	return zipInflate(za, e, &sink) ? (long) sink.size : -1;
+}
+
+char* zipExtractToMemory(ZipArchive* za, ZipEntry* e, size_t* size) {
+	ZipSink sink = { -1, NULL, 0, e->size + 1 };
+	sink.buffer = (char*) malloc(sink.capacity);
+	if (!sink.buffer)
+		return NULL;
+	if (!zipInflate(za, e, &sink)) {
+		free(sink.buffer);
+		return NULL;
+	}
+	sink.buffer[sink.size] = '\0';
+	if (size)
+		*size = sink.size;
+	return sink.buffer;
+}
+
+char* zipReadStored(ZipArchive* za, ZipEntry* e) {
+	off_t offset = dataOffset(za, e);
+	char* data = offset < 0 ? NULL :
+			(char*) malloc(e->compSize ? e->compSize : 1);
+	if (data && !readAt(za->fd, data, e->compSize, offset)) {
+		printf("error: could not read %s\n", e->name);
+		free(data);
+		data = NULL;
+	}
+	return data;
+}
+
+static int isSelected(const char* name, const char** patterns) {
+	int i;
+	for (i = 0; patterns[i]; i++) {
+		size_t n = strlen(patterns[i]);
+		if (n > 0 && patterns[i][n - 1] == '/') {
+			if (!strncmp(name, patterns[i], n))
+				return 1;
+		} else if (!strcmp(name, patterns[i]))
+			return 1;
+	}
+	return 0;
+}
+
+// reject absolute paths and '..' components that would escape outPath
+static int isSafeName(const char* name) {
+	const char* p = name;
+	if (name[0] == '/' || name[0] == '\\')
+		return 0;
+	while (p) {
+		if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+			return 0;
+		p = strchr(p, '/');
+		if (p)
+			p++;
+	}
+	return 1;
+}
+
+// create all missing parent directories of path
+static int makeParentDirs(char* path) {
+	char* p;
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+			printf("error: could not create directory '%s'\n", path);
+			*p = '/';
+			return 0;
+		}
+		*p = '/';
+	}
+	return 1;
+}
+
+long zipExtract(ZipArchive* za, const char* outPath, const char** patterns) {
+	long total = 0;
+	int i;
+	for (i = 0; i < za->n; i++) {
+		ZipEntry* e = &za->entries[i];
+		size_t n = strlen(e->name);
+		char* path;
+		long written;
+		int fd;
+		if (!isSelected(e->name, patterns) || n == 0
+				|| e->name[n - 1] == '/')
+			continue; // directories are created on demand
+		if (!isSafeName(e->name)) {
+			printf("error: illegal entry name '%s'\n", e->name);
+			return -1;
+		}
+		path = (char*) calloc(sizeof(char), strlen(outPath) + n + 1);
+		if (!path)
+			return -1;
+		sprintf(path, "%s%s", outPath, e->name);
+		if (!makeParentDirs(path)) {
+			free(path);
+			return -1;
+		}
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+		if (fd < 0) {
+			printf("error: could not create '%s'\n", path);
+			free(path);
+			return -1;
+		}
+		written = zipExtractToFd(za, e, fd);
+		close(fd);
+		free(path);
+		if (written < 0)
+			return -1;
+		total += written;
+	}
+	return total;
+}
@@ -7,6 +7,9 @@
 #include <fmi_cosim.h>
 #include <support_cosim.hpp>
 #include <cosim.hpp>
+#include <fmu_batch.hpp>
+#include <fmu_pool.hpp>
+#include <fmu_server.hpp>
 
 using namespace std;
 
@@ -17,7 +20,147 @@ var var2("and1.u2");
 var var3("onOffController.reference");
 var var4("onOffController.reference");
 
-int main() {
+// Returns the bits 1 << enu of the comma separated enum values in list,
+// -1 if one is illegal
+static int enumSet(const char* list) {
+	int set = 0;
+	string s(list);
+	size_t start = 0, end;
+	do {
+		end = s.find(',', start);
+		string value = s.substr(start, end - start);
+		int e = 0;
+		while (e < SIZEOF_ENU && value != enuNames[e])
+			e++;
+		if (e == SIZEOF_ENU) {
+			printf("error: illegal enum value %s\n", value.c_str());
+			return -1;
+		}
+		set |= 1 << e;
+		start = end + 1;
+	} while (end != string::npos);
+	return set;
+}
+
+// cosim_main --inspect [--causality c,...] [--variability v,...]
+// [--name pattern] fmu... prints the model description of each FMU without
+// extracting it or loading its shared library. The options select the
+// variables that are parsed and printed, see VarFilter.
+static int inspect(int argc, char* argv[]) {
+	VarFilter filter = { 0, 0, NULL, 1 };
+	int failed = 0, filtered = 0, i = 0;
+	for (; i < argc - 1 && !strncmp(argv[i], "--", 2); i += 2, filtered = 1)
+		if (!strcmp(argv[i], "--causality"))
+			filter.causalities = enumSet(argv[i + 1]);
+		else if (!strcmp(argv[i], "--variability"))
+			filter.variabilities = enumSet(argv[i + 1]);
+		else if (!strcmp(argv[i], "--name"))
+			filter.name = argv[i + 1];
+		else {
+			printf("error: unknown option %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	if (filter.causalities == -1 || filter.variabilities == -1)
+		return EXIT_FAILURE;
+	int n = argc - i;
+	char** fmuPaths = argv + i;
+	for (i = 0; i < n; i++) {
+		ModelDescription* md = inspectFMU(fmuPaths[i],
+				filtered ? &filter : NULL);
+		if (!md) {
+			failed++;
+			continue;
+		}
+		printInspection(fmuPaths[i], md);
+		freeElement(md);
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// append the profile of fmu as one line of JSON to the file named by the
+// environment variable FMU_PROFILE, if set
+static void writeProfile(FMU* fmu, const char* name) {
+	const char* path = getenv("FMU_PROFILE");
+	FILE* file = path && *path ? fopen(path, "a") : NULL;
+	if (path && *path && !file)
+		printf("error: could not open %s\n", path);
+	if (file) {
+		fmuProfileJson(&fmu->profile, name, file);
+		fclose(file);
+	}
+}
+
+// cosim_main --batch [--private] [--hosted] [--parallel-parse] threads fmu...
+// loads and initializes all FMUs in parallel, simulates them from 0 to 10 and
+// reports the startup phases of each FMU. --private loads a private copy of
+// the library for every FMU, --hosted runs every FMU in a worker process,
+// --parallel-parse parses large model descriptions on several threads.
+static int batch(int loadFlags, int nThreads, int n, char* fmuPaths[]) {
+	FmuBatch* b = fmuBatchNew((const char**) fmuPaths, n, nThreads, loadFlags);
+	int i, failed, steps = 0;
+	fmiReal t, h = 1;
+	if (!b)
+		return EXIT_FAILURE;
+	failed = fmuBatchLoad(b);
+	failed += fmuBatchInit(b, 0, 10);
+	for (t = 0; t < 10 && !failed; t += h, steps++)
+		failed = fmuBatchDoStep(b, t, h);
+	fmuBatchReport(b, stdout);
+	for (i = 0; i < b->n; i++)
+		if (b->slots[i].fmu.modelDescription)
+			writeProfile(&b->slots[i].fmu, b->slots[i].instanceName);
+	printf("%d steps done\n", steps);
+	fmuBatchFree(b);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// cosim_main --pool runs fmu simulates the FMU from 0 to 10 runs times
+// back to back with instances recycled by a pool
+static int pool(int runs, const char* fmuPath) {
+	FmuPool* p = fmuPoolNew(fmuPath, 1, 0);
+	fmiComponent c;
+	fmiReal t;
+	double start = fmuProfileNow();
+	int i, failed = 0;
+	if (!p)
+		return EXIT_FAILURE;
+	for (i = 0; i < runs && !failed; i++) {
+		c = fmuPoolAcquire(p);
+		failed = !c || p->fmu.initializeSlave(c, 0, fmiTrue, 10) > fmiWarning;
+		for (t = 0; t < 10 && !failed; t++)
+			failed = p->fmu.doStep(c, t, 1, fmiTrue) > fmiWarning;
+		if (c) {
+			p->fmu.terminateSlave(c);
+			fmuPoolRelease(p, c);
+		}
+	}
+	printf("%d runs in %.3f ms, %d instantiated, %d reset\n", i,
+			1e3 * (fmuProfileNow() - start), p->instantiated, p->reused);
+	fmuPoolFree(p);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+
+	if (argc > 1 && !strcmp(argv[1], "--inspect"))
+		return inspect(argc - 2, argv + 2);
+	// cosim_main --serve socket [threads], see fmu_server.hpp
+	if (argc > 2 && !strcmp(argv[1], "--serve"))
+		return fmuServerRun(argv[2], argc > 3 ? atoi(argv[3]) : 0, 0) ?
+				EXIT_SUCCESS : EXIT_FAILURE;
+	if (argc == 4 && !strcmp(argv[1], "--pool"))
+		return pool(atoi(argv[2]), argv[3]);
+	if (argc > 2 && !strcmp(argv[1], "--batch")) {
+		int flags = 0, i = 2;
+		for (; i < argc - 1 && !strncmp(argv[i], "--", 2); i++)
+			if (!strcmp(argv[i], "--private"))
+				flags |= FMU_LOAD_PRIVATE;
+			else if (!strcmp(argv[i], "--hosted"))
+				flags |= FMU_LOAD_HOSTED;
+			else if (!strcmp(argv[i], "--parallel-parse"))
+				flags |= FMU_LOAD_PARALLEL_PARSE;
+		return batch(flags, atoi(argv[i]), argc - i - 1, argv + i + 1);
+	}
 
 	var2.value.b = false;
 	var3.value.r = 100;
@@ -26,6 +169,8 @@ int main() {
 	fmi_cosim fmu1(a, 1, 0.001);
 	int s1 = fmu1.initFMU(0, 10);
 	int s2;
+	fmuProfileSummary(&fmi_cosim::fmu_g.profile, a, stdout);
+	writeProfile(&fmi_cosim::fmu_g, a);
 
 	for (fmiReal i = 0; i < 10; i += tol) {
 		s2 = fmu1.simulateFMU(i, tol, 1);
@@ -35,7 +180,8 @@ int main() {
 		cout << "input setting \n" << fmu1.setInput(&var3) << endl;
 		cout << "input getting \n" << fmu1.getInput(&var4) << var4.value.r
 				<< endl;
-		printf("%f : %s ,%d %d %s %d %f \n", i, fmu1.tmp_FMU_Path, s1, s2,
+		printf("%f : %s ,%d %d %s %d %f \n", i,
+				fmu1.tmp_FMU_Path ? fmu1.tmp_FMU_Path : "(memory)", s1, s2,
 				var1.name, var1.vr, var1.value.r);
 	}
 	fmu1.unloadFMU();
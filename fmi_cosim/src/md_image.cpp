@@ -0,0 +1,510 @@
+/*
+ * md_image.cpp
+ *
+ * Layout of an image:
+ *   ImageHeader
+ *   ModelDescription   the root, at offset IMAGE_ROOT
+ *   ...                all other nodes, attribute arrays, strings and indexes
+ *   relocations        offsets of all pointers in the image
+ *   key                the XML file as stored in the FMU, see MdImageKey
+ * Pointers are stored as the address they have when the image is mapped at
+ * its base address. Base addresses are spread by the CRC of the XML file, so
+ * that the images of different FMUs rarely compete for the same address.
+ * The header holds a CRC-32 of everything after it. Loading checks it and
+ * that every pointer lies within the image before anything is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <md_image.hpp>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000 // a hint only for kernels before 4.17
+#endif
+
+#define IMAGE_MAGIC "FMUMDIMG"
+#define IMAGE_ALIGN 8
+#define ALIGNED(n) (((n) + IMAGE_ALIGN - 1) & ~(size_t) (IMAGE_ALIGN - 1))
+#define IMAGE_ROOT ALIGNED(sizeof(ImageHeader))
+#if UINTPTR_MAX > 0xFFFFFFFFUL
+#define IMAGE_BASE 0x600000000000UL // 4096 slots of 4 GB below 0x700000000000
+#define IMAGE_SLOTS 4096
+#define IMAGE_SLOT_SIZE (1UL << 32)
+#else
+#define IMAGE_BASE 0 // always relocate
+#endif
+
+typedef struct {
+	char magic[8];
+	unsigned version;        // MD_IMAGE_VERSION
+	unsigned layout;         // see astLayout()
+	unsigned long xmlCrc;
+	unsigned long xmlSize;
+	size_t size;             // of the whole image
+	size_t base;             // address the pointers are valid for, 0 if none
+	size_t relocs;           // offset of the relocations
+	size_t nRelocs;
+	size_t key;              // offset of MdImageKey.stored
+	size_t keySize;
+	unsigned long bodyCrc;   // CRC-32 of the image after the header
+} ImageHeader;
+
+typedef struct {
+	char* buf;
+	size_t size;
+	size_t cap;
+	size_t* relocs;
+	size_t nRelocs;
+	size_t capRelocs;
+	size_t base;
+	size_t names[SIZEOF_ATT]; // offsets of the attribute names, 0 until used
+	int failed;
+} ImageWriter;
+
+// Changes whenever a struct of the AST changes, images of another layout
+// are not used
+static unsigned astLayout() {
+	size_t sizes[] = { sizeof(void*), sizeof(Element), sizeof(ListElement),
+			sizeof(Type), sizeof(ScalarVariable), sizeof(CoSimulation),
+			sizeof(ModelDescription), sizeof(VarInfo), sizeof(VarIndex),
+			sizeof(VarTable), sizeof(DepGraph), sizeof(NameTrie),
+			SIZEOF_ELM, SIZEOF_ATT, SIZEOF_ENU };
+	unsigned h = 2166136261u;
+	unsigned i;
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		h = (h ^ (unsigned) sizes[i]) * 16777619u;
+	return h;
+}
+
+// Returns the offset of size zeroed bytes, 0 to indicate failure
+static size_t reserve(ImageWriter* w, size_t size) {
+	size_t off = ALIGNED(w->size);
+	if (w->failed)
+		return 0;
+	if (off + size > w->cap) {
+		size_t cap = w->cap ? w->cap : 64 * 1024;
+		char* buf;
+		while (off + size > cap)
+			cap *= 2;
+		buf = (char*) realloc(w->buf, cap);
+		if (!buf) {
+			w->failed = 1;
+			return 0;
+		}
+		memset(buf + w->cap, 0, cap - w->cap);
+		w->buf = buf;
+		w->cap = cap;
+	}
+	w->size = off + size;
+	return off;
+}
+
+static size_t writeBytes(ImageWriter* w, const void* p, size_t size) {
+	size_t off = reserve(w, size);
+	if (off)
+		memcpy(w->buf + off, p, size);
+	return off;
+}
+
+static size_t writeString(ImageWriter* w, const char* s) {
+	return s ? writeBytes(w, s, strlen(s) + 1) : 0;
+}
+
+// Store a pointer to offset target at offset slot, NULL if target is 0
+static void setPointer(ImageWriter* w, size_t slot, size_t target) {
+	if (w->failed)
+		return;
+	*(size_t*) (w->buf + slot) = target ? w->base + target : 0;
+	if (!target)
+		return;
+	if (w->nRelocs == w->capRelocs) {
+		size_t cap = w->capRelocs ? 2 * w->capRelocs : 4096;
+		size_t* relocs = (size_t*) realloc(w->relocs, cap * sizeof(size_t));
+		if (!relocs) {
+			w->failed = 1;
+			return;
+		}
+		w->relocs = relocs;
+		w->capRelocs = cap;
+	}
+	w->relocs[w->nRelocs++] = slot;
+}
+
+static size_t writeElement(ImageWriter* w, void* element);
+
+// Returns the offset of a copy of the null-terminated list
+static size_t writeList(ImageWriter* w, void** list) {
+	size_t off, n = 0, i;
+	if (!list)
+		return 0;
+	while (list[n])
+		n++;
+	off = reserve(w, (n + 1) * sizeof(void*));
+	for (i = 0; off && i < n; i++)
+		setPointer(w, off + i * sizeof(void*), writeElement(w, list[i]));
+	return off;
+}
+
+static size_t writeIndex(ImageWriter* w, VarIndex* x) {
+	size_t off;
+	if (!x)
+		return 0;
+	off = writeBytes(w, x, sizeof(VarIndex));
+	if (!off)
+		return 0;
+	setPointer(w, off + offsetof(VarIndex, byName),
+			writeBytes(w, x->byName, (x->mask + 1) * sizeof(unsigned)));
+	setPointer(w, off + offsetof(VarIndex, byRef),
+			writeBytes(w, x->byRef, (x->mask + 1) * sizeof(unsigned)));
+	setPointer(w, off + offsetof(VarIndex, byType),
+			writeBytes(w, x->byType, (x->typeMask + 1) * sizeof(unsigned)));
+	return off;
+}
+
+static size_t writeTable(ImageWriter* w, VarTable* t) {
+	size_t off, units;
+	int i;
+	if (!t)
+		return 0;
+	off = writeBytes(w, t, sizeof(VarTable));
+	if (!off)
+		return 0;
+	setPointer(w, off + offsetof(VarTable, vr),
+			writeBytes(w, t->vr, t->n * sizeof(fmiValueReference)));
+	setPointer(w, off + offsetof(VarTable, type),
+			writeBytes(w, t->type, t->n));
+	setPointer(w, off + offsetof(VarTable, causality),
+			writeBytes(w, t->causality, t->n));
+	setPointer(w, off + offsetof(VarTable, variability),
+			writeBytes(w, t->variability, t->n));
+	setPointer(w, off + offsetof(VarTable, alias),
+			writeBytes(w, t->alias, t->n));
+	setPointer(w, off + offsetof(VarTable, canonical),
+			writeBytes(w, t->canonical, t->n * sizeof(int)));
+	setPointer(w, off + offsetof(VarTable, negated),
+			writeBytes(w, t->negated, t->n));
+	setPointer(w, off + offsetof(VarTable, declaredType),
+			writeBytes(w, t->declaredType, t->n * sizeof(int)));
+	setPointer(w, off + offsetof(VarTable, defined),
+			writeBytes(w, t->defined, t->n));
+	setPointer(w, off + offsetof(VarTable, nominal),
+			writeBytes(w, t->nominal, t->n * sizeof(double)));
+	setPointer(w, off + offsetof(VarTable, min),
+			writeBytes(w, t->min, t->n * sizeof(double)));
+	setPointer(w, off + offsetof(VarTable, max),
+			writeBytes(w, t->max, t->n * sizeof(double)));
+	setPointer(w, off + offsetof(VarTable, unit),
+			writeBytes(w, t->unit, t->n * sizeof(int)));
+	setPointer(w, off + offsetof(VarTable, displayUnit),
+			writeBytes(w, t->displayUnit, t->n * sizeof(int)));
+	units = reserve(w, t->nUnits * sizeof(const char*));
+	for (i = 0; units && i < t->nUnits; i++)
+		setPointer(w, units + i * sizeof(const char*),
+				writeString(w, t->units[i]));
+	setPointer(w, off + offsetof(VarTable, units), units);
+	return off;
+}
+
+static size_t writeDepGraph(ImageWriter* w, DepGraph* g) {
+	size_t off;
+	if (!g)
+		return 0;
+	off = writeBytes(w, g, sizeof(DepGraph));
+	if (!off)
+		return 0;
+	setPointer(w, off + offsetof(DepGraph, start),
+			writeBytes(w, g->start, (g->n + 1) * sizeof(int)));
+	setPointer(w, off + offsetof(DepGraph, deps),
+			writeBytes(w, g->deps, g->start[g->n] * sizeof(int)));
+	setPointer(w, off + offsetof(DepGraph, all), writeBytes(w, g->all, g->n));
+	setPointer(w, off + offsetof(DepGraph, inputs),
+			writeBytes(w, g->inputs, g->nInputs * sizeof(int)));
+	return off;
+}
+
+static size_t writeNameTrie(ImageWriter* w, NameTrie* t) {
+	size_t off;
+	if (!t)
+		return 0;
+	off = writeBytes(w, t, sizeof(NameTrie));
+	if (!off)
+		return 0;
+	setPointer(w, off + offsetof(NameTrie, order),
+			writeBytes(w, t->order, t->n * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, node),
+			writeBytes(w, t->node, t->n * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, first),
+			writeBytes(w, t->first, t->nNodes * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, count),
+			writeBytes(w, t->count, t->nNodes * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, parent),
+			writeBytes(w, t->parent, t->nNodes * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, lo),
+			writeBytes(w, t->lo, t->nNodes * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, size),
+			writeBytes(w, t->size, t->nNodes * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, label),
+			writeBytes(w, t->label, (t->nNodes + 1) * sizeof(int)));
+	setPointer(w, off + offsetof(NameTrie, labels),
+			writeBytes(w, t->labels, t->label[t->nNodes]));
+	setPointer(w, off + offsetof(NameTrie, isVariable),
+			writeBytes(w, t->isVariable, t->nNodes));
+	return off;
+}
+
+// Returns the offset of a copy of the element and all its children, with
+// all pointer fields set anew
+static size_t writeElement(ImageWriter* w, void* element) {
+	Element* e = (Element*) element;
+	unsigned long long mask;
+	size_t off, att;
+	int i;
+	if (!e)
+		return 0;
+	off = writeBytes(w, e, getAstNodeSize(e->type));
+	if (!off)
+		return 0;
+	// the attributes are ordered by Att, see addAttributes()
+	att = e->n ? reserve(w, e->n * sizeof(char*)) : 0;
+	setPointer(w, off + offsetof(Element, attributes), att);
+	for (i = 0, mask = e->attMask; att && i < e->n; i += 2) {
+		int a = __builtin_ctzll(mask);
+		mask &= mask - 1;
+		if (!w->names[a])
+			w->names[a] = writeString(w, attNames[a]);
+		setPointer(w, att + i * sizeof(char*), w->names[a]);
+		setPointer(w, att + (i + 1) * sizeof(char*),
+				writeString(w, e->attributes[i + 1]));
+	}
+	switch (getAstNodeType(e->type)) {
+	case astElement:
+		break;
+	case astListElement:
+		setPointer(w, off + offsetof(ListElement, list),
+				writeList(w, (void**) ((ListElement*) e)->list));
+		break;
+	case astType:
+		setPointer(w, off + offsetof(Type, typeSpec),
+				writeElement(w, ((Type*) e)->typeSpec));
+		break;
+	case astScalarVariable: {
+		ScalarVariable* sv = (ScalarVariable*) e;
+		setPointer(w, off + offsetof(ScalarVariable, typeSpec),
+				writeElement(w, sv->typeSpec));
+		setPointer(w, off + offsetof(ScalarVariable, directDependencies),
+				writeList(w, (void**) sv->directDependencies));
+		break;
+	}
+	case astCoSimulation: {
+		CoSimulation* cs = (CoSimulation*) e;
+		setPointer(w, off + offsetof(CoSimulation, capabilities),
+				writeElement(w, cs->capabilities));
+		setPointer(w, off + offsetof(CoSimulation, model),
+				writeElement(w, cs->model));
+		break;
+	}
+	case astModelDescription: {
+		ModelDescription* md = (ModelDescription*) e;
+		setPointer(w, off + offsetof(ModelDescription, unitDefinitions),
+				writeList(w, (void**) md->unitDefinitions));
+		setPointer(w, off + offsetof(ModelDescription, typeDefinitions),
+				writeList(w, (void**) md->typeDefinitions));
+		setPointer(w, off + offsetof(ModelDescription, defaultExperiment),
+				writeElement(w, md->defaultExperiment));
+		setPointer(w, off + offsetof(ModelDescription, vendorAnnotations),
+				writeList(w, (void**) md->vendorAnnotations));
+		setPointer(w, off + offsetof(ModelDescription, modelVariables),
+				writeList(w, (void**) md->modelVariables));
+		setPointer(w, off + offsetof(ModelDescription, cosimulation),
+				writeElement(w, md->cosimulation));
+		setPointer(w, off + offsetof(ModelDescription, arena), 0);
+		setPointer(w, off + offsetof(ModelDescription, index),
+				writeIndex(w, md->index));
+		setPointer(w, off + offsetof(ModelDescription, table),
+				writeTable(w, md->table));
+		setPointer(w, off + offsetof(ModelDescription, deps),
+				writeDepGraph(w, md->deps));
+		setPointer(w, off + offsetof(ModelDescription, names),
+				writeNameTrie(w, md->names));
+		break;
+	}
+	}
+	return off;
+}
+
+// Returns 0 to indicate failure
+static int writeFile(const char* path, const char* buf, size_t size) {
+	char* tmp = (char*) malloc(strlen(path) + 8);
+	size_t done = 0;
+	int fd;
+	if (!tmp)
+		return 0;
+	sprintf(tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(tmp);
+		return 0;
+	}
+	while (done < size) {
+		ssize_t n = write(fd, buf + done, size - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	// readers see the old image or the complete new one
+	if (close(fd) != 0 || done < size || rename(tmp, path) != 0) {
+		unlink(tmp);
+		done = 0;
+	}
+	free(tmp);
+	return done == size;
+}
+
+// Returns the CRC-32 of the image p after the header
+static unsigned long bodyCrc(const char* p, size_t size) {
+	return crc32(crc32(0L, Z_NULL, 0), (const Bytef*) p + IMAGE_ROOT,
+			size - IMAGE_ROOT);
+}
+
+int mdImageSave(const char* path, ModelDescription* md, const MdImageKey* key) {
+	ImageWriter w;
+	int ok;
+	memset(&w, 0, sizeof(ImageWriter));
+#if IMAGE_BASE
+	w.base = IMAGE_BASE + (key->crc % IMAGE_SLOTS) * IMAGE_SLOT_SIZE;
+#endif
+	reserve(&w, sizeof(ImageHeader));
+	if (writeElement(&w, md) != IMAGE_ROOT)
+		w.failed = 1;
+	if (!w.failed) {
+		size_t relocs = writeBytes(&w, w.relocs, w.nRelocs * sizeof(size_t));
+		size_t stored = reserve(&w, key->storedSize);
+		ImageHeader* h = (ImageHeader*) w.buf;
+		if (stored)
+			memcpy(w.buf + stored, key->stored, key->storedSize);
+		memcpy(h->magic, IMAGE_MAGIC, sizeof(h->magic));
+		h->version = MD_IMAGE_VERSION;
+		h->layout = astLayout();
+		h->xmlCrc = key->crc;
+		h->xmlSize = key->size;
+		h->size = w.size;
+		h->base = w.base;
+		h->relocs = relocs;
+		h->nRelocs = w.nRelocs;
+		h->key = stored;
+		h->keySize = key->storedSize;
+		h->bodyCrc = bodyCrc(w.buf, w.size);
+	}
+	ok = !w.failed && writeFile(path, w.buf, w.size);
+	free(w.buf);
+	free(w.relocs);
+	return ok;
+}
+
+// Returns 1 if h describes a complete image for the given XML file
+static int checkHeader(ImageHeader* h, size_t fileSize, const MdImageKey* key) {
+	return !memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic))
+			&& h->version == MD_IMAGE_VERSION && h->layout == astLayout()
+			&& h->xmlCrc == key->crc && h->xmlSize == key->size
+			&& h->keySize == key->storedSize && h->size == fileSize
+			&& h->relocs >= IMAGE_ROOT + sizeof(ModelDescription)
+			&& h->relocs <= h->size && h->relocs % sizeof(size_t) == 0
+			&& h->nRelocs <= (h->size - h->relocs) / sizeof(size_t)
+			&& h->key <= h->size && h->keySize <= h->size - h->key;
+}
+
+// Returns 1 if the image p of the given header is intact, was made for the
+// given XML file and has all its pointers within the image
+static int checkImage(const char* p, ImageHeader* h, const MdImageKey* key) {
+	const size_t* relocs = (const size_t*) (p + h->relocs);
+	size_t i, target;
+	if (bodyCrc(p, h->size) != h->bodyCrc
+			|| memcmp(p + h->key, key->stored, h->keySize))
+		return 0;
+	// slots are aligned and precede the relocations, targets point into
+	// the image when it is mapped at its base address
+	for (i = 0; i < h->nRelocs; i++) {
+		if (relocs[i] < IMAGE_ROOT || relocs[i] % sizeof(size_t)
+				|| relocs[i] > h->relocs - sizeof(size_t))
+			return 0;
+		target = *(const size_t*) (p + relocs[i]) - h->base;
+		if (target < IMAGE_ROOT || target >= h->size)
+			return 0;
+	}
+	return 1;
+}
+
+// Add the difference between the actual and the base address to all pointers,
+// which checkImage() accepted before
+static void relocate(char* p, ImageHeader* h) {
+	size_t delta = (size_t) p - h->base;
+	size_t* relocs = (size_t*) (p + h->relocs);
+	size_t i;
+	for (i = 0; i < h->nRelocs; i++)
+		*(size_t*) (p + relocs[i]) += delta;
+}
+
+ModelDescription* mdImageLoad(const char* path, const MdImageKey* key) {
+	ImageHeader h;
+	struct stat st;
+	void* p = MAP_FAILED;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0
+			|| pread(fd, &h, sizeof(ImageHeader), 0) != sizeof(ImageHeader)
+			|| !checkHeader(&h, st.st_size, key)) {
+		close(fd);
+		return NULL;
+	}
+	if (h.base) {
+		// used in place, nothing is written to the image
+		p = mmap((void*) h.base, h.size, PROT_READ,
+				MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, 0);
+		if (p != MAP_FAILED && p != (void*) h.base) {
+			munmap(p, h.size);
+			p = MAP_FAILED;
+		}
+		if (p != MAP_FAILED && !checkImage((char*) p, &h, key)) {
+			munmap(p, h.size);
+			close(fd);
+			return NULL;
+		}
+	}
+	if (p == MAP_FAILED) {
+		// base address taken, relocate a private copy of the pages
+		p = mmap(NULL, h.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED && !checkImage((char*) p, &h, key)) {
+			munmap(p, h.size);
+			p = MAP_FAILED;
+		} else if (p != MAP_FAILED) {
+			relocate((char*) p, &h);
+			mprotect(p, h.size, PROT_READ);
+		}
+	}
+	close(fd);
+	return p == MAP_FAILED ? NULL : (ModelDescription*) ((char*) p + IMAGE_ROOT);
+}
+
+int mdIsImage(ModelDescription* md) {
+	return md->arena == NULL; // parsed model descriptions have one
+}
+
+static ImageHeader* headerOf(ModelDescription* md) {
+	return (ImageHeader*) ((char*) md - IMAGE_ROOT);
+}
+
+size_t mdImageSize(ModelDescription* md) {
+	return headerOf(md)->size;
+}
+
+void mdImageFree(ModelDescription* md) {
+	munmap(headerOf(md), headerOf(md)->size);
+}
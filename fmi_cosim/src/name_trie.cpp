@@ -0,0 +1,388 @@
+/*
+ * name_trie.cpp
+ *
+ * The names are sorted component by component, so that the variables under
+ * every node of the trie are a range of the sorted names. The trie is then
+ * built top down, with the children of a node allocated next to each other.
+ * The labels are copied once per node, in the order of the nodes, so that
+ * the label of node k ends where that of node k + 1 starts. A name is
+ * rebuilt from the labels on the path from its node up to the root.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <name_trie.hpp>
+
+typedef struct {
+	const char* name;
+	int position;
+} NamedPosition;
+
+// Nodes of the trie in construction, in growing arrays
+typedef struct {
+	NamedPosition* names; // sorted by component
+	int* node;            // node of the variable at each position
+	int nNodes;
+	int cap;
+	int* first;
+	int* count;
+	int* parent;
+	int* lo;
+	int* size;
+	int* label;
+	unsigned char* isVariable;
+	char* labels;
+	int nLabels;          // chars in labels
+	int capLabels;
+	int failed;
+} TrieBuilder;
+
+#define LABEL_SIZE(t, k) ((t)->label[(k) + 1] - (t)->label[k])
+
+// The end of a name sorts before the end of a component, which sorts before
+// all chars, so a name comes before the names under it
+static int rank(char c) {
+	return c == '\0' ? 0 : c == '.' ? 1 : (unsigned char) c + 2;
+}
+
+static int compareNames(const void* a, const void* b) {
+	const char* s = ((const NamedPosition*) a)->name;
+	const char* t = ((const NamedPosition*) b)->name;
+	for (; *s && *s == *t; s++, t++)
+		;
+	return rank(*s) - rank(*t);
+}
+
+static int grow(void** array, int cap, size_t size) {
+	void* p = realloc(*array, cap * size);
+	if (p)
+		*array = p;
+	return p != NULL;
+}
+
+// Returns the first of n new nodes, -1 to indicate failure
+static int newNodes(TrieBuilder* b, int n) {
+	int k = b->nNodes;
+	if (b->failed)
+		return -1;
+	if (k + n > b->cap) {
+		int cap = b->cap ? b->cap : 1024;
+		while (k + n > cap)
+			cap *= 2;
+		b->failed = !grow((void**) &b->first, cap, sizeof(int))
+				|| !grow((void**) &b->count, cap, sizeof(int))
+				|| !grow((void**) &b->parent, cap, sizeof(int))
+				|| !grow((void**) &b->lo, cap, sizeof(int))
+				|| !grow((void**) &b->size, cap, sizeof(int))
+				|| !grow((void**) &b->label, cap, sizeof(int))
+				|| !grow((void**) &b->isVariable, cap, 1);
+		if (b->failed)
+			return -1;
+		b->cap = cap;
+	}
+	b->nNodes += n;
+	return k;
+}
+
+// Append the n chars of s to the labels
+// Returns their offset, -1 to indicate failure
+static int addLabel(TrieBuilder* b, const char* s, int n) {
+	int k = b->nLabels;
+	if (b->failed)
+		return -1;
+	if (k + n > b->capLabels) {
+		int cap = b->capLabels ? b->capLabels : 4096;
+		while (k + n > cap)
+			cap *= 2;
+		b->failed = !grow((void**) &b->labels, cap, 1);
+		if (b->failed)
+			return -1;
+		b->capLabels = cap;
+	}
+	memcpy(b->labels + k, s, n);
+	b->nLabels += n;
+	return k;
+}
+
+// Returns the end of the names in [i, hi) with the component of name i that
+// starts at off
+static int groupEnd(TrieBuilder* b, int i, int hi, int off) {
+	const char* c = b->names[i].name + off;
+	int n = strcspn(c, ".");
+	int j;
+	for (j = i + 1; j < hi; j++) {
+		const char* s = b->names[j].name + off;
+		if (strncmp(s, c, n) || (s[n] != '.' && s[n] != '\0'))
+			break;
+	}
+	return j;
+}
+
+// Add the children of node k for the names in [lo, hi), which continue with
+// a component at off. All children are labeled before the first grandchild,
+// so that the labels are in the order of the nodes.
+static void buildChildren(TrieBuilder* b, int k, int lo, int hi, int off) {
+	int i, j, g = 0, node, c, n;
+	for (i = lo; i < hi; i = groupEnd(b, i, hi, off))
+		g++;
+	node = newNodes(b, g);
+	if (node < 0)
+		return;
+	b->first[k] = node;
+	b->count[k] = g;
+	for (i = lo, c = node; i < hi; i = j, c++) {
+		const char* name = b->names[i].name;
+		n = strcspn(name + off, ".");
+		j = groupEnd(b, i, hi, off);
+		b->parent[c] = k;
+		b->lo[c] = i;
+		b->size[c] = j - i;
+		b->label[c] = addLabel(b, name + off, n);
+		b->isVariable[c] = name[off + n] == '\0';
+	}
+	for (c = node; c < node + g && !b->failed; c++) {
+		n = strcspn(b->names[b->lo[c]].name + off, ".");
+		i = b->lo[c];
+		j = i + b->size[c];
+		// the names that end here, more than one only if names repeat
+		for (; i < j && b->names[i].name[off + n] == '\0'; i++)
+			b->node[b->names[i].position] = c;
+		buildChildren(b, c, i, j, off + n + 1);
+	}
+}
+
+// Returns a copy of the first n ints of p in the arena
+static int* copyInts(Arena* a, const int* p, int n, int* failed) {
+	int* copy = (int*) arenaAlloc(a, (n ? n : 1) * sizeof(int));
+	if (copy)
+		memcpy(copy, p, n * sizeof(int));
+	*failed |= !copy;
+	return copy;
+}
+
+static void freeBuilder(TrieBuilder* b) {
+	free(b->names);
+	free(b->node);
+	free(b->first);
+	free(b->count);
+	free(b->parent);
+	free(b->lo);
+	free(b->size);
+	free(b->label);
+	free(b->isVariable);
+	free(b->labels);
+}
+
+int buildNameTrie(ModelDescription* md) {
+	NameTrie* t = (NameTrie*) arenaAlloc(md->arena, sizeof(NameTrie));
+	TrieBuilder b;
+	int i, failed = 0;
+	memset(&b, 0, sizeof(TrieBuilder));
+	if (!t)
+		return 0;
+	t->n = md->table->n;
+	b.names = (NamedPosition*) malloc((t->n ? t->n : 1) * sizeof(NamedPosition));
+	b.node = (int*) malloc((t->n ? t->n : 1) * sizeof(int));
+	if (!b.names || !b.node) {
+		freeBuilder(&b);
+		return 0;
+	}
+	for (i = 0; i < t->n; i++) {
+		b.names[i].name = getName(md->modelVariables[i]);
+		b.names[i].position = i;
+	}
+	qsort(b.names, t->n, sizeof(NamedPosition), compareNames);
+	newNodes(&b, 1); // the root
+	if (!b.failed) {
+		b.parent[0] = -1;
+		b.lo[0] = b.label[0] = b.isVariable[0] = 0;
+		b.size[0] = t->n;
+		buildChildren(&b, 0, 0, t->n, 0);
+	}
+	// the end of the last label
+	if (!b.failed && newNodes(&b, 1) >= 0)
+		b.label[--b.nNodes] = b.nLabels;
+	t->order = (int*) arenaAlloc(md->arena, (t->n ? t->n : 1) * sizeof(int));
+	failed |= b.failed || !t->order;
+	for (i = 0; !failed && i < t->n; i++)
+		t->order[i] = b.names[i].position;
+	t->nNodes = b.nNodes;
+	if (!failed) {
+		t->node = copyInts(md->arena, b.node, t->n, &failed);
+		t->first = copyInts(md->arena, b.first, b.nNodes, &failed);
+		t->count = copyInts(md->arena, b.count, b.nNodes, &failed);
+		t->parent = copyInts(md->arena, b.parent, b.nNodes, &failed);
+		t->lo = copyInts(md->arena, b.lo, b.nNodes, &failed);
+		t->size = copyInts(md->arena, b.size, b.nNodes, &failed);
+		t->label = copyInts(md->arena, b.label, b.nNodes + 1, &failed);
+		t->isVariable = (unsigned char*) arenaAlloc(md->arena, b.nNodes);
+		t->labels = (char*) arenaAlloc(md->arena, b.nLabels);
+		failed |= !t->isVariable || !t->labels;
+	}
+	if (!failed) {
+		memcpy(t->isVariable, b.isVariable, b.nNodes);
+		memcpy(t->labels, b.labels, b.nLabels);
+	}
+	freeBuilder(&b);
+	if (!failed)
+		md->names = t;
+	return !failed;
+}
+
+int getVariableName(ModelDescription* md, int i, char* name, int size) {
+	NameTrie* t = md->names;
+	int length = -1, end, n, k;
+	for (k = t->node[i]; k > 0; k = t->parent[k])
+		length += LABEL_SIZE(t, k) + 1;
+	if (size <= 0)
+		return length;
+	// from the end of the name back, leaving out what does not fit
+	for (end = length, k = t->node[i]; k > 0; k = t->parent[k]) {
+		end -= LABEL_SIZE(t, k);
+		n = size - 1 - end < LABEL_SIZE(t, k) ?
+				size - 1 - end : LABEL_SIZE(t, k);
+		if (n > 0)
+			memcpy(name + end, t->labels + t->label[k], n);
+		if (t->parent[k] > 0 && --end < size - 1)
+			name[end] = '.';
+	}
+	name[length < size ? length : size - 1] = '\0';
+	return length;
+}
+
+char* newVariableName(ModelDescription* md, int i) {
+	int n = getVariableName(md, i, NULL, 0);
+	char* name = (char*) malloc(n + 1);
+	if (name)
+		getVariableName(md, i, name, n + 1);
+	return name;
+}
+
+int isVariableName(ModelDescription* md, int i, const char* name) {
+	NameTrie* t = md->names;
+	const char* end = name + strlen(name);
+	int k, n;
+	for (k = t->node[i]; k > 0; k = t->parent[k]) {
+		n = LABEL_SIZE(t, k);
+		if (end - name < n || memcmp(end - n, t->labels + t->label[k], n))
+			return 0;
+		end -= n;
+		if (t->parent[k] > 0 && (end == name || *--end != '.'))
+			return 0;
+	}
+	return end == name;
+}
+
+// Compares the label of node k with the first n chars of s. Returns 0 if
+// the label starts with them, otherwise the order of the label.
+static int compareLabel(ModelDescription* md, int k, const char* s, int n) {
+	NameTrie* t = md->names;
+	int m = LABEL_SIZE(t, k);
+	int r = memcmp(t->labels + t->label[k], s, m < n ? m : n);
+	return r ? r : m < n ? -1 : 0;
+}
+
+// Returns the first child of k whose label is not less than the n chars of
+// s, or the first greater than them if after, in the order of the children
+static int lowerBound(ModelDescription* md, int k, const char* s, int n,
+		int after) {
+	NameTrie* t = md->names;
+	int lo = t->first[k], hi = t->first[k] + t->count[k];
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int r = compareLabel(md, mid, s, n);
+		if (r < 0 || (after && r == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// Returns the child of k labeled with the n chars of s, -1 if none
+static int findChild(ModelDescription* md, int k, const char* s, int n) {
+	NameTrie* t = md->names;
+	int c = lowerBound(md, k, s, n, 0);
+	return c < t->first[k] + t->count[k] && LABEL_SIZE(t, c) == n
+			&& !compareLabel(md, c, s, n) ? c : -1;
+}
+
+int findByPrefix(ModelDescription* md, const char* prefix,
+		const int** positions) {
+	NameTrie* t = md->names;
+	const char* dot;
+	int k = 0, lo, hi, first, last, n;
+	while ((dot = strchr(prefix, '.'))) {
+		k = findChild(md, k, prefix, dot - prefix);
+		if (k == -1)
+			return 0;
+		prefix = dot + 1;
+	}
+	n = strlen(prefix);
+	if (n) {
+		// the children of k whose label starts with the rest of prefix
+		first = lowerBound(md, k, prefix, n, 0);
+		last = lowerBound(md, k, prefix, n, 1);
+		if (first == last)
+			return 0;
+		lo = t->lo[first];
+		hi = t->lo[last - 1] + t->size[last - 1];
+	} else {
+		// everything under k, but k itself
+		lo = t->lo[k] + t->isVariable[k];
+		hi = t->lo[k] + t->size[k];
+	}
+	*positions = t->order + lo;
+	return hi - lo;
+}
+
+// Returns 1 if the n chars of s match the first m chars of pattern
+static int matchComponent(const char* pattern, int m, const char* s, int n) {
+	int p = 0, i = 0, star = -1, resume = 0;
+	while (i < n) {
+		if (p < m && pattern[p] == '*') {
+			star = p++;
+			resume = i;
+		} else if (p < m && (pattern[p] == '?' || pattern[p] == s[i])) {
+			p++;
+			i++;
+		} else if (star >= 0) {
+			p = star + 1; // let the last '*' match one more char
+			i = ++resume;
+		} else
+			return 0;
+	}
+	while (p < m && pattern[p] == '*')
+		p++;
+	return p == m;
+}
+
+// Append the variables under node k that match the components of pattern
+// Returns the new number of positions
+static int matchChildren(ModelDescription* md, int k, const char* pattern,
+		int* positions, int n) {
+	NameTrie* t = md->names;
+	const char* dot = strchr(pattern, '.');
+	int m = dot ? dot - pattern : strlen(pattern);
+	int c = t->first[k], end = t->first[k] + t->count[k];
+	if (!memchr(pattern, '*', m) && !memchr(pattern, '?', m)) {
+		c = findChild(md, k, pattern, m); // a plain component
+		if (c == -1)
+			return n;
+		end = c + 1;
+	}
+	for (; c < end; c++) {
+		if (!matchComponent(pattern, m, t->labels + t->label[c],
+				LABEL_SIZE(t, c)))
+			continue;
+		if (dot)
+			n = matchChildren(md, c, dot + 1, positions, n);
+		else if (t->isVariable[c])
+			positions[n++] = t->order[t->lo[c]];
+	}
+	return n;
+}
+
+int findByPattern(ModelDescription* md, const char* pattern, int* positions) {
+	return matchChildren(md, 0, pattern, positions, 0);
+}
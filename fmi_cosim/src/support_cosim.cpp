@@ -19,11 +19,30 @@
 #endif
 
 #include <support_cosim.hpp>
+#include <dep_graph.hpp>
+#include <name_trie.hpp>
 
 #ifndef _MSC_VER
 #define MAX_PATH 1024
 #include <unistd.h>  // mkdtemp()
 #include <dlfcn.h> //dlsym()
+#include <ftw.h> // nftw()
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fmu_zip.hpp>
+#include <fmu_cache.hpp>
+#include <fmu_host.hpp>
+#include <md_image.hpp>
+#include <sys/mman.h> // memfd_create()
+#include <pthread.h>
+#endif
+
+// load shared libraries from anonymous memory files where available
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+#define FMU_MEMFD 1
+#else
+#define FMU_MEMFD 0
 #endif
 
 #if WINDOWS
@@ -81,52 +100,22 @@ int unzip(const char *zipPath, const char *outPath) {
 }
 #else /* WINDOWS */
 
-int unzip(const char *zipPath, const char *outPath) {
-	int code;
-	char cwd[BUFSIZE];
-	int n;
-	char* cmd;
-
-	// remember current directory
-	if (!getcwd(cwd, BUFSIZE)) {
-		printf("error: Could not get current directory\n");
-		return 0; // error
-	}
-
-	// run the unzip command
-	n = strlen(UNZIP_CMD) + strlen(outPath) + 1 + strlen(zipPath) + 16;
-	cmd = (char*) calloc(sizeof(char), n);
-	sprintf(cmd, "%s%s \"%s\" > /dev/null", UNZIP_CMD, outPath, zipPath);
-	printf("cmd='%s'\n", cmd);
-	code = system(cmd);
-	free(cmd);
-	if (code != SEVEN_ZIP_NO_ERROR) {
-		switch (code) {
-		printf("7z: ");
-	case SEVEN_ZIP_WARNING:
-		printf("warning\n");
-		break;
-	case SEVEN_ZIP_ERROR:
-		printf("error\n");
-		break;
-	case SEVEN_ZIP_COMMAND_LINE_ERROR:
-		printf("command line error\n");
-		break;
-	case SEVEN_ZIP_OUT_OF_MEMORY:
-		printf("out of memory\n");
-		break;
-	case SEVEN_ZIP_STOPPED_BY_USER:
-		printf("stopped by user\n");
-		break;
-	default:
-		printf("unknown problem\n");
-		}
-	}
-
-	// restore current directory
-	chdir(cwd);
+// Extract the model description and the binaries for this platform in-process.
+// Sources, documentation and binaries for other platforms are not unpacked.
+// Returns the number of bytes extracted, -1 to indicate error
+static long extractFMU(const char *zipPath, const char *outPath) {
+	const char* selected[] = { XML_FILE, DLL_DIR, DLL_DIR2, NULL };
+	long n;
+	ZipArchive* za = zipOpen(zipPath);
+	if (!za)
+		return -1; // error
+	n = zipExtract(za, outPath, selected);
+	zipClose(za);
+	return n;
+}
 
-	return (code == SEVEN_ZIP_NO_ERROR || code == SEVEN_ZIP_WARNING) ? 1 : 0;
+int unzip(const char *zipPath, const char *outPath) {
+	return extractFMU(zipPath, outPath) >= 0 ? 1 : 0;
 }
 #endif /* WINDOWS */
 
@@ -160,18 +149,59 @@ static char* getFmuPath(const char* fmuFileName) {
 	/* Not sure why this is useful.  Just returning the filename. */
 	return strdup(fmuFileName);
 }
+static char* fmuWorkspace = NULL; // NULL until first use, see getFmuWorkspace()
+
+// a workspace must be a writable directory on which shared objects can be mapped
+static int isUsableWorkspace(const char* dir) {
+	struct statvfs vfs;
+	if (access(dir, W_OK | X_OK) != 0 || statvfs(dir, &vfs) != 0)
+		return 0;
+	return (vfs.f_flag & ST_NOEXEC) == 0;
+}
+
+void setFmuWorkspace(const char* dir) {
+	free(fmuWorkspace);
+	fmuWorkspace = strdup(dir);
+}
+
+// FMUs are extracted below $FMU_WORKSPACE if set, else below the
+// RAM backed /dev/shm if usable, else below the current directory
+const char* getFmuWorkspace() {
+	if (!fmuWorkspace) {
+		const char* dir = getenv("FMU_WORKSPACE");
+		if (!dir || !*dir)
+			dir = isUsableWorkspace("/dev/shm") ? "/dev/shm" : ".";
+		setFmuWorkspace(dir);
+	}
+	return fmuWorkspace;
+}
+
 static char* getTmpPath() {
-	char tmplate[13];  // Lenght of "fmuTmpXXXXXX" + null
-	sprintf(tmplate, "%s", "fmuTmpXXXXXX");
-	//char *tmp = mkdtemp(strdup("fmuTmpXXXXXX"));
+	const char* workspace = getFmuWorkspace();
+	char* tmplate = (char *) calloc(sizeof(char), strlen(workspace) + 15);
+	sprintf(tmplate, "%s/fmuTmpXXXXXX", workspace);
 	char *tmp = mkdtemp(tmplate);
 	if (tmp == NULL) {
-		fprintf(stderr, "Couldn't create temporary directory\n");
-		exit(1);
+		fprintf(stderr, "Couldn't create temporary directory in %s\n",
+				workspace);
+		free(tmplate);
+		return NULL;
 	}
-	char * results = (char *) calloc(sizeof(char), strlen(tmp) + 2);
-	strncat(results, tmp, strlen(tmp));
-	return strcat(results, "/");
+	return strcat(tmp, "/");
+}
+
+static int removeEntry(const char* path, const struct stat* st, int flag,
+		struct FTW* ftw) {
+	(void) st; // only the path is needed
+	(void) flag;
+	(void) ftw;
+	return remove(path);
+}
+
+// Remove the directory tree created by getTmpPath(), without running a shell.
+// Returns 0 to indicate failure
+int removeTmpDir(const char* tmpPath) {
+	return nftw(tmpPath, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0;
 }
 #endif
 
@@ -185,6 +215,8 @@ static void* getAdr(int* s, FMU *fmu, const char* functionName) {
 #else
 	fp = dlsym(fmu->dllHandle, name);
 #endif
+	if (fp)
+		fmu->profile.symbols++;
 	if (!fp) {
 		printf("warning: Function %s not found in %s\n", name, DLL_SUFFIX);
 #ifdef _MSC_VER
@@ -198,29 +230,14 @@ static void* getAdr(int* s, FMU *fmu, const char* functionName) {
 	return fp;
 }
 
-// Load the given dll and set function pointers in fmu
+// Set function pointers in fmu from the dll loaded as fmu->dllHandle
 // Return 0 to indicate failure
-static int loadDll(const char* dllPath, FMU *fmu) {
+static int bindFunctions(FMU *fmu) {
+	double start = fmuProfileNow();
 	int s = 1;
 #ifdef FMI_COSIMULATION
 	int x = 1;
 #endif
-#ifdef _MSC_VER
-	HANDLE h = LoadLibrary(dllPath);
-#else
-	printf("dllPath = %s\n", dllPath);
-	HANDLE h = dlopen(dllPath, RTLD_LAZY);
-#endif
-	if (!h) {
-		printf("error: Could not load %s\n", dllPath);
-
-#ifdef _MSC_VER
-#else
-		printf("The error was: %s\n", dlerror());
-#endif
-		return 0; // failure
-	}
-	fmu->dllHandle = h;
 
 #ifdef FMI_COSIMULATION
 	fmu->getTypesPlatform = (fGetTypesPlatform) getAdr(&s, fmu,
@@ -285,83 +302,529 @@ static int loadDll(const char* dllPath, FMU *fmu) {
 	fmu->getBoolean = (fGetBoolean) getAdr(&s, fmu, "fmiGetBoolean");
 	fmu->getString = (fGetString) getAdr(&s, fmu, "fmiGetString");
 
+	fmuProfileAdd(&fmu->profile, phase_bind, start);
 	return s;
 }
 
-static void printModelDescription(ModelDescription* md) {
+#ifndef _MSC_VER
+// Load a uniquely named copy of the dll, so that dlopen() does not return
+// an already loaded instance. The copy is unlinked right after loading.
+static HANDLE openDllCopy(const char* dllPath) {
+	static int copies = 0;
+	const char* workspace = getFmuWorkspace();
+	char* copyPath;
+	char buffer[BUFSIZE];
+	HANDLE h = NULL;
+	ssize_t n = 0;
+	int in, out;
+	copyPath = (char*) calloc(sizeof(char),
+			strlen(workspace) + strlen(DLL_SUFFIX) + 48);
+	if (!copyPath)
+		return NULL;
+	sprintf(copyPath, "%s/fmuCopy.%d.%d%s", workspace, (int) getpid(),
+			__sync_fetch_and_add(&copies, 1), DLL_SUFFIX);
+	in = open(dllPath, O_RDONLY | O_CLOEXEC);
+	out = open(copyPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0755);
+	while (in >= 0 && out >= 0 && (n = read(in, buffer, BUFSIZE)) > 0)
+		if (write(out, buffer, n) != n) {
+			n = -1;
+			break;
+		}
+	if (in >= 0)
+		close(in);
+	if (out >= 0) {
+		close(out);
+		if (n == 0)
+			h = dlopen(copyPath, RTLD_LAZY);
+		unlink(copyPath); // the loaded library stays mapped
+	}
+	if (!h)
+		printf("error: Could not load a private copy of %s\n", dllPath);
+	free(copyPath);
+	return h;
+}
+#endif
+
+// Open the shared library at dllPath. With FMU_LOAD_PRIVATE, the library gets
+// its own copy of all global variables, even if it is already loaded:
+// it is loaded into a new link-map namespace, or, when no namespace is left,
+// from a uniquely named copy. Set uniquePath if no other library was loaded
+// from dllPath before, then the copy is not needed.
+static HANDLE openDll(const char* dllPath, int flags, int uniquePath) {
+#ifdef _MSC_VER
+	return LoadLibrary(dllPath);
+#else
+	HANDLE h;
+	if (!(flags & FMU_LOAD_PRIVATE))
+		return dlopen(dllPath, RTLD_LAZY);
+#ifdef LM_ID_NEWLM
+	h = dlmopen(LM_ID_NEWLM, dllPath, RTLD_LAZY | RTLD_LOCAL);
+	if (h)
+		return h;
+	if (flags & FMU_LOAD_VERBOSE)
+		printf("dlmopen failed for %s: %s\n", dllPath, dlerror());
+#endif
+	return uniquePath ? dlopen(dllPath, RTLD_LAZY) : openDllCopy(dllPath);
+#endif
+}
+
+// Load the given dll and set function pointers in fmu
+// Return 0 to indicate failure
+static int loadDll(const char* dllPath, FMU *fmu, int flags) {
+#ifndef _MSC_VER
+	if (flags & FMU_LOAD_VERBOSE)
+		printf("dllPath = %s\n", dllPath);
+#endif
+	double start = fmuProfileNow();
+	HANDLE h = openDll(dllPath, flags, 0);
+	fmuProfileAdd(&fmu->profile, phase_dlopen, start);
+	if (!h) {
+		printf("error: Could not load %s\n", dllPath);
+
+#ifdef _MSC_VER
+#else
+		printf("The error was: %s\n", dlerror());
+#endif
+		return 0; // failure
+	}
+	fmu->dllHandle = h;
+	return bindFunctions(fmu);
+}
+
+#if FMU_MEMFD
+static int loadFromMemory = -1; // -1 until first use, see useMemoryLoading()
+
+void setFmuMemoryLoading(int on) {
+	loadFromMemory = on;
+}
+
+// Shared libraries are loaded from memory unless FMU_MEMFD=0 is set
+// or an extraction cache is configured
+static int useMemoryLoading() {
+	if (loadFromMemory < 0) {
+		const char* env = getenv("FMU_MEMFD");
+		loadFromMemory = !(env && !strcmp(env, "0"));
+	}
+	return loadFromMemory && !getFmuCacheDir();
+}
+
+// Inflate entry dllEntry of the archive into an anonymous memory file and
+// load it through /proc/self/fd, so nothing is written to disk. The memory
+// file stays open in fmu->dllFd until unload: dlopen() recognizes libraries
+// by path, so a reused fd number would return the library loaded before.
+// Return 0 to indicate failure
+static int loadDllFromArchive(ZipArchive* za, const char* dllEntry, FMU *fmu,
+		int flags) {
+	char fdPath[32];
+	HANDLE h;
+	int fd;
+	long n;
+	double start = fmuProfileNow();
+	ZipEntry* e = zipFind(za, dllEntry);
+	if (!e)
+		return 0; // failure
+	fd = memfd_create(dllEntry, MFD_CLOEXEC);
+	if (fd < 0) {
+		printf("warning: memfd_create failed for %s\n", dllEntry);
+		return 0; // failure
+	}
+	n = zipExtractToFd(za, e, fd);
+	start = fmuProfileAdd(&fmu->profile, phase_extract, start);
+	if (n < 0) {
+		close(fd);
+		return 0; // failure
+	}
+	fmu->profile.bytesExtracted += n;
+	sprintf(fdPath, "/proc/self/fd/%d", fd);
+	if (flags & FMU_LOAD_VERBOSE)
+		printf("dllPath = %s (%s)\n", fdPath, dllEntry);
+	// The fd stays open while the library is loaded: dlopen() identifies loaded
+	// libraries by path, a recycled fd number would return the wrong library.
+	h = openDll(fdPath, flags, 1);
+	fmuProfileAdd(&fmu->profile, phase_dlopen, start);
+	if (!h) {
+		printf("warning: Could not load %s from memory: %s\n", dllEntry,
+				dlerror());
+		close(fd);
+		return 0; // failure
+	}
+	fmu->dllHandle = h;
+	fmu->dllFd = fd;
+	if (!bindFunctions(fmu)) {
+		dlclose(h);
+		close(fd);
+		fmu->dllHandle = NULL;
+		fmu->dllFd = -1;
+		return 0; // failure
+	}
+	return 1; // success
+}
+
+// Try both platform directories of the archive.
+// Return 0 to indicate failure
+static int loadDllFromFMU(const char* fmuPath, FMU *fmu, int flags) {
+	const char* modelId = getModelIdentifier(fmu->modelDescription);
+	char* dllEntry;
+	int s = 0;
+	ZipArchive* za = zipOpen(fmuPath);
+	if (!za)
+		return 0; // failure
+	dllEntry = (char*) calloc(sizeof(char),
+			strlen(DLL_DIR) + strlen(DLL_DIR2) + strlen(modelId)
+					+ strlen(DLL_SUFFIX) + strlen(DLL_SUFFIX2) + 1);
+	sprintf(dllEntry, "%s%s%s", DLL_DIR, modelId, DLL_SUFFIX);
+	s = loadDllFromArchive(za, dllEntry, fmu, flags);
+	if (!s) {
+		sprintf(dllEntry, "%s%s%s", DLL_DIR2, modelId, DLL_SUFFIX2);
+		s = loadDllFromArchive(za, dllEntry, fmu, flags);
+	}
+	free(dllEntry);
+	zipClose(za);
+	return s;
+}
+#endif /* FMU_MEMFD */
+
+// Record the number of variables and the memory of md, md may be NULL
+static void profileModel(FmuProfile* p, ModelDescription* md) {
+	int n = 0;
+	if (md && md->modelVariables)
+		while (md->modelVariables[n])
+			n++;
+	p->variables = n;
+	if (!md)
+		p->astBytes = 0;
+	else
+		p->astBytes = mdIsImage(md) ? mdImageSize(md) : md->arena->footprint;
+}
+
+// Parse the model description directly from the archive, without extracting
+// anything to disk and without loading the shared library. With the FMU cache
+// enabled, a precompiled image of the model description is used instead, and
+// made at the first parse. Images hold all variables, so a filtered parse
+// does not use them, see parseFiltered().
+// Adds to the extract and parse phases of p unless p is NULL. Large model
+// descriptions are parsed on nThreads threads, see parseBufferInSitu().
+// Returns NULL to indicate failure. The receiver must call freeElement()
+static ModelDescription* parseFromArchive(const char* fmuPath,
+		FmuProfile* p, const VarFilter* filter, int nThreads) {
+	ModelDescription* md = NULL;
+	ZipArchive* za;
+	ZipEntry* e;
+	char* xml = NULL;
+	char* imagePath = NULL;
+	char* stored = NULL;
+	MdImageKey key;
+	size_t size;
+	double start = fmuProfileNow();
+	za = zipOpen(fmuPath);
+	if (!za)
+		return NULL;
+	e = zipFind(za, XML_FILE);
+	if (!e)
+		printf("error: %s not found in %s\n", XML_FILE, fmuPath);
+#ifndef _MSC_VER
+	imagePath = e && !filter ? fmuCacheImagePath(e->crc, e->size) : NULL;
+	stored = imagePath ? zipReadStored(za, e) : NULL;
+	if (stored) {
+		key.crc = e->crc;
+		key.size = e->size;
+		key.stored = stored;
+		key.storedSize = e->compSize;
+		md = mdImageLoad(imagePath, &key);
+		if (md)
+			utimensat(AT_FDCWD, imagePath, NULL, 0); // recently used
+	}
+#endif
+	if (!md && e)
+		xml = zipExtractToMemory(za, e, &size);
+	zipClose(za);
+	if (md) {
+		fmuProfileAdd(p, phase_parse, start);
+		if (p)
+			profileModel(p, md);
+		free(imagePath);
+		free(stored);
+		return md;
+	}
+	start = fmuProfileAdd(p, phase_extract, start);
+	if (xml) {
+		md = parseBufferInSitu(xml, size, fmuPath, filter, nThreads);
+		xml = NULL; // taken over by the parser
+		fmuProfileAdd(p, phase_parse, start);
+		if (p) {
+			p->bytesExtracted += size;
+			profileModel(p, md);
+		}
+#ifndef _MSC_VER
+		if (md && stored) {
+			if (mdImageSave(imagePath, md, &key))
+				fmuCacheTrim();
+			else
+				printf("warning: could not write %s\n", imagePath);
+		}
+#endif
+	}
+	free(imagePath);
+	free(stored);
+	free(xml);
+	return md;
+}
+
+// Returns 0 to indicate that md does not describe a Co-Simulation FMU
+static int printModelDescription(ModelDescription* md, int verbose) {
 	Element* e = (Element*) md;
 	int i;
-	printf("%s\n", elmNames[e->type]);
-	for (i = 0; i < e->n; i += 2)
-		printf("  %s=%s\n", e->attributes[i], e->attributes[i + 1]);
+	if (verbose) {
+		printf("%s\n", elmNames[e->type]);
+		for (i = 0; i < e->n; i += 2)
+			printf("  %s=%s\n", e->attributes[i], e->attributes[i + 1]);
+	}
 #ifdef FMI_COSIMULATION   
 	if (!md->cosimulation) {
 		printf(
 				"error: No Implementation element found in model description. This FMU is not for Co-Simulation.\n");
-		exit(EXIT_FAILURE);
+		return 0;
 	}
 	e = md->cosimulation->capabilities;
-	printf("%s\n", elmNames[e->type]);
-	for (i = 0; i < e->n; i += 2)
-		printf("  %s=%s\n", e->attributes[i], e->attributes[i + 1]);
+	if (verbose) {
+		printf("%s\n", elmNames[e->type]);
+		for (i = 0; i < e->n; i += 2)
+			printf("  %s=%s\n", e->attributes[i], e->attributes[i + 1]);
+	}
 #endif // FMI_COSIMULATION  
+	return 1;
 }
 
-char* loadFMU(char *path, FMU *fmu) {
+// Load the FMU: parse its model description and load its shared library.
+// On success, *tmpPath is the directory the FMU was extracted to, or NULL if it
+// was loaded from memory. flags is a combination of the FMU_LOAD_ flags.
+// The model description is parsed on the calling thread only, unless
+// FMU_LOAD_PARALLEL_PARSE is given: loads usually run on a thread pool
+// already, see fmuBatchLoad() and fmuServerRun().
+// Returns 0 to indicate failure, nothing needs to be released then.
+int tryLoadFMU(const char *path, FMU *fmu, char** tmpPath, int flags) {
+	int verbose = flags & FMU_LOAD_VERBOSE;
+	int parseThreads = flags & FMU_LOAD_PARALLEL_PARSE ? 0 : 1;
+	double t0 = fmuProfileNow();
+	double start;
 	char* fmuPath;
-	char* tmpPath;
-	char* xmlPath;
 	char* dllPath;
+	long n;
+	int s;
 
 	// get absolute path to FMU, NULL if not found
+	*tmpPath = NULL;
 	fmuPath = getFmuPath(path);
 	if (!fmuPath)
-		exit(EXIT_FAILURE);
+		return 0;
 
-	// unzip the FMU to the tmpPath directory
-	tmpPath = getTmpPath();
-	if (!unzip(fmuPath, tmpPath))
-		exit(EXIT_FAILURE);
+	fmu->modelDescription = NULL;
+	fmu->dllHandle = NULL;
+	fmu->dllFd = -1;
+	fmu->host = NULL;
+	memset(&fmu->profile, 0, sizeof(FmuProfile));
+#ifndef _MSC_VER
+	// the library is loaded by a worker process, only the model description here
+	if (flags & FMU_LOAD_HOSTED) {
+		fmu->modelDescription = parseFromArchive(fmuPath, &fmu->profile, NULL,
+				parseThreads);
+		if (!fmu->modelDescription
+				|| !printModelDescription(fmu->modelDescription, verbose)
+				|| !fmuHostStart(fmuPath, fmu,
+						flags & ~(FMU_LOAD_HOSTED | FMU_LOAD_VERBOSE)))
+			goto failure;
+		free(fmuPath);
+		fmu->profile.total = fmuProfileNow() - t0;
+		return 1;
+	}
+#endif
+#if FMU_MEMFD
+	// parse the model description and load the shared library straight from
+	// the archive; no temporary directory is needed then
+	if (useMemoryLoading()) {
+		fmu->modelDescription = parseFromArchive(fmuPath, &fmu->profile, NULL,
+				parseThreads);
+		if (!fmu->modelDescription
+				|| !printModelDescription(fmu->modelDescription, verbose))
+			goto failure;
+		if (loadDllFromFMU(fmuPath, fmu, flags)) {
+			free(fmuPath);
+			fmu->profile.total = fmuProfileNow() - t0;
+			return 1; // nothing to remove at unload
+		}
+		printf("falling back to loading the extracted shared library\n");
+	}
+#endif
 
-	// parse tmpPath\modelDescription.xml
-	xmlPath = (char*) calloc(sizeof(char),
-			strlen(tmpPath) + strlen(XML_FILE) + 1);
-	sprintf(xmlPath, "%s%s", tmpPath, XML_FILE);
-	fmu->modelDescription = parse(xmlPath);
-	free(xmlPath);
-	if (!fmu->modelDescription)
-		exit(EXIT_FAILURE);
-	printModelDescription(fmu->modelDescription);
+	// unzip the FMU to the tmpPath directory, unless an unpacked copy is cached
+	start = fmuProfileNow();
+#ifndef _MSC_VER
+	if (getFmuCacheDir())
+		*tmpPath = fmuCacheAcquire(fmuPath);
+#endif
+	if (!*tmpPath) {
+		*tmpPath = getTmpPath();
+		if (!*tmpPath)
+			goto failure;
+#ifdef _MSC_VER
+		n = unzip(fmuPath, *tmpPath) ? 0 : -1;
+#else
+		n = extractFMU(fmuPath, *tmpPath);
+#endif
+		if (n < 0)
+			goto failure;
+		fmu->profile.bytesExtracted += n;
+	}
+	fmuProfileAdd(&fmu->profile, phase_extract, start);
+
+	// parse the model description, or use its image
+	if (!fmu->modelDescription) {
+		fmu->modelDescription = parseFromArchive(fmuPath, &fmu->profile, NULL,
+				parseThreads);
+		if (!fmu->modelDescription
+				|| !printModelDescription(fmu->modelDescription, verbose))
+			goto failure;
+	}
 
 	dllPath = (char*) calloc(sizeof(char),
-			strlen(tmpPath) + strlen(DLL_DIR)
+			strlen(*tmpPath) + strlen(DLL_DIR) + strlen(DLL_DIR2)
 					+ strlen(getModelIdentifier(fmu->modelDescription))
-					+ strlen(DLL_SUFFIX) + 1);
-	sprintf(dllPath, "%s%s%s%s", tmpPath, DLL_DIR,
+					+ strlen(DLL_SUFFIX) + strlen(DLL_SUFFIX2) + 1);
+	sprintf(dllPath, "%s%s%s%s", *tmpPath, DLL_DIR,
 			getModelIdentifier(fmu->modelDescription), DLL_SUFFIX);
 
-	int s = loadDll(dllPath, fmu);
+	s = loadDll(dllPath, fmu, flags);
 
 	if (!s) {
-		printf("printing debug");
 		// try the alternative directory and suffix
-		dllPath = (char*) calloc(sizeof(char),
-				strlen(tmpPath) + strlen(DLL_DIR2)
-						+ strlen(getModelIdentifier(fmu->modelDescription))
-						+ strlen(DLL_SUFFIX2) + 1);
-		sprintf(dllPath, "%s%s%s%s", tmpPath, DLL_DIR2,
+		sprintf(dllPath, "%s%s%s%s", *tmpPath, DLL_DIR2,
 				getModelIdentifier(fmu->modelDescription), DLL_SUFFIX2);
-		if (!loadDll(dllPath, fmu))
-			exit(EXIT_FAILURE);
-
+		s = loadDll(dllPath, fmu, flags);
 	}
-
 	free(dllPath);
+	if (!s)
+		goto failure;
+
+	free(fmuPath);
+	fmu->profile.total = fmuProfileNow() - t0;
+	return 1; // success
+
+	failure: freeFMU(fmu, *tmpPath);
+	*tmpPath = NULL;
 	free(fmuPath);
-	//free(tmpPath);
+	return 0;
+}
+
+int onlyOncePerProcess(ModelDescription* md) {
+	ValueStatus vs;
+	char once = getBoolean(md->cosimulation->capabilities,
+			att_canBeInstantiatedOnlyOncePerProcess, &vs);
+	return vs == valueDefined && once;
+}
+
+char* loadFMU(char *path, FMU *fmu) {
+	char* tmpPath;
+	if (!tryLoadFMU(path, fmu, &tmpPath, FMU_LOAD_VERBOSE))
+		exit(EXIT_FAILURE);
 	return tmpPath;
 }
 
+// Release everything tryLoadFMU() acquired. Instances must be freed before.
+void freeFMU(FMU *fmu, char* tmpPath) {
+#ifndef _MSC_VER
+	fmuHostStop(fmu);
+#endif
+	if (fmu->dllHandle) {
+#ifdef _MSC_VER
+		FreeLibrary(fmu->dllHandle);
+#else
+		dlclose(fmu->dllHandle);
+		if (fmu->dllFd >= 0)
+			close(fmu->dllFd);
+		fmu->dllFd = -1;
+#endif
+		fmu->dllHandle = NULL;
+	}
+	if (fmu->modelDescription) {
+		freeElement(fmu->modelDescription);
+		fmu->modelDescription = NULL;
+	}
+	if (tmpPath) {
+#ifndef _MSC_VER
+		if (!fmuCacheRelease(tmpPath))
+			removeTmpDir(tmpPath);
+#endif
+		free(tmpPath);
+	}
+}
+
+// Parse the model description only, see parseFromArchive()
+// filter selects the variables, NULL for all
+ModelDescription* inspectFMU(const char* fmuPath, const VarFilter* filter) {
+	return parseFromArchive(fmuPath, NULL, filter, 1);
+}
+
+static const char* typeName(Elm type) {
+	return type < SIZEOF_ELM ? elmNames[type] : "?";
+}
+
+static const char* enuName(Enu e) {
+	return e < SIZEOF_ENU ? enuNames[e] : "?";
+}
+
+// print the name of the variable at position i with format, which has one %s
+static void printName(FILE* file, const char* format, ModelDescription* md,
+		int i) {
+	char* name = newVariableName(md, i);
+	fprintf(file, format, name ? name : "?");
+	free(name);
+}
+
+// print the inputs each output depends on directly, one line per output:
+// name <- input...
+static void printDependencies(ModelDescription* md) {
+	const int* deps;
+	int o, k, n;
+	printf("%s\n", elmNames[elm_DirectDependency]);
+	for (o = 0; o < md->table->n; o++) {
+		if (md->table->causality[o] != enu_output)
+			continue;
+		n = getDependencies(md, o, &deps);
+		printName(stdout, "  %s <-", md, o);
+		for (k = 0; k < n; k++)
+			printName(stdout, " %s", md, deps[k]);
+		printf("%s\n", n ? "" : " none");
+	}
+}
+
+// print attributes, capabilities and variables, one line per variable:
+// name valueReference type causality variability alias
+void printInspection(const char* fmuPath, ModelDescription* md) {
+	Element* e = (Element*) md;
+	int i;
+	printf("fmu=%s\n", fmuPath);
+	for (i = 0; i < e->n; i += 2)
+		printf("  %s=%s\n", e->attributes[i], e->attributes[i + 1]);
+	if (md->cosimulation) {
+		e = md->cosimulation->capabilities;
+		printf("%s %s\n", elmNames[md->cosimulation->type],
+				elmNames[e->type]);
+		for (i = 0; i < e->n; i += 2)
+			printf("  %s=%s\n", e->attributes[i], e->attributes[i + 1]);
+	} else
+		printf("model exchange only\n");
+	printf("%s\n", elmNames[elm_ModelVariables]);
+	if (md->modelVariables)
+		for (i = 0; md->modelVariables[i]; i++) {
+			ScalarVariable* sv = md->modelVariables[i];
+			printName(stdout, "  %s", md, i);
+			printf(" %u %s %s %s %s\n", getValueReference(sv), typeName(sv->typeSpec->type),
+					enuName(getCausality(sv)), enuName(getVariability(sv)),
+					enuName(getAlias(sv)));
+		}
+	printDependencies(md);
+}
+
 static void doubleToCommaString(char* buffer, double r) {
 	char* comma;
 	sprintf(buffer, "%.16g", r);
@@ -369,7 +832,7 @@ static void doubleToCommaString(char* buffer, double r) {
 	//if (comma) *comma = ',';
 }
 
-// output time and all non-alias variables in CSV format
+// output time and one variable of each value reference in CSV format
 // if separator is ',', columns are separated by ',' and '.' is used for floating-point numbers.
 // otherwise, the given separator (e.g. ';' or '\t') is to separate columns, and ',' is used 
 // as decimal dot in floating-point numbers.
@@ -381,7 +844,7 @@ void outputRow(FMU *fmu, fmiComponent c, double time, FILE* file,
 	fmiBoolean b;
 	fmiString s;
 	fmiValueReference vr;
-	ScalarVariable** vars = fmu->modelDescription->modelVariables;
+	VarTable* t = fmu->modelDescription->table;
 	char buffer[32];
 
 	separator = ' ';
@@ -399,29 +862,31 @@ void outputRow(FMU *fmu, fmiComponent c, double time, FILE* file,
 	}
 
 	// print all other columns
-	for (k = 0; vars[k]; k++) {
-		ScalarVariable* sv = vars[k];
-		if (getAlias(sv) != enu_noAlias)
-			continue;
+	for (k = 0; k < t->n; k++) {
+		if (t->canonical[k] != k)
+			continue; // an alias, its value is in another column
 		if (header) {
 			// output names only
 			if (separator == ',') {
 				// treat array element, e.g. print a[1, 2] as a[1.2]
-				char* s = strdup(getName(sv));
+				char* name = newVariableName(fmu->modelDescription, k);
 				fprintf(file, "%c", separator);
-				while (*s) {
+				for (s = name; s && *s; s++)
 					if (*s != ' ')
 						fprintf(file, "%c", *s == ',' ? '.' : *s);
-					s++;
-				}
-			} else
-				fprintf(file, "%c%s", separator, getName(sv));
+				free(name);
+			} else {
+				fprintf(file, "%c", separator);
+				printName(file, "%s", fmu->modelDescription, k);
+			}
 		} else {
-			// output values
-			vr = getValueReference(sv);
-			switch (sv->typeSpec->type) {
+			// output values, a canonical variable may be a negated alias
+			vr = t->vr[k];
+			switch (t->type[k]) {
 			case elm_Real:
 				fmu->getReal(c, &vr, 1, &r);
+				if (t->negated[k])
+					r = -r;
 
 				if (separator == ',')
 					fprintf(file, "%.16g", r);
@@ -434,6 +899,8 @@ void outputRow(FMU *fmu, fmiComponent c, double time, FILE* file,
 			case elm_Integer:
 			case elm_Enumeration:
 				fmu->getInteger(c, &vr, 1, &i);
+				if (t->negated[k])
+					i = -i;
 				fprintf(file, "%c%d", separator, i);
 				break;
 			case elm_Boolean:
@@ -445,8 +912,7 @@ void outputRow(FMU *fmu, fmiComponent c, double time, FILE* file,
 				fprintf(file, "%c%s", separator, s);
 				break;
 			default:
-				fprintf(file, "%cNoValueForType=%d", separator,
-						sv->typeSpec->type);
+				fprintf(file, "%cNoValueForType=%d", separator, t->type[k]);
 			}
 		}
 	} // for
@@ -497,62 +963,86 @@ const char* fmiStatusToString_CS(fmiStatus status) {
 	}
 }
 
-// search a fmu for the given variable
-// return NULL if not found or vr = fmiUndefinedValueReference
-ScalarVariable* getSV(FMU* fmu, char type, fmiValueReference vr) {
-	int i;
-	Elm tp;
-	ScalarVariable** vars = fmu->modelDescription->modelVariables;
-	if (vr == fmiUndefinedValueReference)
-		return NULL;
+// Returns the base type of the type char of a value reference, e.g. r for
+// #r12# in a log message, elm_ANY_TYPE if it is none of r, i, b and s
+static Elm baseTypeOf(char type) {
 	switch (type) {
 	case 'r':
-		tp = elm_Real;
-		break;
+		return elm_Real;
 	case 'i':
-		tp = elm_Integer;
-		break;
+		return elm_Integer; // or Enumeration, see getVariable()
 	case 'b':
-		tp = elm_Boolean;
-		break;
+		return elm_Boolean;
 	case 's':
-		tp = elm_String;
-		break;
-	}
-	for (i = 0; vars[i]; i++) {
-		ScalarVariable* sv = vars[i];
-		if (vr == getValueReference(sv) && tp == sv->typeSpec->type)
-			return sv;
+		return elm_String;
+	default:
+		return elm_ANY_TYPE;
 	}
-	return NULL;
+}
+
+// search a fmu for the given variable
+// return NULL if not found or vr = fmiUndefinedValueReference
+ScalarVariable* getSV(FMU* fmu, char type, fmiValueReference vr) {
+	Elm tp = baseTypeOf(type);
+	return tp == elm_ANY_TYPE ?
+			NULL : getVariable(fmu->modelDescription, vr, tp);
 }
 
 ScalarVariable* getSV_CS(FMU* fmu, char type, fmiValueReference vr) {
-	int i;
-	Elm tp;
-	ScalarVariable** vars = fmu->modelDescription->modelVariables;
-	if (vr == fmiUndefinedValueReference)
-		return NULL;
-	switch (type) {
-	case 'r':
-		tp = elm_Real;
-		break;
-	case 'i':
-		tp = elm_Integer;
-		break;
-	case 'b':
-		tp = elm_Boolean;
-		break;
-	case 's':
-		tp = elm_String;
-		break;
-	}
-	for (i = 0; vars[i]; i++) {
-		ScalarVariable* sv = vars[i];
-		if (vr == getValueReference(sv) && tp == sv->typeSpec->type)
-			return sv;
+	return getSV(fmu, type, vr);
+}
+
+// FMUs of instances created outside of fmi_cosim, see fmuLogger()
+typedef struct RegisteredInstance {
+	char* instanceName;
+	FMU* fmu;
+	struct RegisteredInstance* next;
+} RegisteredInstance;
+static RegisteredInstance* instances = NULL;
+static pthread_mutex_t instancesLock = PTHREAD_MUTEX_INITIALIZER;
+
+void registerInstance(const char* instanceName, FMU* fmu) {
+	RegisteredInstance* r = (RegisteredInstance*) calloc(1,
+			sizeof(RegisteredInstance));
+	if (!r)
+		return;
+	r->instanceName = strdup(instanceName);
+	r->fmu = fmu;
+	pthread_mutex_lock(&instancesLock);
+	r->next = instances;
+	instances = r;
+	pthread_mutex_unlock(&instancesLock);
+}
+
+void unregisterInstance(const char* instanceName) {
+	RegisteredInstance** p;
+	RegisteredInstance* r = NULL;
+	pthread_mutex_lock(&instancesLock);
+	for (p = &instances; *p; p = &(*p)->next)
+		if (!strcmp((*p)->instanceName, instanceName)) {
+			r = *p;
+			*p = r->next;
+			break;
+		}
+	pthread_mutex_unlock(&instancesLock);
+	if (r) {
+		free(r->instanceName);
+		free(r);
 	}
-	return NULL;
+}
+
+// Returns NULL if no FMU is registered for instanceName
+FMU* getInstanceFMU(const char* instanceName) {
+	RegisteredInstance* r;
+	FMU* fmu = NULL;
+	pthread_mutex_lock(&instancesLock);
+	for (r = instances; r; r = r->next)
+		if (!strcmp(r->instanceName, instanceName)) {
+			fmu = r->fmu;
+			break;
+		}
+	pthread_mutex_unlock(&instancesLock);
+	return fmu;
 }
 
 int error(const char* message) {
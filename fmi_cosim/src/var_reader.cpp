@@ -0,0 +1,145 @@
+/*
+ * var_reader.cpp
+ *
+ * The variables are sorted by their canonical variable, so that each group
+ * of aliases gets one slot in the call of its type.
+ */
+
+#include <stdlib.h>
+#include <var_reader.hpp>
+
+typedef struct {
+	int canonical; // position of the variable holding the value
+	int k;         // index of the variable in the reader
+} ReadKey;
+
+static int compareKeys(const void* a, const void* b) {
+	const ReadKey* x = (const ReadKey*) a;
+	const ReadKey* y = (const ReadKey*) b;
+	return x->canonical != y->canonical ?
+			(x->canonical < y->canonical ? -1 : 1) : x->k - y->k;
+}
+
+static int readCall(Elm type) {
+	switch (type) {
+	case elm_Real:
+		return READ_REAL;
+	case elm_Integer:
+	case elm_Enumeration:
+		return READ_INTEGER;
+	case elm_Boolean:
+		return READ_BOOLEAN;
+	case elm_String:
+		return READ_STRING;
+	default:
+		return READ_CALLS;
+	}
+}
+
+VarReader* varReaderNew(ModelDescription* md, const int* positions, int n) {
+	VarTable* t = md->table;
+	VarReader* r = (VarReader*) calloc(1, sizeof(VarReader));
+	ReadKey* keys = (ReadKey*) malloc((n ? n : 1) * sizeof(ReadKey));
+	int size = n ? n : 1, i, k, call;
+	if (r) {
+		r->n = n;
+		r->call = (unsigned char*) malloc(size);
+		r->slot = (int*) malloc(size * sizeof(int));
+		r->negated = (unsigned char*) malloc(size);
+		for (call = 0; call < READ_CALLS; call++)
+			r->refs[call] = (fmiValueReference*) malloc(
+					size * sizeof(fmiValueReference));
+		r->reals = (fmiReal*) calloc(size, sizeof(fmiReal));
+		r->integers = (fmiInteger*) calloc(size, sizeof(fmiInteger));
+		r->booleans = (fmiBoolean*) calloc(size, sizeof(fmiBoolean));
+		r->strings = (fmiString*) calloc(size, sizeof(fmiString));
+	}
+	if (!r || !keys || !r->call || !r->slot || !r->negated || !r->refs[0]
+			|| !r->refs[1] || !r->refs[2] || !r->refs[3] || !r->reals
+			|| !r->integers || !r->booleans || !r->strings) {
+		free(keys);
+		varReaderFree(r);
+		return NULL;
+	}
+	for (k = 0; k < n; k++) {
+		keys[k].canonical = t->canonical[positions[k]];
+		keys[k].k = k;
+	}
+	qsort(keys, n, sizeof(ReadKey), compareKeys);
+	for (i = 0; i < n; i++) {
+		int c = keys[i].canonical;
+		k = keys[i].k;
+		call = readCall((Elm) t->type[c]);
+		r->call[k] = call;
+		r->negated[k] = t->negated[positions[k]];
+		if (call == READ_CALLS)
+			continue;
+		if (!i || keys[i - 1].canonical != c)
+			r->refs[call][r->nRefs[call]++] = t->vr[c]; // a new value
+		r->slot[k] = r->nRefs[call] - 1;
+	}
+	free(keys);
+	return r;
+}
+
+fmiStatus varReaderGet(VarReader* r, FMU* fmu, fmiComponent c,
+		VarValue* values) {
+	fmiStatus status = fmiOK, s;
+	int k;
+	if (r->nRefs[READ_REAL]) {
+		s = fmu->getReal(c, r->refs[READ_REAL], r->nRefs[READ_REAL], r->reals);
+		status = s > status ? s : status;
+	}
+	if (r->nRefs[READ_INTEGER]) {
+		s = fmu->getInteger(c, r->refs[READ_INTEGER], r->nRefs[READ_INTEGER],
+				r->integers);
+		status = s > status ? s : status;
+	}
+	if (r->nRefs[READ_BOOLEAN]) {
+		s = fmu->getBoolean(c, r->refs[READ_BOOLEAN], r->nRefs[READ_BOOLEAN],
+				r->booleans);
+		status = s > status ? s : status;
+	}
+	if (r->nRefs[READ_STRING]) {
+		s = fmu->getString(c, r->refs[READ_STRING], r->nRefs[READ_STRING],
+				r->strings);
+		status = s > status ? s : status;
+	}
+	// fan the values out to all variables, aliases included
+	for (k = 0; k < r->n; k++)
+		switch (r->call[k]) {
+		case READ_REAL:
+			values[k].r = r->negated[k] ?
+					-r->reals[r->slot[k]] : r->reals[r->slot[k]];
+			break;
+		case READ_INTEGER:
+			values[k].i = r->negated[k] ?
+					-r->integers[r->slot[k]] : r->integers[r->slot[k]];
+			break;
+		case READ_BOOLEAN:
+			values[k].b = r->booleans[r->slot[k]];
+			break;
+		case READ_STRING:
+			values[k].s = r->strings[r->slot[k]];
+			break;
+		default:
+			status = fmiError; // no value for this type
+		}
+	return status;
+}
+
+void varReaderFree(VarReader* r) {
+	int call;
+	if (!r)
+		return;
+	free(r->call);
+	free(r->slot);
+	free(r->negated);
+	for (call = 0; call < READ_CALLS; call++)
+		free(r->refs[call]);
+	free(r->reals);
+	free(r->integers);
+	free(r->booleans);
+	free(r->strings);
+	free(r);
+}
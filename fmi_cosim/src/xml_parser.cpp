@@ -4,7 +4,8 @@
  * The parser creates an AST (abstract syntax tree) for a given XML file.
  * The root node of the AST is of type ModelDescription.
  * Validation already performed by this parser
- * - check for match of open/close elements (performed by Expat)
+ * - check for match of open/close elements (performed by Expat or, for
+ *   texts parsed in place, by the tokenizer)
  * - ceck element, attribute and enum value names, all case sensitive
  * - check for each element that is has the expected parent element
  * - check for correct sequence of elements
@@ -19,11 +20,33 @@
  * -------------------------------------------------------------------------*/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <strings.h>
 #include <xml_parser.hpp>
-
-const char *elmNames[SIZEOF_ELM] = { "fmiModelDescription", "UnitDefinitions",
+#include <name_hash.hpp>
+#include <md_image.hpp>
+#include <dep_graph.hpp>
+#include <name_trie.hpp>
+#include <ctype.h>
+#ifndef _MSC_VER
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define countBits(x) ((int) __popcnt64(x))
+#else
+#define countBits(x) __builtin_popcountll(x)
+#endif
+
+constexpr const char* elmNames[SIZEOF_ELM] = { "fmiModelDescription", "UnitDefinitions",
 		"BaseUnit", "DisplayUnitDefinition", "TypeDefinitions", "Type",
 		"RealType", "IntegerType", "BooleanType", "StringType",
 		"EnumerationType", "Item", "DefaultExperiment", "VendorAnnotations",
@@ -32,7 +55,7 @@ const char *elmNames[SIZEOF_ELM] = { "fmiModelDescription", "UnitDefinitions",
 		"Enumeration", "Implementation", "CoSimulation_StandAlone",
 		"CoSimulation_Tool", "Model", "File", "Capabilities" };
 
-const char *attNames[SIZEOF_ATT] = { "fmiVersion", "displayUnit", "gain",
+constexpr const char* attNames[SIZEOF_ATT] = { "fmiVersion", "displayUnit", "gain",
 		"offset", "unit", "name", "description", "quantity", "relativeQuantity",
 		"min", "max", "nominal", "declaredType", "start", "fixed", "startTime",
 		"stopTime", "tolerance", "value", "valueReference", "variability",
@@ -47,39 +70,64 @@ const char *attNames[SIZEOF_ATT] = { "fmiVersion", "displayUnit", "gain",
 		"canNotUseMemoryManagementFunctions", "file", "entryPoint",
 		"manualStart", "type" };
 
-const char *enuNames[SIZEOF_ENU] = { "flat", "structured", "constant",
+constexpr const char* enuNames[SIZEOF_ENU] = { "flat", "structured", "constant",
 		"parameter", "discrete", "continuous", "input", "output", "internal",
 		"none", "noAlias", "alias", "negatedAlias" };
 
+// perfect hash tables of the names, generated at compile time
+static constexpr NameHash<64> elmHash = makeNameHash<64>(elmNames, SIZEOF_ELM);
+static constexpr NameHash<128> attHash = makeNameHash<128>(attNames,
+		SIZEOF_ATT);
+static constexpr NameHash<32> enuHash = makeNameHash<32>(enuNames, SIZEOF_ENU);
+static_assert(elmHash.seed < NAME_HASH_MAX_SEED, "no perfect hash of elmNames");
+static_assert(attHash.seed < NAME_HASH_MAX_SEED, "no perfect hash of attNames");
+static_assert(enuHash.seed < NAME_HASH_MAX_SEED, "no perfect hash of enuNames");
+static_assert(SIZEOF_ATT <= 64, "attMask has a bit for every attribute");
+
 #define ANY_TYPE -1
-#define XMLBUFSIZE 1024
-char text[XMLBUFSIZE];      // XML file is parsed in chunks of length XMLBUFZIZE
-XML_Parser parser = NULL;    // non-NULL during parsing
-Stack* stack = NULL;         // the parser stack
-char* data = NULL;          // buffer that holds element content, see handleData
-int skipData = 0;        // 1 to ignore element content, 0 when recordig content
+#define XMLBUFSIZE 1024      // XML file is parsed in chunks of length XMLBUFSIZE
+
+// State of one call of parse(), passed to the callbacks as expat user data,
+// so that model descriptions can be parsed concurrently
+typedef struct {
+	XML_Parser parser;
+	Stack* stack;       // the parser stack
+	Arena* arena;       // owns the AST, handed over to the ModelDescription
+	Arena* names;       // owns the copied names of the ScalarVariables until
+	                    // validate() has built the NameTrie, see checkModel()
+	char* data;         // buffer that holds element content, see handleData
+	int skipData;       // 1 to ignore element content, 0 when recordig content
+	const VarFilter* filter; // NULL to build all variables
+	int skipDepth;      // > 0 while inside an element skipped by the filter
+	int quiet;          // 1 to stop at errors without reporting them
+	int inSitu;         // 1 if attribute values point into the parsed text
+	int stopped;        // 1 once a callback stopped the parser
+} ParserContext;
 
 // ------------------------------------------------------------------------- 
 // Low-level functions for inspecting the model description 
 
+// The attributes are ordered by Att, so the rank of a among the attributes
+// present is the position of its pair
 const char* getString(void* element, Att a) {
 	Element* e = (Element*) element;
-	const char** attr = e->attributes;
-	int i;
-	for (i = 0; i < e->n; i += 2)
-		if (attr[i] == attNames[a])
-			return attr[i + 1];
-	return NULL;
+	unsigned long long bit = 1ULL << a;
+	if (!(e->attMask & bit))
+		return NULL;
+	return e->attributes[2 * countBits(e->attMask & (bit - 1)) + 1];
 }
 
+// strtod and strtol accept the same input as sscanf, but are faster
 double getDouble(void* element, Att a, ValueStatus* vs) {
 	double d = 0;
+	char* end;
 	const char* value = getString(element, a);
 	if (!value) {
 		*vs = valueMissing;
 		return d;
 	}
-	*vs = (1 == sscanf(value, "%lf", &d)) ? valueDefined : valueIllegal;
+	d = strtod(value, &end);
+	*vs = end != value ? valueDefined : valueIllegal;
 	return d;
 }
 
@@ -87,23 +135,27 @@ double getDouble(void* element, Att a, ValueStatus* vs) {
 // e.g. the start value for a variable of user-defined enumeration type.
 int getInt(void* element, Att a, ValueStatus* vs) {
 	int n = 0;
+	char* end;
 	const char* value = getString(element, a);
 	if (!value) {
 		*vs = valueMissing;
 		return n;
 	}
-	*vs = (1 == sscanf(value, "%d", &n)) ? valueDefined : valueIllegal;
+	n = (int) strtol(value, &end, 10);
+	*vs = end != value ? valueDefined : valueIllegal;
 	return n;
 }
 
 unsigned int getUInt(void* element, Att a, ValueStatus* vs) {
 	unsigned int u = -1;
+	char* end;
 	const char* value = getString(element, a);
 	if (!value) {
 		*vs = valueMissing;
 		return u;
 	}
-	*vs = (1 == sscanf(value, "%u", &u)) ? valueDefined : valueIllegal;
+	u = (unsigned int) strtoul(value, &end, 10);
+	*vs = end != value ? valueDefined : valueIllegal;
 	return u;
 }
 
@@ -177,7 +229,9 @@ int getNumberOfEventIndicators(ModelDescription* md) {
 	return n;
 }
 
-// name is a required attribute of ScalarVariable, Type, Item, Annotation, and Tool
+// name is a required attribute of ScalarVariable, Type, Item, Annotation, and Tool.
+// The names of validated ScalarVariables are kept by the NameTrie only, see
+// getVariableName().
 const char* getName(void* element) {
 	const char* name = getString(element, att_name);
 	assert(name); // this is a required attribute
@@ -187,45 +241,27 @@ const char* getName(void* element) {
 // returns one of: input, output, internal, none
 // if value is missing, the default internal is returned
 Enu getCausality(void* scalarVariable) {
-	ValueStatus vs;
-	return getEnumValue(scalarVariable, att_causality, &vs);
+	return ((ScalarVariable*) scalarVariable)->info.causality;
 }
 
 // returns one of constant, parameter, discrete, continuous
 // if value is missing, the default continuous is returned
 Enu getVariability(void* scalarVariable) {
-	ValueStatus vs;
-	return getEnumValue(scalarVariable, att_variability, &vs);
+	return ((ScalarVariable*) scalarVariable)->info.variability;
 }
 
 // returns one of noAlias, alias, negatedAlias
 // if value is missing, the default noAlias is returned 
 Enu getAlias(void* scalarVariable) {
-	ValueStatus vs;
-	return getEnumValue(scalarVariable, att_alias, &vs);
+	return ((ScalarVariable*) scalarVariable)->info.alias;
 }
 
 // the vr is unique only for one of the 4 base data types r,i,b,s and
 // may also be fmiUndefinedValueReference = 4294967295 = 0xFFFFFFFF
 // here, i means integer or enumeration
 fmiValueReference getValueReference(void* scalarVariable) {
-	ValueStatus vs;
-	fmiValueReference vr = getUInt(scalarVariable, att_valueReference, &vs);
 	assert(((Element* )scalarVariable)->type == elm_ScalarVariable);
-	assert(vs == valueDefined); // this is a reqired attribute
-	return vr;
-}
-
-// the name is unique within a fmu
-ScalarVariable* getVariableByName(ModelDescription* md, const char* name) {
-	int i;
-	if (md->modelVariables)
-		for (i = 0; md->modelVariables[i]; i++) {
-			ScalarVariable* sv = (ScalarVariable*) md->modelVariables[i];
-			if (!strcmp(getName(sv), name))
-				return sv;
-		}
-	return NULL;
+	return ((ScalarVariable*) scalarVariable)->info.vr;
 }
 
 // Enumeration and Integer have the same base type while 
@@ -235,29 +271,313 @@ int sameBaseType(Elm t1, Elm t2) {
 			|| (t2 == elm_Enumeration && t1 == elm_Integer);
 }
 
+static unsigned refHash(Elm type, fmiValueReference vr) {
+	// Integer and Enumeration share their value references
+	unsigned t = type == elm_Enumeration ? elm_Integer : type;
+	unsigned h = (vr ^ (t << 28)) * 0x9e3779b1u;
+	return h ^ (h >> 16);
+}
+
+// Allocate md->index and index the names of the typeDefinitions, so that
+// declared types are found by hash already while validating
+// Returns 0 to indicate failure
+static int buildTypeIndex(ModelDescription* md) {
+	VarIndex* x = (VarIndex*) arenaAlloc(md->arena, sizeof(VarIndex));
+	unsigned n = 0, size = 16, i, k;
+	const char* name;
+	if (!x)
+		return 0;
+	while (md->typeDefinitions && md->typeDefinitions[n])
+		n++;
+	while (size < 2 * n)
+		size *= 2;
+	x->typeMask = size - 1;
+	x->byType = (unsigned*) arenaAlloc(md->arena, size * sizeof(unsigned));
+	if (!x->byType)
+		return 0;
+	for (i = 0; i < n; i++) {
+		name = getName(md->typeDefinitions[i]);
+		if (!name)
+			continue;
+		for (k = nameHash(0, name) & x->typeMask; x->byType[k];
+				k = (k + 1) & x->typeMask)
+			if (!strcmp(getName(md->typeDefinitions[x->byType[k] - 1]), name))
+				break; // the first of types of the same name wins
+		if (!x->byType[k])
+			x->byType[k] = i + 1;
+	}
+	md->index = x;
+	return 1; // success
+}
+
+// Returns the position of the type named declaredType in typeDefinitions,
+// -1 if none
+static int findType(ModelDescription* md, const char* declaredType) {
+	VarIndex* x = md->index;
+	unsigned k;
+	if (!declaredType)
+		return -1;
+	for (k = nameHash(0, declaredType) & x->typeMask; x->byType[k];
+			k = (k + 1) & x->typeMask)
+		if (!strcmp(getName(md->typeDefinitions[x->byType[k] - 1]),
+				declaredType))
+			return x->byType[k] - 1;
+	return -1;
+}
+
+// Returns 0 to indicate failure
+static int buildIndex(ModelDescription* md) {
+	VarIndex* x;
+	unsigned n = 0, size = 16, i, k;
+	while (md->modelVariables && md->modelVariables[n])
+		n++;
+	while (size < 2 * n)
+		size *= 2;
+	x = md->index; // see buildTypeIndex()
+	x->mask = size - 1;
+	x->byName = (unsigned*) arenaAlloc(md->arena, size * sizeof(unsigned));
+	x->byRef = (unsigned*) arenaAlloc(md->arena, size * sizeof(unsigned));
+	if (!x->byName || !x->byRef)
+		return 0;
+	for (i = 0; i < n; i++) {
+		ScalarVariable* sv = md->modelVariables[i];
+		VarInfo* v = &sv->info;
+		for (k = nameHash(0, getName(sv)) & x->mask; x->byName[k];
+				k = (k + 1) & x->mask)
+			;
+		x->byName[k] = i + 1; // names are unique
+		if (v->vr == fmiUndefinedValueReference)
+			continue;
+		for (k = refHash(v->baseType, v->vr) & x->mask; x->byRef[k];
+				k = (k + 1) & x->mask) {
+			VarInfo* first = &md->modelVariables[x->byRef[k] - 1]->info;
+			if (first->vr == v->vr && sameBaseType(first->baseType, v->baseType))
+				break; // alias of a variable that comes first
+		}
+		if (!x->byRef[k])
+			x->byRef[k] = i + 1;
+	}
+	md->index = x;
+	return 1; // success
+}
+
+// Set t->canonical of the variables of md, by way of the first variable of
+// each value reference. The first one of a group that is not noAlias points
+// to the noAlias one, if any, which comes after it.
+static void buildCanonical(ModelDescription* md, VarTable* t) {
+	int i, first;
+	for (i = 0; i < t->n; i++) {
+		first = getReferencePosition(md, t->vr[i], (Elm) t->type[i]);
+		t->canonical[i] = first == -1 ? i : first;
+	}
+	for (i = 0; i < t->n; i++) {
+		first = t->canonical[i];
+		if (first < i && t->alias[i] == enu_noAlias
+				&& t->alias[first] != enu_noAlias && t->canonical[first] == first)
+			t->canonical[first] = i;
+	}
+	for (i = 0; i < t->n; i++)
+		if (t->canonical[i] < i)
+			t->canonical[i] = t->canonical[t->canonical[i]];
+}
+
+// Distinct units in construction, in an open addressing table of their
+// positions plus 1, with room for (mask + 1) / 2 units
+typedef struct {
+	const char** units;
+	int n;
+	unsigned mask;
+	unsigned* slots;
+} UnitSet;
+
+// Returns 0 to indicate failure
+static int growUnits(UnitSet* u) {
+	unsigned mask = u->mask ? 2 * u->mask + 1 : 31, k;
+	unsigned* slots = (unsigned*) calloc(mask + 1, sizeof(unsigned));
+	const char** units = (const char**) realloc(u->units,
+			(mask + 1) / 2 * sizeof(const char*));
+	int i;
+	if (units)
+		u->units = units;
+	if (!slots || !units) {
+		free(slots);
+		return 0;
+	}
+	for (i = 0; i < u->n; i++) {
+		for (k = nameHash(0, units[i]) & mask; slots[k]; k = (k + 1) & mask)
+			;
+		slots[k] = i + 1;
+	}
+	free(u->slots);
+	u->slots = slots;
+	u->mask = mask;
+	return 1;
+}
+
+// Returns the position of unit in u, where it is added if new, -1 if unit
+// is NULL, -2 to indicate failure
+static int addUnit(UnitSet* u, const char* unit) {
+	unsigned k;
+	if (!unit)
+		return -1;
+	if (2 * (unsigned) (u->n + 1) > u->mask + 1 && !growUnits(u))
+		return -2;
+	for (k = nameHash(0, unit) & u->mask; u->slots[k]; k = (k + 1) & u->mask)
+		if (!strcmp(u->units[u->slots[k] - 1], unit))
+			return u->slots[k] - 1;
+	u->units[u->n] = unit;
+	u->slots[k] = ++u->n;
+	return u->n - 1;
+}
+
+// Set the columns of the attributes of the variables of md that default to
+// those of their declared type
+// Returns 0 to indicate failure
+static int flattenTypes(ModelDescription* md, VarTable* t) {
+	UnitSet u;
+	int i, failed = 0;
+	memset(&u, 0, sizeof(UnitSet));
+	for (i = 0; i < t->n; i++) {
+		ScalarVariable* sv = md->modelVariables[i];
+		int k = findType(md, getString(sv->typeSpec, att_declaredType));
+		Element* tp = k == -1 ? NULL : md->typeDefinitions[k]->typeSpec;
+		const char* unit = getString(sv->typeSpec, att_unit);
+		const char* displayUnit = getString(sv->typeSpec, att_displayUnit);
+		t->declaredType[i] = k;
+		t->defined[i] = sv->info.defined;
+		t->nominal[i] = sv->info.nominal;
+		t->min[i] = sv->info.min;
+		t->max[i] = sv->info.max;
+		t->unit[i] = addUnit(&u, unit || !tp ? unit : getString(tp, att_unit));
+		t->displayUnit[i] = addUnit(&u, displayUnit || !tp ?
+				displayUnit : getString(tp, att_displayUnit));
+		failed |= t->unit[i] == -2 || t->displayUnit[i] == -2;
+	}
+	t->nUnits = u.n;
+	t->units = (const char**) arenaAlloc(md->arena,
+			u.n * sizeof(const char*));
+	failed |= !t->units;
+	if (!failed)
+		memcpy(t->units, u.units, u.n * sizeof(const char*));
+	free(u.units);
+	free(u.slots);
+	return !failed;
+}
+
+// the name is unique within a fmu
+// Returns 0 to indicate failure
+static int buildTable(ModelDescription* md) {
+	VarTable* t = (VarTable*) arenaAlloc(md->arena, sizeof(VarTable));
+	int i;
+	if (!t)
+		return 0;
+	while (md->modelVariables && md->modelVariables[t->n])
+		t->n++;
+	t->vr = (fmiValueReference*) arenaAlloc(md->arena,
+			t->n * sizeof(fmiValueReference));
+	t->type = (unsigned char*) arenaAlloc(md->arena, t->n);
+	t->causality = (unsigned char*) arenaAlloc(md->arena, t->n);
+	t->variability = (unsigned char*) arenaAlloc(md->arena, t->n);
+	t->alias = (unsigned char*) arenaAlloc(md->arena, t->n);
+	t->canonical = (int*) arenaAlloc(md->arena, t->n * sizeof(int));
+	t->negated = (unsigned char*) arenaAlloc(md->arena, t->n);
+	t->declaredType = (int*) arenaAlloc(md->arena, t->n * sizeof(int));
+	t->defined = (unsigned char*) arenaAlloc(md->arena, t->n);
+	t->nominal = (double*) arenaAlloc(md->arena, t->n * sizeof(double));
+	t->min = (double*) arenaAlloc(md->arena, t->n * sizeof(double));
+	t->max = (double*) arenaAlloc(md->arena, t->n * sizeof(double));
+	t->unit = (int*) arenaAlloc(md->arena, t->n * sizeof(int));
+	t->displayUnit = (int*) arenaAlloc(md->arena, t->n * sizeof(int));
+	if (!t->vr || !t->type || !t->causality || !t->variability || !t->alias
+			|| !t->canonical || !t->negated || !t->declaredType || !t->defined
+			|| !t->nominal || !t->min || !t->max || !t->unit
+			|| !t->displayUnit)
+		return 0;
+	for (i = 0; i < t->n; i++) {
+		VarInfo* v = &md->modelVariables[i]->info;
+		t->vr[i] = v->vr;
+		t->type[i] = v->baseType;
+		t->causality[i] = v->causality;
+		t->variability[i] = v->variability;
+		t->alias[i] = v->alias;
+		t->negated[i] = v->alias == enu_negatedAlias
+				&& (v->baseType == elm_Real || v->baseType == elm_Integer);
+	}
+	buildCanonical(md, t);
+	if (!flattenTypes(md, t))
+		return 0;
+	md->table = t;
+	return 1;
+}
+
+// Store the positions of the variables selected by q in positions, which has
+// room for all variables. The columns are tested without branches, a block at
+// a time, so that the compiler can vectorize the tests.
+// Returns the number of variables selected
+int selectVariables(ModelDescription* md, const VarQuery* q, int* positions) {
+	const VarTable* t = md->table;
+	unsigned types = q->types ? q->types : ~0u;
+	unsigned causalities = q->causalities ? q->causalities : ~0u;
+	unsigned variabilities = q->variabilities ? q->variabilities : ~0u;
+	unsigned aliases = q->aliases ? q->aliases : ~0u;
+	unsigned char hit[256];
+	int n = 0, i, j, size;
+	for (i = 0; i < t->n; i += size) {
+		size = t->n - i < 256 ? t->n - i : 256;
+		for (j = 0; j < size; j++)
+			hit[j] = (types >> t->type[i + j] & causalities >> t->causality[i + j]
+					& variabilities >> t->variability[i + j]
+					& aliases >> t->alias[i + j]) & 1;
+		for (j = 0; j < size; j++) {
+			positions[n] = i + j;
+			n += hit[j];
+		}
+	}
+	return n;
+}
+
+// Returns the position of the variable in modelVariables, -1 if not found
+int getVariablePosition(ModelDescription* md, const char* name) {
+	VarIndex* x = md->index;
+	unsigned k;
+	for (k = nameHash(0, name) & x->mask; x->byName[k]; k = (k + 1) & x->mask)
+		if (isVariableName(md, x->byName[k] - 1, name))
+			return x->byName[k] - 1;
+	return -1;
+}
+
+ScalarVariable* getVariableByName(ModelDescription* md, const char* name) {
+	int i = getVariablePosition(md, name);
+	return i == -1 ? NULL : md->modelVariables[i];
+}
+
 // returns NULL if variable not found or vr==fmiUndefinedValueReference
+// Of aliases, the variable that comes first in the model description is found.
 ScalarVariable* getVariable(ModelDescription* md, fmiValueReference vr,
 		Elm type) {
-	int i;
-	if (md->modelVariables && vr != fmiUndefinedValueReference)
-		for (i = 0; md->modelVariables[i]; i++) {
-			ScalarVariable* sv = (ScalarVariable*) md->modelVariables[i];
-			if (sameBaseType(type, sv->typeSpec->type)
-					&& getValueReference(sv) == vr)
-				return sv;
-		}
-	return NULL;
+	int i = getReferencePosition(md, vr, type);
+	return i == -1 ? NULL : md->modelVariables[i];
+}
+
+// Returns the position of the first variable of vr and type, -1 if none
+int getReferencePosition(ModelDescription* md, fmiValueReference vr,
+		Elm type) {
+	VarIndex* x = md->index;
+	VarInfo* v;
+	unsigned k;
+	if (vr == fmiUndefinedValueReference)
+		return -1;
+	for (k = refHash(type, vr) & x->mask; x->byRef[k]; k = (k + 1) & x->mask) {
+		v = &md->modelVariables[x->byRef[k] - 1]->info;
+		if (v->vr == vr && sameBaseType(type, v->baseType))
+			return x->byRef[k] - 1;
+	}
+	return -1;
 }
 
 Type* getDeclaredType(ModelDescription* md, const char* declaredType) {
-	int i;
-	if (declaredType && md->typeDefinitions)
-		for (i = 0; md->typeDefinitions[i]; i++) {
-			Type* tp = (Type*) md->typeDefinitions[i];
-			if (!strcmp(declaredType, getName(tp)))
-				return tp;
-		}
-	return NULL;
+	int i = findType(md, declaredType);
+	return i == -1 ? NULL : md->typeDefinitions[i];
 }
 
 const char* getString2(ModelDescription* md, void* tp, Att a) {
@@ -286,16 +606,20 @@ const char * getDescription(ModelDescription* md, ScalarVariable* sv) {
 const char * getVariableAttributeString(ModelDescription* md,
 		fmiValueReference vr, Elm type, Att a) {
 	const char* value;
-	Type* tp;
-	ScalarVariable* sv = getVariable(md, vr, type);
-	if (!sv)
+	VarTable* t = md->table;
+	int i = getReferencePosition(md, vr, type), k;
+	if (i == -1)
 		return NULL;
-	value = getString(sv->typeSpec, a);
+	if (a == att_unit || a == att_displayUnit) {
+		k = a == att_unit ? t->unit[i] : t->displayUnit[i];
+		return k == -1 ? NULL : t->units[k];
+	}
+	value = getString(md->modelVariables[i]->typeSpec, a);
 	if (value)
 		return value; // found
-	// search declared type, if any
-	tp = getDeclaredType(md, getString(sv->typeSpec, att_declaredType));
-	return tp ? getString(tp->typeSpec, a) : NULL;
+	// the declared type, if any
+	k = t->declaredType[i];
+	return k == -1 ? NULL : getString(md->typeDefinitions[k]->typeSpec, a);
 }
 
 // Get attribute value from scalar variable given by vr and type, 
@@ -303,98 +627,121 @@ const char * getVariableAttributeString(ModelDescription* md,
 double getVariableAttributeDouble(ModelDescription* md, fmiValueReference vr,
 		Elm type, Att a, ValueStatus* vs) {
 	double d = 0;
-	const char* value = getVariableAttributeString(md, vr, type, a);
+	char* end;
+	const char* value;
+	VarTable* t = md->table;
+	int flag = a == att_nominal ? VAR_NOMINAL : a == att_min ? VAR_MIN :
+			a == att_max ? VAR_MAX : 0;
+	int i = flag ? getReferencePosition(md, vr, type) : -1;
+	if (i != -1 && t->defined[i] & flag) {
+		// decoded by validate()
+		*vs = valueDefined;
+		return flag == VAR_NOMINAL ? t->nominal[i] :
+				flag == VAR_MIN ? t->min[i] : t->max[i];
+	}
+	value = getVariableAttributeString(md, vr, type, a);
 	if (!value) {
 		*vs = valueMissing;
 		return d;
 	}
-	*vs = (1 == sscanf(value, "%lf", &d)) ? valueDefined : valueIllegal;
+	d = strtod(value, &end);
+	*vs = end != value ? valueDefined : valueIllegal;
 	return d;
 }
 
 // Get nominal value from real variable or its declared type.
 // Return 1, if no nominal value is defined.
 double getNominal(ModelDescription* md, fmiValueReference vr) {
-	ValueStatus vs;
-	double nominal = getVariableAttributeDouble(md, vr, elm_Real, att_nominal,
-			&vs);
-	return vs == valueDefined ? nominal : 1.0;
+	int i = getReferencePosition(md, vr, elm_Real);
+	return i == -1 ? 1.0 : md->table->nominal[i];
 }
 
 // ------------------------------------------------------------------------- 
 // Various checks that log an error and stop the parser 
 
+static void stopParser(ParserContext* ctx) {
+	ctx->stopped = 1;
+	if (ctx->parser) // NULL when parsing in place
+		XML_StopParser(ctx->parser, XML_FALSE);
+}
+
 // Returns 0 to indicate error
-static int checkPointer(const void* ptr) {
+static int checkPointer(ParserContext* ctx, const void* ptr) {
 	if (!ptr) {
 		printf("Out of memory\n");
-		if (parser)
-			XML_StopParser(parser, XML_FALSE);
+		stopParser(ctx);
 		return 0; // error
 	}
 	return 1; // success
 }
 
-static int checkName(const char* name, const char* kind, const char* array[],
-		int n) {
-	int i;
-	for (i = 0; i < n; i++) {
-		if (!strcmp(name, array[i]))
-			return i;
-	}
-	printf("Illegal %s %s\n", kind, name);
-	XML_StopParser(parser, XML_FALSE);
+// i is the index of name found by lookupName()
+static int checkName(ParserContext* ctx, const char* name, const char* kind,
+		int i) {
+	if (i != -1)
+		return i;
+	if (!ctx || !ctx->quiet)
+		printf("Illegal %s %s\n", kind, name);
+	if (ctx) // NULL when called after parsing
+		stopParser(ctx);
 	return -1;
 }
 
 // Returns -1 to indicate error
-static int checkElement(const char* elm) {
-	return checkName(elm, "element", elmNames, SIZEOF_ELM);
+static int checkElement(ParserContext* ctx, const char* elm) {
+	return checkName(ctx, elm, "element", lookupName(elmHash, elmNames, elm));
 }
 
 // Returns -1 to indicate error
-static int checkAttribute(const char* att) {
-	return checkName(att, "attribute", attNames, SIZEOF_ATT);
+static int checkAttribute(ParserContext* ctx, const char* att) {
+	return checkName(ctx, att, "attribute",
+			lookupName(attHash, attNames, att));
 }
 
 // Returns -1 to indicate error
 static int checkEnumValue(const char* enu) {
-	return checkName(enu, "enum value", enuNames, SIZEOF_ENU);
+	return checkName(NULL, enu, "enum value",
+			lookupName(enuHash, enuNames, enu));
 }
 
-static void logFatalTypeError(const char* expected, Elm found) {
-	printf("Wrong element type, expected %s, found %s\n", expected,
-			elmNames[found]);
-	XML_StopParser(parser, XML_FALSE);
+static void logFatalTypeError(ParserContext* ctx, const char* expected,
+		Elm found) {
+	if (!ctx->quiet)
+		printf("Wrong element type, expected %s, found %s\n", expected,
+				elmNames[found]);
+	stopParser(ctx);
 }
 
 // Returns 0 to indicate error
 // Verify that Element elm is of the given type
-static int checkElementType(void* element, Elm e) {
+static int checkElementType(ParserContext* ctx, void* element, Elm e) {
 	Element* elm = (Element*) element;
 	if (elm->type == e)
 		return 1; // success
-	logFatalTypeError(elmNames[e], elm->type);
+	logFatalTypeError(ctx, elmNames[e], elm->type);
 	return 0; // error
 }
 
 // Returns 0 to indicate error
 // Verify that the next stack element exists and is of the given type
 // If e==ANY_TYPE, the type check is ommited 
-static int checkPeek(Elm e) {
-	if (stackIsEmpty(stack)) {
-		printf("Illegal document structure, expected %s\n", elmNames[e]);
-		XML_StopParser(parser, XML_FALSE);
+static int checkPeek(ParserContext* ctx, Elm e) {
+	if (stackIsEmpty(ctx->stack)) {
+		if (!ctx->quiet)
+			printf("Illegal document structure, expected %s\n",
+					elmNames[e]);
+		stopParser(ctx);
 		return 0; // error
 	}
-	return e == elm_ANY_TYPE ? 1 : checkElementType(stackPeek(stack), e);
+	return e == elm_ANY_TYPE ?
+			1 : checkElementType(ctx, stackPeek(ctx->stack), e);
 }
 
 // Returns NULL to indicate error
 // Get the next stack element, it is of the given type.
 // If e==ANY_TYPE, the type check is ommited 
-static void* checkPop(Elm e) {
-	return checkPeek(e) ? stackPop(stack) : NULL;
+static void* checkPop(ParserContext* ctx, Elm e) {
+	return checkPeek(ctx, e) ? stackPop(ctx->stack) : NULL;
 }
 
 // ------------------------------------------------------------------------- 
@@ -426,44 +773,73 @@ AstNodeType getAstNodeType(Elm e) {
 	}
 }
 
+// size of the struct representing element e in the AST
+int getAstNodeSize(Elm e) {
+	switch (getAstNodeType(e)) {
+	case astListElement:
+		return sizeof(ListElement);
+	case astType:
+		return sizeof(Type);
+	case astScalarVariable:
+		return sizeof(ScalarVariable);
+	case astCoSimulation:
+		return sizeof(CoSimulation);
+	case astModelDescription:
+		return sizeof(ModelDescription);
+	default:
+		return sizeof(Element);
+	}
+}
+
 // Returns 0 to indicate error
-// Copies the attr array and all values.
+// Copies the attr array and all values, unless they point into a text
+// parsed in place, which lives as long as the AST. The names of variables
+// are only needed until the NameTrie is built, see ParserContext::names.
 // Replaces all attribute names by constant literal strings.
-// Converts the null-terminated array into an array of known size n.
-int addAttributes(Element* el, const char** attr) {
+// Converts the null-terminated array into an array of known size n,
+// ordered by Att, see getString().
+static int addAttributes(ParserContext* ctx, Element* el, const char** attr) {
 	int n, a;
 	const char** att = NULL;
-	for (n = 0; attr[n]; n += 2)
-		;
+	unsigned long long mask = 0;
+	for (n = 0; attr[n]; n += 2) {
+		a = checkAttribute(ctx, attr[n]);
+		if (a == -1)
+			return 0;  // illegal attribute error
+		mask |= 1ULL << a; // XML attributes are unique, checked by expat
+	}
 	if (n > 0) {
-		att = (const char **) calloc(n, sizeof(char*));
-		if (!checkPointer(att))
+		att = (const char **) arenaAlloc(ctx->arena, n * sizeof(char*));
+		if (!checkPointer(ctx, att))
 			return 0;
 	}
 	for (n = 0; attr[n]; n += 2) {
-		char* value = strdup(attr[n + 1]);
-		if (!checkPointer(value))
+		const char* value;
+		int i;
+		a = lookupName(attHash, attNames, attr[n]);
+		value = ctx->inSitu ? attr[n + 1] : arenaStrdup(
+				a == att_name && el->type == elm_ScalarVariable ?
+						ctx->names : ctx->arena, attr[n + 1]);
+		if (!checkPointer(ctx, value))
 			return 0;
-		a = checkAttribute(attr[n]);
-		if (a == -1)
-			return 0;  // illegal attribute error
-		att[n] = attNames[a]; // no heap memory
-		att[n + 1] = value;       // heap memory
+		i = 2 * countBits(mask & ((1ULL << a) - 1));
+		att[i] = attNames[a]; // no heap memory
+		att[i + 1] = value;       // arena memory or the parsed text
 	}
 	el->attributes = att; // NULL if n=0
 	el->n = n;
+	el->attMask = mask;
 	return 1; // success
 }
 
 // Returns NULL to indicate error
-Element* newElement(Elm type, int size, const char** attr) {
-	Element* e = (Element*) calloc(1, size);
-	if (!checkPointer(e))
+static Element* newElement(ParserContext* ctx, Elm type, int size,
+		const char** attr) {
+	Element* e = (Element*) arenaAlloc(ctx->arena, size);
+	if (!checkPointer(ctx, e))
 		return NULL;
 	e->type = type;
-	e->attributes = NULL;
-	e->n = 0;
-	if (!addAttributes(e, attr))
+	if (!addAttributes(ctx, e, attr))
 		return NULL;
 	return e;
 }
@@ -471,58 +847,79 @@ Element* newElement(Elm type, int size, const char** attr) {
 // ------------------------------------------------------------------------- 
 // callback functions called by the XML parser 
 
+// Returns 1 if the enum value of a in attr is one of the bits of set,
+// def is the value of a missing attribute
+static int matchEnum(const char** attr, Att a, Enu def, int set) {
+	int i, e = def;
+	if (!set)
+		return 1;
+	for (i = 0; attr[i]; i += 2)
+		if (!strcmp(attr[i], attNames[a]))
+			e = lookupName(enuHash, enuNames, attr[i + 1]);
+	return e != -1 && (set & (1 << e));
+}
+
+// Returns 1 if the ScalarVariable with the given XML attributes is selected
+static int selectVariable(const VarFilter* f, const char** attr) {
+	int i;
+	if (!matchEnum(attr, att_causality, enu_internal, f->causalities)
+			|| !matchEnum(attr, att_variability, enu_continuous,
+					f->variabilities))
+		return 0;
+	if (!f->name)
+		return 1;
+	for (i = 0; attr[i]; i += 2)
+		if (!strcmp(attr[i], attNames[att_name]))
+			return matchName(f->name, attr[i + 1]);
+	return 0;
+}
+
 // Create and push a new element node
 static void XMLCALL startElement(void *context, const char *elm,
 		const char **attr) {
+	ParserContext* ctx = (ParserContext*) context;
 	Elm el;
 	void* e;
-	int size;
-	el = (Elm) checkElement(elm);
+	if (ctx->skipDepth) {
+		ctx->skipDepth++; // child of a skipped element
+		return;
+	}
+	el = (Elm) checkElement(ctx, elm);
 	if (el == elm_ANY_TYPE)
 		return; // error
-	skipData = (el != elm_Name); // skip element content for all elements but Name
-	switch (getAstNodeType(el)) {
-	case astElement:
-		size = sizeof(Element);
-		break;
-	case astListElement:
-		size = sizeof(ListElement);
-		break;
-	case astType:
-		size = sizeof(Type);
-		break;
-	case astScalarVariable:
-		size = sizeof(ScalarVariable);
-		break;
-	case astCoSimulation:
-		size = sizeof(CoSimulation);
-		break;
-	case astModelDescription:
-		size = sizeof(ModelDescription);
-		break;
-	default:
-		assert(0);
+	if (ctx->filter
+			&& (el == elm_ScalarVariable ? !selectVariable(ctx->filter, attr) :
+				el == elm_DirectDependency && ctx->filter->noDependencies)) {
+		ctx->skipDepth = 1;
+		ctx->skipData = 1;
+		return;
 	}
-	e = newElement(el, size, attr);
-	checkPointer(e);
-	stackPush(stack, e);
+	ctx->skipData = (el != elm_Name); // skip element content for all elements but Name
+	e = newElement(ctx, el, getAstNodeSize(el), attr);
+	checkPointer(ctx, e);
+	stackPush(ctx->stack, e);
 }
 
 // Pop all elements of the given type from stack and 
 // add it to the ListElement that follows.
 // The ListElement remains on the stack.
-static void popList(Elm e) {
+static void popList(ParserContext* ctx, Elm e) {
 	int n = 0;
 	Element** array;
-	Element* elm = (Element*) stackPop(stack);
+	Element* elm = (Element*) stackPop(ctx->stack);
 	while (elm->type == e) {
-		elm = (Element*) stackPop(stack);
+		elm = (Element*) stackPop(ctx->stack);
 		n++;
 	}
-	stackPush(stack, elm); // push ListElement back to stack
-	array = (Element**) stackLastPopedAsArray0(stack, n); // NULL terminated list
+	stackPush(ctx->stack, elm); // push ListElement back to stack
 	if (getAstNodeType(elm->type) != astListElement)
 		return; // failure
+	// NULL terminated list, the popped elements are still above the top
+	array = (Element**) arenaAlloc(ctx->arena, (n + 1) * sizeof(Element*));
+	if (!checkPointer(ctx, array))
+		return; // failure
+	memcpy(array, ctx->stack->stack + ctx->stack->stackPos + 1,
+			n * sizeof(Element*));
 	((ListElement*) elm)->list = array;
 	return; // success only if list!=NULL
 }
@@ -530,8 +927,13 @@ static void popList(Elm e) {
 // Pop the children from the stack and
 // check for correct type and sequence of children
 static void XMLCALL endElement(void *context, const char *elm) {
+	ParserContext* ctx = (ParserContext*) context;
 	Elm el;
-	el = (Elm) checkElement(elm);
+	if (ctx->skipDepth) {
+		ctx->skipDepth--; // end of a skipped element or one of its children
+		return;
+	}
+	el = (Elm) checkElement(ctx, elm);
 	switch (el) {
 	case elm_fmiModelDescription: {
 		ModelDescription* md;
@@ -543,45 +945,41 @@ static void XMLCALL endElement(void *context, const char *elm) {
 		CoSimulation *cs = NULL;     // NULL or CoSimulation
 		ListElement* child;
 
-		child = (ListElement*) checkPop(elm_ANY_TYPE);
+		child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 		if (child->type == elm_CoSimulation_StandAlone
 				|| child->type == elm_CoSimulation_Tool) {
 			cs = (CoSimulation*) child;
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
 		if (child->type == elm_ModelVariables) {
 			mv = (ScalarVariable**) child->list;
-			free(child);
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
 		if (child->type == elm_VendorAnnotations) {
 			va = (ListElement**) child->list;
-			free(child);
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
 		if (child->type == elm_DefaultExperiment) {
 			de = (Element*) child;
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
 		if (child->type == elm_TypeDefinitions) {
 			td = (Type**) child->list;
-			free(child);
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
 		if (child->type == elm_UnitDefinitions) {
 			ud = (ListElement**) child->list;
-			free(child);
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
@@ -590,11 +988,11 @@ static void XMLCALL endElement(void *context, const char *elm) {
 				&& (child->type == elm_CoSimulation_StandAlone
 						|| child->type == elm_CoSimulation_Tool)) {
 			cs = (CoSimulation*) child;
-			child = (ListElement*) checkPop(elm_ANY_TYPE);
+			child = (ListElement*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
-		if (!checkElementType(child, elm_fmiModelDescription))
+		if (!checkElementType(ctx, child, elm_fmiModelDescription))
 			return;
 		md = (ModelDescription*) child;
 		md->modelVariables = mv;
@@ -603,47 +1001,46 @@ static void XMLCALL endElement(void *context, const char *elm) {
 		md->typeDefinitions = td;
 		md->unitDefinitions = ud;
 		md->cosimulation = cs;
-		stackPush(stack, md);
+		stackPush(ctx->stack, md);
 		break;
 	}
 	case elm_Implementation: {
 		// replace Implementation element
-		void* cs = checkPop(elm_ANY_TYPE);
-		void* im = checkPop(elm_Implementation);
-		stackPush(stack, cs);
-		free(im);
+		void* cs = checkPop(ctx, elm_ANY_TYPE);
+		checkPop(ctx, elm_Implementation); // dropped, owned by the arena
+		stackPush(ctx->stack, cs);
 		el = ((Element*) cs)->type;
 		break;
 	}
 	case elm_CoSimulation_StandAlone: {
-		Element* ca = (Element*) checkPop(elm_Capabilities);
-		CoSimulation* cs = (CoSimulation*) checkPop(
+		Element* ca = (Element*) checkPop(ctx, elm_Capabilities);
+		CoSimulation* cs = (CoSimulation*) checkPop(ctx,
 				elm_CoSimulation_StandAlone);
 		if (!ca || !cs)
 			return;
 		cs->capabilities = ca;
-		stackPush(stack, cs);
+		stackPush(ctx->stack, cs);
 		break;
 	}
 	case elm_CoSimulation_Tool: {
-		ListElement* mo = (ListElement*) checkPop(elm_Model);
-		Element* ca = (Element*) checkPop(elm_Capabilities);
-		CoSimulation* cs = (CoSimulation*) checkPop(elm_CoSimulation_Tool);
+		ListElement* mo = (ListElement*) checkPop(ctx, elm_Model);
+		Element* ca = (Element*) checkPop(ctx, elm_Capabilities);
+		CoSimulation* cs = (CoSimulation*) checkPop(ctx, elm_CoSimulation_Tool);
 		if (!ca || !mo || !cs)
 			return;
 		cs->capabilities = ca;
 		cs->model = mo;
-		stackPush(stack, cs);
+		stackPush(ctx->stack, cs);
 		break;
 	}
 	case elm_Type: {
 		Type* tp;
-		Element* ts = (Element*) checkPop(elm_ANY_TYPE);
+		Element* ts = (Element*) checkPop(ctx, elm_ANY_TYPE);
 		if (!ts)
 			return;
-		if (!checkPeek(elm_Type))
+		if (!checkPeek(ctx, elm_Type))
 			return;
-		tp = (Type*) stackPeek(stack);
+		tp = (Type*) stackPeek(ctx->stack);
 		switch (ts->type) {
 		case elm_RealType:
 		case elm_IntegerType:
@@ -652,7 +1049,7 @@ static void XMLCALL endElement(void *context, const char *elm) {
 		case elm_EnumerationType:
 			break;
 		default:
-			logFatalTypeError("RealType or similar", ts->type);
+			logFatalTypeError(ctx, "RealType or similar", ts->type);
 			return;
 		}
 		tp->typeSpec = ts;
@@ -661,19 +1058,18 @@ static void XMLCALL endElement(void *context, const char *elm) {
 	case elm_ScalarVariable: {
 		ScalarVariable* sv;
 		Element** list = NULL;
-		Element* child = (Element*) checkPop(elm_ANY_TYPE);
+		Element* child = (Element*) checkPop(ctx, elm_ANY_TYPE);
 		if (!child)
 			return;
 		if (child->type == elm_DirectDependency) {
 			list = ((ListElement*) child)->list;
-			free(child);
-			child = (Element*) checkPop(elm_ANY_TYPE);
+			child = (Element*) checkPop(ctx, elm_ANY_TYPE);
 			if (!child)
 				return;
 		}
-		if (!checkPeek(elm_ScalarVariable))
+		if (!checkPeek(ctx, elm_ScalarVariable))
 			return;
-		sv = (ScalarVariable*) stackPeek(stack);
+		sv = (ScalarVariable*) stackPeek(ctx->stack);
 		switch (child->type) {
 		case elm_Real:
 		case elm_Integer:
@@ -682,7 +1078,7 @@ static void XMLCALL endElement(void *context, const char *elm) {
 		case elm_Enumeration:
 			break;
 		default:
-			logFatalTypeError("Real or similar", child->type);
+			logFatalTypeError(ctx, "Real or similar", child->type);
 			return;
 		}
 		sv->directDependencies = list;
@@ -690,45 +1086,51 @@ static void XMLCALL endElement(void *context, const char *elm) {
 		break;
 	}
 	case elm_ModelVariables:
-		popList(elm_ScalarVariable);
+		popList(ctx, elm_ScalarVariable);
 		break;
 	case elm_VendorAnnotations:
-		popList(elm_Tool);
+		popList(ctx, elm_Tool);
 		break;
 	case elm_Tool:
-		popList(elm_Annotation);
+		popList(ctx, elm_Annotation);
 		break;
 	case elm_TypeDefinitions:
-		popList(elm_Type);
+		popList(ctx, elm_Type);
 		break;
 	case elm_EnumerationType:
-		popList(elm_Item);
+		popList(ctx, elm_Item);
 		break;
 	case elm_UnitDefinitions:
-		popList(elm_BaseUnit);
+		popList(ctx, elm_BaseUnit);
 		break;
 	case elm_BaseUnit:
-		popList(elm_DisplayUnitDefinition);
+		popList(ctx, elm_DisplayUnitDefinition);
 		break;
 	case elm_DirectDependency:
-		popList(elm_Name);
+		popList(ctx, elm_Name);
 		break;
 	case elm_Model:
-		popList(elm_File);
+		popList(ctx, elm_File);
 		break;
 	case elm_Name: {
 		// Exception: the name value is represented as element content.
 		// All other values of the XML file are represented using attributes.
-		Element* name = (Element*) checkPop(elm_Name);
+		Element* name = (Element*) checkPop(ctx, elm_Name);
 		if (!name)
 			return;
 		name->n = 2;
-		name->attributes = (const char **) malloc(2 * sizeof(char*));
+		name->attMask = 1ULL << att_input;
+		name->attributes = (const char **) arenaAlloc(ctx->arena,
+				2 * sizeof(char*));
+		if (!checkPointer(ctx, name->attributes))
+			return;
 		name->attributes[0] = attNames[att_input];
-		name->attributes[1] = data;
-		data = NULL;
-		skipData = 1; // stop recording element content
-		stackPush(stack, name);
+		name->attributes[1] =
+				ctx->data ? arenaStrdup(ctx->arena, ctx->data) : NULL;
+		free(ctx->data);
+		ctx->data = NULL;
+		ctx->skipData = 1; // stop recording element content
+		stackPush(ctx->stack, name);
 		break;
 	}
 	case elm_ANY_TYPE:
@@ -739,7 +1141,7 @@ static void XMLCALL endElement(void *context, const char *elm) {
 	}
 	// All children of el removed from the stack.
 	// The top element must be of type el now.
-	checkPeek(el);
+	checkPeek(ctx, el);
 }
 
 // Called to handle element data, e.g. "xy" in <Name>xy</Name>
@@ -748,25 +1150,26 @@ static void XMLCALL endElement(void *context, const char *elm) {
 // For some reason, if the element data is the empty string (Eg. <a></a>)
 // instead of an empty string with len == 0 we get "\n". The workaround is
 // to replace this with the empty string whenever we encounter "\n".
-void XMLCALL handleData(void *context, const XML_Char *s, int len) {
+static void XMLCALL handleData(void *context, const XML_Char *s, int len) {
+	ParserContext* ctx = (ParserContext*) context;
 	int n;
-	if (skipData)
+	if (ctx->skipData)
 		return;
-	if (!data) {
+	if (!ctx->data) {
 		// start a new data string
 		if (len == 1 && s[0] == '\n') {
-			data = strdup("");
+			ctx->data = strdup("");
 		} else {
-			data = (char *) malloc(len + 1);
-			strncpy(data, s, len);
-			data[len] = '\0';
+			ctx->data = (char *) malloc(len + 1);
+			strncpy(ctx->data, s, len);
+			ctx->data[len] = '\0';
 		}
 	} else {
 		// continue existing string
-		n = strlen(data) + len;
-		data = (char *) realloc(data, n + 1);
-		strncat(data, s, len);
-		data[n] = '\0';
+		n = strlen(ctx->data) + len;
+		ctx->data = (char *) realloc(ctx->data, n + 1);
+		strncat(ctx->data, s, len);
+		ctx->data[n] = '\0';
 	}
 	return;
 }
@@ -833,71 +1236,98 @@ static void printList(int indent, void** list) {
 // ------------------------------------------------------------------------- 
 // free memory of the AST
 
-static void freeList(void** list);
-
+// All nodes and strings of the AST are owned by the arena of its
+// ModelDescription, which is released at once, or by the mapped image it was
+// loaded from. Other nodes are not freed.
 void freeElement(void* element) {
-	int i;
-	Element* e = (Element*) element;
-	if (!e)
+	ModelDescription* md = (ModelDescription*) element;
+	if (!md || md->type != elm_fmiModelDescription)
 		return;
-	// free attributes
-	for (i = 0; i < e->n; i += 2)
-		free((void*) e->attributes[i + 1]);
-	if (e->attributes)
-		free(e->attributes);
-	// free child nodes
-	switch (getAstNodeType(e->type)) {
-	case astElement:
-		// Add an empty case here to avoid warnings from -Wall
-		// The element e gets freed elsewhere, if we free it
-		// here,  we get warnings
-		//freeElement((void**)(Element*)e);
-		break;
-	case astListElement:
-		freeList((void**) ((ListElement*) e)->list);
-		break;
-	case astScalarVariable:
-		freeList((void**) ((ScalarVariable*) e)->directDependencies);
+	if (mdIsImage(md))
+		mdImageFree(md);
+	else
+		arenaFree(md->arena);
+}
+
+// ------------------------------------------------------------------------- 
+// Validation - done after parsing to report all errors 
+
+// Returns the flag of a if a is defined for sv or its declared type tp
+static int decodeDouble(ScalarVariable* sv, Type* tp, Att a, int flag,
+		double* d) {
+	ValueStatus vs;
+	*d = getDouble(sv->typeSpec, a, &vs);
+	if (vs == valueMissing && tp)
+		*d = getDouble(tp->typeSpec, a, &vs);
+	return vs == valueDefined ? flag : 0;
+}
+
+// Decode the attributes of sv into sv->info, tp is its declared type or NULL
+// Returns 0 to indicate error
+static int decodeVariable(ScalarVariable* sv, Type* tp) {
+	VarInfo* v = &sv->info;
+	ValueStatus vs;
+	v->vr = getUInt(sv, att_valueReference, &vs);
+	if (vs != valueDefined) {
+		printf("Error: Variable %s has %s valueReference\n", getName(sv),
+				vs == valueMissing ? "no" : "an illegal");
+		return 0;
+	}
+	v->baseType = sv->typeSpec->type;
+	v->causality = getEnumValue(sv, att_causality, &vs);
+	v->variability = getEnumValue(sv, att_variability, &vs);
+	v->alias = getEnumValue(sv, att_alias, &vs);
+	switch (v->baseType) {
+	case elm_Real:
+		v->defined |= decodeDouble(sv, NULL, att_start, VAR_START, &v->start);
 		break;
-	case astType:
-		freeElement(((Type*) e)->typeSpec);
+	case elm_Integer:
+	case elm_Enumeration:
+		v->start = getInt(sv->typeSpec, att_start, &vs);
+		v->defined |= vs == valueDefined ? VAR_START : 0;
 		break;
-	case astCoSimulation: {
-		CoSimulation* cs = (CoSimulation*) e;
-		freeElement(cs->capabilities);
-		freeElement(cs->model);
+	case elm_Boolean:
+		v->start = getBoolean(sv->typeSpec, att_start, &vs);
+		v->defined |= vs == valueDefined ? VAR_START : 0;
 		break;
-	}
-	case astModelDescription: {
-		ModelDescription* md = (ModelDescription*) e;
-		freeList((void**) md->unitDefinitions);
-		freeList((void**) md->typeDefinitions);
-		freeElement(md->defaultExperiment);
-		freeList((void**) md->vendorAnnotations);
-		freeList((void**) md->modelVariables);
-		freeElement(md->cosimulation);
+	default: // String, start is accessed with getString()
 		break;
 	}
-	}
-	// free the struct
-	free(e);
+	v->defined |= decodeDouble(sv, tp, att_nominal, VAR_NOMINAL, &v->nominal);
+	if (!(v->defined & VAR_NOMINAL))
+		v->nominal = 1.0;
+	v->defined |= decodeDouble(sv, tp, att_min, VAR_MIN, &v->min);
+	v->defined |= decodeDouble(sv, tp, att_max, VAR_MAX, &v->max);
+	return 1; // success
 }
 
-static void freeList(void** list) {
-	int i;
-	if (!list)
-		return;
-	for (i = 0; list[i]; i++)
-		freeElement(list[i]);
-	free(list);
+// Remove the name attribute of every variable, the names are kept by
+// md->names, see getVariableName(). The other attributes keep their order.
+static void dropNames(ModelDescription* md) {
+	unsigned long long bit = 1ULL << att_name;
+	int i, k;
+	for (i = 0; md->modelVariables && md->modelVariables[i]; i++) {
+		Element* e = (Element*) md->modelVariables[i];
+		if (!(e->attMask & bit))
+			continue;
+		for (k = 2 * countBits(e->attMask & (bit - 1)); k + 2 < e->n; k++)
+			e->attributes[k] = e->attributes[k + 2];
+		e->attMask &= ~bit;
+		e->n -= 2;
+	}
 }
 
-// ------------------------------------------------------------------------- 
-// Validation - done after parsing to report all errors 
-
+// Decode the attributes of the variables and build the indexes of md.
+// Afterwards, the names of the variables are found with getVariableName()
+// instead of getName().
+// Returns NULL to indicate an error
 ModelDescription* validate(ModelDescription* md) {
 	int error = 0;
 	int i;
+	if (!buildTypeIndex(md)) {
+		printf("Out of memory\n");
+		return NULL;
+	}
 	if (md->modelVariables)
 		for (i = 0; md->modelVariables[i]; i++) {
 			ScalarVariable* sv = (ScalarVariable*) md->modelVariables[i];
@@ -910,66 +1340,1143 @@ ModelDescription* validate(ModelDescription* md) {
 						declaredType, getName(sv));
 				error++;
 			}
+			if (!decodeVariable(sv, decltype1))
+				error++;
 		}
 	if (error) {
 		printf("Error: Found %d error in modelDescription.xml\n", error);
 		return NULL;
 	}
+	if (!buildIndex(md) || !buildTable(md) || !buildNameTrie(md)
+			|| !buildDepGraph(md)) {
+		printf("Out of memory\n");
+		return NULL;
+	}
+	dropNames(md);
 	return md;
 }
 
 // ------------------------------------------------------------------------- 
 // Entry function parse() of the XML parser 
 
-static void cleanup(FILE *file) {
-	stackFree(stack);
-	stack = NULL;
-	XML_ParserFree(parser);
-	parser = NULL;
-	fclose(file);
+static void cleanup(ParserContext* ctx) {
+	stackFree(ctx->stack);
+	ctx->stack = NULL;
+	XML_ParserFree(ctx->parser);
+	ctx->parser = NULL;
+	free(ctx->data);
+	ctx->data = NULL;
+	arenaFree(ctx->arena); // NULL if handed over to the ModelDescription
+	ctx->arena = NULL;
+	arenaFree(ctx->names);
+	ctx->names = NULL;
+}
+
+// size is a hint for the size of the XML file, 0 if unknown
+// inSitu is 1 if the caller tokenizes the text, see parseInPlace()
+// Returns 0 to indicate failure
+static int startParser(ParserContext* ctx, size_t size,
+		const VarFilter* filter, int inSitu) {
+	memset(ctx, 0, sizeof(ParserContext));
+	ctx->filter = filter;
+	ctx->inSitu = inSitu;
+	ctx->stack = stackNew(100, 10);
+	if (!checkPointer(ctx, ctx->stack))
+		return 0;  // failure
+	// the AST takes about as much memory as the XML text, half as much when
+	// the values stay in the text, a filtered one grows with the selection
+	ctx->arena = arenaNew(filter ? 0 : inSitu ? size / 2 : size);
+	ctx->names = arenaNew(0);
+	if (!checkPointer(ctx, ctx->arena) || !checkPointer(ctx, ctx->names)) {
+		cleanup(ctx);
+		return 0;  // failure
+	}
+	if (inSitu)
+		return 1; // success
+	ctx->parser = XML_ParserCreate(NULL);
+	if (!checkPointer(ctx, ctx->parser)) {
+		cleanup(ctx);
+		return 0;  // failure
+	}
+	XML_SetUserData(ctx->parser, ctx);
+	XML_SetElementHandler(ctx->parser, startElement, endElement);
+	XML_SetCharacterDataHandler(ctx->parser, handleData);
+	return 1; // success
+}
+
+// Returns 0 to indicate failure, the parser is then released
+static int parseChunk(ParserContext* ctx, const char* xmlPath,
+		const char* chunk, int n, int done) {
+	if (XML_Parse(ctx->parser, chunk, n, done))
+		return 1; // success
+	if (!ctx->quiet)
+		printf("Parse error in file %s at line %d:\n%s\n", xmlPath,
+				(int) XML_GetCurrentLineNumber(ctx->parser),
+				XML_ErrorString(XML_GetErrorCode(ctx->parser)));
+	cleanup(ctx); // releases the partial AST
+	return 0; // failure
+}
+
+// Returns the root of the AST and releases the parser.
+// The arena that owns the AST is handed over in *arena, the one that owns
+// the names of the variables in *names, see ParserContext.
+static void* finishAst(ParserContext* ctx, Arena** arena, Arena** names) {
+	void* root = stackPop(ctx->stack);
+	assert(stackIsEmpty(ctx->stack));
+	*arena = ctx->arena;
+	*names = ctx->names;
+	ctx->arena = NULL;
+	ctx->names = NULL;
+	cleanup(ctx);
+	return root;
 }
 
+// filter is the VarFilter md was parsed with, NULL if none. names is
+// released once the NameTrie holds the names, see validate().
+// Returns NULL if md is not valid, md is then released
+static ModelDescription* checkModel(ModelDescription* md, Arena* arena,
+		Arena* names, const VarFilter* filter) {
+	md->arena = arena;
+	md->filtered = filter != NULL;
+	//printElement(1, md); // debug
+	if (!validate(md)) {
+		freeElement(md);
+		md = NULL;
+	}
+	arenaFree(names);
+	return md; // success if all refs are valid
+}
+
+static ModelDescription* finishParser(ParserContext* ctx) {
+	const VarFilter* filter = ctx->filter;
+	Arena* arena;
+	Arena* names;
+	ModelDescription* md = (ModelDescription*) finishAst(ctx, &arena, &names);
+	return checkModel(md, arena, names, filter);
+}
+
+// Returns 1 if name matches pattern, where '*' matches any sequence of
+// characters and '?' any single character
+int matchName(const char* pattern, const char* name) {
+	const char* star = NULL; // the last '*' seen and where it resumes
+	const char* resume = name;
+	while (*name) {
+		if (*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		} else if (*pattern == '?' || *pattern == *name) {
+			pattern++;
+			name++;
+		} else if (star) {
+			pattern = star + 1; // let the last '*' match one more char
+			name = ++resume;
+		} else
+			return 0;
+	}
+	while (*pattern == '*')
+		pattern++;
+	return !*pattern;
+}
+
+// ------------------------------------------------------------------------- 
+// Parsing in place: the text of the model description is tokenized in its
+// own buffer, where names and attribute values are terminated and decoded,
+// so that the AST points into the text instead of holding copies. Decoding
+// only shrinks a value, so no copy is ever needed. The text is adopted by
+// the arena of the AST. The AST is built by the same callbacks as with
+// expat, which still parses texts in other encodings or with a DTD, and
+// texts with bytes that are not UTF-8 of chars allowed in XML, so that
+// expat reports these errors. The tokenizer checks the rest of what expat
+// checks, with the same messages: names, references, comments, CDATA
+// sections, "]]>" in text, processing instructions and the XML declaration.
+// Chars of names beyond ASCII are taken as name chars without checking their
+// class, the FMI vocabulary has no such names. bench/check_insitu compares
+// both parsers.
+
+// State of the tokenizer
+typedef struct {
+	char* text;         // start of the buffer, for line numbers
+	char* p;            // next char to read
+	char* end;
+	char* token;        // start of the current markup or text
+	const char* error;  // NULL or why the text is not well-formed
+	char* errorAt;
+	char** open;        // names of the open elements
+	int depth;
+	int maxDepth;
+	const char** attr;  // attributes of the current tag, see startElement()
+	int maxAttr;
+	int closed;         // 1 once the root element is closed
+} InSitu;
+
+static int isXmlSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Returns 1 if c ends a name in a tag
+static int isNameEnd(char c) {
+	return isXmlSpace(c) || c == '>' || c == '/' || c == '=' || c == '<'
+			|| c == '"' || c == '\'';
+}
+
+// Returns 1 if c may start a name, bytes beyond ASCII are not checked
+static int isNameStart(unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'
+			|| c == ':' || c >= 0x80;
+}
+
+// Returns 1 if [s, e) is a name, see section 2.3 of the XML specification
+static int isXmlName(const char* s, const char* e) {
+	if (s == e || !isNameStart(*s))
+		return 0;
+	for (s++; s < e; s++)
+		if (!isNameStart(*s) && !(*s >= '0' && *s <= '9') && *s != '.'
+				&& *s != '-')
+			return 0;
+	return 1;
+}
+
+// Returns 0 to indicate failure
+static int failAt(InSitu* t, char* p, const char* error) {
+	t->error = error;
+	t->errorAt = p;
+	return 0;
+}
+
+// Returns 1 if text is UTF-8 of chars allowed in XML, see section 2.2 of
+// the XML specification: no control chars but tab and line ends, no
+// surrogates, U+FFFE or U+FFFF. Printable ASCII is checked 8 chars at a time.
+static int isXmlText(const char* text, size_t size) {
+	const uint64_t ones = 0x0101010101010101ULL;
+	const unsigned char* s = (const unsigned char*) text;
+	const unsigned char* end = s + size;
+	unsigned c, lo, hi;
+	uint64_t w;
+	int n, k;
+	while (s < end) {
+		if (end - s >= 8) {
+			memcpy(&w, s, 8);
+			if (!(((w - 0x20 * ones) | w) & (0x80 * ones))) {
+				s += 8; // no byte below 0x20 or above 0x7F
+				continue;
+			}
+		}
+		c = *s;
+		if (c < 0x80) {
+			if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+				return 0;
+			s++;
+			continue;
+		}
+		if (c < 0xC2 || c > 0xF4)
+			return 0; // continuation byte, overlong or beyond U+10FFFF
+		n = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+		if (end - s < n)
+			return 0;
+		// the second byte rules out overlong encodings, surrogates and
+		// chars beyond U+10FFFF
+		lo = c == 0xE0 ? 0xA0 : c == 0xF0 ? 0x90 : 0x80;
+		hi = c == 0xED ? 0x9F : c == 0xF4 ? 0x8F : 0xBF;
+		if (s[1] < lo || s[1] > hi)
+			return 0;
+		for (k = 2; k < n; k++)
+			if ((s[k] & 0xC0) != 0x80)
+				return 0;
+		if (c == 0xEF && s[1] == 0xBF && s[2] >= 0xBE)
+			return 0; // U+FFFE or U+FFFF
+		s += n;
+	}
+	return 1;
+}
+
+// Returns 1 if the text can be parsed in place: UTF-8 or ASCII of chars
+// allowed in XML, no DTD
+static int canParseInPlace(const char* xml, size_t size) {
+	const char* end = xml + size;
+	const char* s = xml;
+	if (!isXmlText(xml, size))
+		return 0; // reported by expat
+	if (size >= 3 && !memcmp(s, "\xEF\xBB\xBF", 3))
+		s += 3; // UTF-8 byte order mark
+	else if (size < 2 || !s[0] || !s[1] || (unsigned char) s[0] >= 0xFE)
+		return 0; // UTF-16, with or without byte order mark
+	for (;;) {
+		while (s < end && isXmlSpace(*s))
+			s++;
+		if (end - s >= 6 && !memcmp(s, "<?xml", 5) && isXmlSpace(s[5])) {
+			// the declaration, look for encoding="..."
+			const char* close = (const char*) memmem(s, end - s, "?>", 2);
+			const char* enc = close ?
+					(const char*) memmem(s, close - s, "encoding", 8) : NULL;
+			char name[16];
+			int n = 0;
+			if (!close)
+				return 0;
+			if (enc) {
+				for (enc += 8; enc < close && (isXmlSpace(*enc) || *enc == '=');
+						enc++)
+					;
+				if (enc < close && (*enc == '"' || *enc == '\''))
+					enc++;
+				for (; enc + n < close && n < 15 && enc[n] != '"'
+						&& enc[n] != '\''; n++)
+					name[n] = toupper((unsigned char) enc[n]);
+				name[n] = '\0';
+				if (strcmp(name, "UTF-8") && strcmp(name, "US-ASCII"))
+					return 0;
+			}
+			s = close + 2;
+		} else if (end - s >= 2 && !memcmp(s, "<?", 2)) {
+			s = (const char*) memmem(s, end - s, "?>", 2);
+			if (!s)
+				return 1; // reported by the tokenizer
+			s += 2;
+		} else if (end - s >= 4 && !memcmp(s, "<!--", 4)) {
+			s = (const char*) memmem(s, end - s, "-->", 3);
+			if (!s)
+				return 1;
+			s += 3;
+		} else
+			return end - s < 9 || memcmp(s, "<!DOCTYPE", 9);
+	}
+}
+
+// Write the UTF-8 encoding of char c at d
+// Returns the end of the encoding, NULL if c is not allowed, see isXmlText()
+static char* putUtf8(char* d, unsigned long c) {
+	if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r') || c > 0x10FFFF
+			|| (c >= 0xD800 && c <= 0xDFFF) || c == 0xFFFE || c == 0xFFFF)
+		return NULL;
+	if (c < 0x80)
+		*d++ = (char) c;
+	else if (c < 0x800) {
+		*d++ = (char) (0xC0 | c >> 6);
+		*d++ = (char) (0x80 | (c & 0x3F));
+	} else if (c < 0x10000) {
+		*d++ = (char) (0xE0 | c >> 12);
+		*d++ = (char) (0x80 | (c >> 6 & 0x3F));
+		*d++ = (char) (0x80 | (c & 0x3F));
+	} else {
+		*d++ = (char) (0xF0 | c >> 18);
+		*d++ = (char) (0x80 | (c >> 12 & 0x3F));
+		*d++ = (char) (0x80 | (c >> 6 & 0x3F));
+		*d++ = (char) (0x80 | (c & 0x3F));
+	}
+	return d;
+}
+
+// Decode the reference at *s, e.g. "&lt;" or "&#x20;", to d and advance *s.
+// The decoded char is never longer than the reference.
+// Returns the end of the decoded char, NULL to indicate an error, see *error
+static char* decodeReference(char* d, char** s, char* end,
+		const char** error) {
+	static const char* names[] = { "lt", "gt", "amp", "quot", "apos" };
+	static const char chars[] = "<>&\"'";
+	char* name = *s + 1;
+	char* semi = name;
+	unsigned long c = 0;
+	int hex, i;
+	*error = "not well-formed (invalid token)";
+	while (semi < end && *semi != ';' && semi - name < 10)
+		semi++;
+	if (semi == end || *semi != ';' || semi == name)
+		return NULL;
+	*s = semi + 1;
+	if (*name != '#') {
+		for (i = 0; i < 5; i++)
+			if (strlen(names[i]) == (size_t) (semi - name)
+					&& !memcmp(names[i], name, semi - name)) {
+				*d = chars[i];
+				return d + 1;
+			}
+		*error = "undefined entity"; // no DTD, so no other entities
+		return NULL;
+	}
+	hex = name[1] == 'x';
+	name += 1 + hex;
+	if (name == semi)
+		return NULL;
+	for (; name < semi; name++) {
+		int digit = isdigit((unsigned char) *name) ? *name - '0' :
+				hex && isxdigit((unsigned char) *name) ?
+						tolower((unsigned char) *name) - 'a' + 10 : -1;
+		if (digit < 0)
+			return NULL;
+		c = c * (hex ? 16 : 10) + digit;
+	}
+	*error = "reference to invalid character number";
+	return putUtf8(d, c);
+}
+
+// Decode [s, e) in place: references, line ends, and in attribute values
+// also white space, see sections 2.11 and 3.3.3 of the XML specification
+// Returns the new end, NULL to indicate an error
+static char* decodeText(InSitu* t, char* s, char* e, int attribute) {
+	char* d;
+	while (s < e && *s != '&' && *s != '\r'
+			&& !(attribute && (*s == '\n' || *s == '\t' || *s == '<')))
+		s++;
+	for (d = s; s < e;) {
+		char c = *s;
+		if (c == '&') {
+			char* ref = s;
+			const char* error;
+			d = decodeReference(d, &s, e, &error);
+			if (!d) {
+				failAt(t, ref, error);
+				return NULL;
+			}
+		} else if (c == '\r') {
+			*d++ = attribute ? ' ' : '\n';
+			s += s + 1 < e && s[1] == '\n' ? 2 : 1;
+		} else if (attribute && c == '<') {
+			failAt(t, s, "not well-formed (invalid token)");
+			return NULL;
+		} else {
+			*d++ = attribute && (c == '\n' || c == '\t') ? ' ' : c;
+			s++;
+		}
+	}
+	return d;
+}
+
+// Check the references in [s, e) without decoding them, for text that is
+// not recorded, see ParserContext::skipData
+// Returns 0 to indicate failure
+static int checkReferences(InSitu* t, char* s, char* e) {
+	char c[4]; // the longest UTF-8 encoding
+	const char* error;
+	char* ref;
+	while ((s = (char*) memchr(s, '&', e - s))) {
+		ref = s;
+		if (!decodeReference(c, &s, e, &error))
+			return failAt(t, ref, error);
+	}
+	return 1;
+}
+
+// Returns 0 to indicate failure
+static int pushOpen(InSitu* t, char* name) {
+	if (t->depth == t->maxDepth) {
+		int max = t->maxDepth ? 2 * t->maxDepth : 16;
+		char** open = (char**) realloc(t->open, max * sizeof(char*));
+		if (!open)
+			return failAt(t, name, "out of memory");
+		t->open = open;
+		t->maxDepth = max;
+	}
+	t->open[t->depth++] = name;
+	return 1;
+}
+
+// n is the number of names and values in t->attr so far
+// Returns 0 to indicate failure
+static int pushAttribute(InSitu* t, int n, char* name, char* value) {
+	if (n + 3 > t->maxAttr) { // room for the terminating NULL
+		int max = 2 * t->maxAttr;
+		const char** attr = (const char**) realloc(t->attr,
+				max * sizeof(char*));
+		if (!attr)
+			return failAt(t, name, "out of memory");
+		t->attr = attr;
+		t->maxAttr = max;
+	}
+	t->attr[n] = name;
+	t->attr[n + 1] = value;
+	return 1;
+}
+
+// Returns the char after the white space at s, which is then moved there.
+// The char at s itself is c, s may have been overwritten by a terminator.
+static char skipSpace(InSitu* t, char** s, char c) {
+	while (isXmlSpace(c) && ++*s < t->end)
+		c = **s;
+	return *s < t->end ? c : '\0';
+}
+
+// Parse the start tag at t->p and call startElement(), for an empty
+// element also endElement()
+// Returns 0 to indicate failure
+static int parseStartTag(InSitu* t, ParserContext* ctx) {
+	char* name = t->p + 1;
+	char* s = name;
+	char* att;
+	char* value;
+	char* valueEnd;
+	char c;
+	int n = 0, empty = 0, spaced, k;
+	if (t->closed)
+		return failAt(t, t->p, "junk after document element");
+	while (s < t->end && !isNameEnd(*s))
+		s++;
+	if (s == name || s == t->end || !isXmlName(name, s))
+		return failAt(t, name, "not well-formed (invalid token)");
+	c = *s;
+	*s = '\0';
+	for (;;) {
+		spaced = isXmlSpace(c);
+		c = skipSpace(t, &s, c);
+		if (c == '>') {
+			s++;
+			break;
+		}
+		if (c == '/' && s + 1 < t->end && s[1] == '>') {
+			empty = 1;
+			s += 2;
+			break;
+		}
+		if (s == t->end)
+			return failAt(t, s, "unclosed token");
+		if (!spaced || isNameEnd(c))
+			return failAt(t, s, "not well-formed (invalid token)");
+		att = s;
+		while (s < t->end && !isNameEnd(*s))
+			s++;
+		if (s == t->end)
+			return failAt(t, s, "unclosed token");
+		if (!isXmlName(att, s))
+			return failAt(t, att, "not well-formed (invalid token)");
+		c = *s;
+		*s = '\0';
+		if (skipSpace(t, &s, c) != '=')
+			return failAt(t, s, "not well-formed (invalid token)");
+		s++;
+		c = skipSpace(t, &s, s < t->end ? *s : '\0');
+		if (c != '"' && c != '\'')
+			return failAt(t, s, "not well-formed (invalid token)");
+		value = s + 1;
+		s = (char*) memchr(value, c, t->end - value);
+		if (!s)
+			return failAt(t, value, "unclosed token");
+		valueEnd = decodeText(t, value, s, 1);
+		if (!valueEnd)
+			return 0;
+		*valueEnd = '\0'; // at the latest over the closing quote
+		for (k = 0; k < n; k += 2)
+			if (!strcmp(t->attr[k], att))
+				return failAt(t, att, "duplicate attribute");
+		if (!pushAttribute(t, n, att, value))
+			return 0;
+		n += 2;
+		if (++s == t->end)
+			return failAt(t, s, "unclosed token");
+		c = *s;
+	}
+	t->attr[n] = NULL;
+	t->p = s;
+	if (!empty && !pushOpen(t, name))
+		return 0;
+	startElement(ctx, name, t->attr);
+	if (empty && !ctx->stopped)
+		endElement(ctx, name);
+	if (empty && !t->depth)
+		t->closed = 1;
+	return 1;
+}
+
+// Parse the end tag at t->p and call endElement()
+// Returns 0 to indicate failure
+static int parseEndTag(InSitu* t, ParserContext* ctx) {
+	char* name = t->p + 2;
+	char* s = name;
+	char c;
+	while (s < t->end && !isNameEnd(*s))
+		s++;
+	if (s == t->end)
+		return failAt(t, s, "unclosed token");
+	if (!isXmlName(name, s))
+		return failAt(t, name, "not well-formed (invalid token)");
+	c = *s;
+	*s = '\0';
+	if (skipSpace(t, &s, c) != '>')
+		return failAt(t, s, "not well-formed (invalid token)");
+	if (!t->depth || strcmp(t->open[t->depth - 1], name))
+		return failAt(t, t->p, "mismatched tag");
+	t->p = s + 1;
+	if (!--t->depth)
+		t->closed = 1;
+	endElement(ctx, name);
+	return 1;
+}
+
+// Pass the text [s, e) to handleData(). Expat passes every line end on its
+// own, and handleData() drops a first one, so a line end at s is passed on
+// its own as well.
+static void passData(ParserContext* ctx, char* s, char* e) {
+	if (e - s > 1 && *s == '\n') {
+		handleData(ctx, s, 1);
+		s++;
+	}
+	if (e > s)
+		handleData(ctx, s, e - s);
+}
+
+// Parse the text up to the next markup and pass it to handleData()
+// Returns 0 to indicate failure
+static int parseText(InSitu* t, ParserContext* ctx) {
+	char* s = t->p;
+	char* e = (char*) memchr(s, '<', t->end - s);
+	char* cdataEnd;
+	if (!e)
+		e = t->end;
+	t->p = e;
+	if (!t->depth) {
+		for (; s < e; s++)
+			if (!isXmlSpace(*s))
+				return failAt(t, s, t->closed ? "junk after document element"
+						: "not well-formed (invalid token)");
+		return 1;
+	}
+	cdataEnd = (char*) memmem(s, e - s, "]]>", 3);
+	if (cdataEnd)
+		return failAt(t, cdataEnd, "not well-formed (invalid token)");
+	if (ctx->skipData)
+		return checkReferences(t, s, e);
+	e = decodeText(t, s, e, 0);
+	if (!e)
+		return 0;
+	passData(ctx, s, e);
+	return 1;
+}
+
+// Parse the CDATA section at t->p and pass its content to handleData(),
+// with line ends normalized as in text
+// Returns 0 to indicate failure
+static int parseCData(InSitu* t, ParserContext* ctx) {
+	char* s = t->p + 9;
+	char* e = (char*) memmem(s, t->end - s, "]]>", 3);
+	char* d;
+	char* r;
+	if (!e)
+		return failAt(t, t->p, "unclosed CDATA section");
+	if (!t->depth)
+		return failAt(t, t->p, t->closed ?
+				"junk after document element" : "syntax error");
+	t->p = e + 3;
+	if (ctx->skipData)
+		return 1;
+	for (r = d = s; r < e; d++) {
+		if (*r == '\r') {
+			*d = '\n';
+			r += r + 1 < e && r[1] == '\n' ? 2 : 1;
+		} else
+			*d = *r++;
+	}
+	passData(ctx, s, d);
+	return 1;
+}
+
+// Skip the comment at t->p, which must not contain "--" but at its end
+// Returns 0 to indicate failure
+static int skipComment(InSitu* t) {
+	char* s = t->p + 4;
+	char* e = (char*) memmem(s, t->end - s, "--", 2);
+	if (!e || e + 2 == t->end)
+		return failAt(t, t->p, "unclosed token");
+	if (e[2] != '>')
+		return failAt(t, e, "not well-formed (invalid token)");
+	t->p = e + 3;
+	return 1;
+}
+
+// Returns 1 if [s, e), the text of the XML declaration between "<?xml" and
+// "?>", has a version and then optionally an encoding and standalone, see
+// section 2.8 of the XML specification. The encoding was checked by
+// canParseInPlace().
+static int isXmlDeclaration(const char* s, const char* e) {
+	static const char* names[] = { "version", "encoding", "standalone" };
+	const char* name;
+	const char* value;
+	int next = 0, i, n;
+	char quote;
+	for (;;) {
+		if (s < e && !isXmlSpace(*s))
+			return 0;
+		while (s < e && isXmlSpace(*s))
+			s++;
+		if (s == e)
+			return next > 0;
+		name = s;
+		while (s < e && !isXmlSpace(*s) && *s != '=')
+			s++;
+		for (i = next; i < 3; i++)
+			if (strlen(names[i]) == (size_t) (s - name)
+					&& !memcmp(names[i], name, s - name))
+				break;
+		if (i == 3 || (next == 0 && i != 0))
+			return 0; // unknown, repeated, out of order, or no version
+		next = i + 1;
+		while (s < e && isXmlSpace(*s))
+			s++;
+		if (s == e || *s++ != '=')
+			return 0;
+		while (s < e && isXmlSpace(*s))
+			s++;
+		if (s == e || (*s != '"' && *s != '\''))
+			return 0;
+		quote = *s++;
+		value = s;
+		while (s < e && *s != quote)
+			s++;
+		if (s == e)
+			return 0;
+		n = s++ - value;
+		if (n == 0)
+			return 0;
+		if (i == 2 && !(n == 3 && !memcmp(value, "yes", 3))
+				&& !(n == 2 && !memcmp(value, "no", 2)))
+			return 0;
+	}
+}
+
+// Skip the processing instruction at t->p, which is the XML declaration if
+// its target is xml. The declaration is only allowed where the text starts.
+// Returns 0 to indicate failure
+static int skipPI(InSitu* t, int atStart) {
+	char* target = t->p + 2;
+	char* s = target;
+	char* e = (char*) memmem(s, t->end - s, "?>", 2);
+	if (!e)
+		return failAt(t, t->p, "unclosed token");
+	while (s < e && !isXmlSpace(*s))
+		s++;
+	// targets such as XML are reserved
+	if (!isXmlName(target, s) || (s - target == 3
+			&& !strncasecmp(target, "xml", 3) && memcmp(target, "xml", 3)))
+		return failAt(t, target, "not well-formed (invalid token)");
+	if (s - target == 3 && !memcmp(target, "xml", 3)) {
+		if (t->closed)
+			return failAt(t, t->p, "junk after document element");
+		if (!atStart)
+			return failAt(t, t->p,
+					"XML or text declaration not at start of entity");
+		if (!isXmlDeclaration(s, e))
+			return failAt(t, t->p, "XML declaration not well-formed");
+	}
+	t->p = e + 2;
+	return 1;
+}
+
+// Parse [t->p, t->end) with the callbacks of ctx
+// Returns 0 to indicate failure, see t->error and ctx->stopped
+static int tokenize(InSitu* t, ParserContext* ctx) {
+	char* start = t->p;
+	int ok = 1;
+	while (ok && !ctx->stopped && t->p < t->end) {
+		char* s = t->p;
+		size_t left = t->end - s;
+		t->token = s;
+		if (*s != '<')
+			ok = parseText(t, ctx);
+		else if (left > 1 && s[1] == '/')
+			ok = parseEndTag(t, ctx);
+		else if (left > 1 && s[1] == '?')
+			ok = skipPI(t, s == start);
+		else if (left >= 4 && !memcmp(s, "<!--", 4))
+			ok = skipComment(t);
+		else if (left >= 9 && !memcmp(s, "<![CDATA[", 9))
+			ok = parseCData(t, ctx);
+		else if (left > 1 && s[1] == '!')
+			ok = failAt(t, s, "not well-formed (invalid token)");
+		else
+			ok = parseStartTag(t, ctx);
+	}
+	if (ok && !ctx->stopped && !t->closed)
+		ok = failAt(t, t->end, "no element found");
+	if (ok && ctx->stopped)
+		ok = failAt(t, t->token, "parsing aborted");
+	return ok;
+}
+
+// Returns the line of p in the text of t, counting from 1
+static int lineAt(InSitu* t, const char* p) {
+	const char* s = t->text;
+	int line = 1;
+	while ((s = (const char*) memchr(s, '\n', p - s))) {
+		line++;
+		s++;
+	}
+	return line;
+}
+
+// Parse the UTF-8 text xml of the given size in place. The AST points into
+// xml, which is adopted by its arena, see arenaAdopt() for mapped.
+// xml is released right away if parsing fails.
 // Returns NULL to indicate failure
-// Otherwise, return the root node md of the AST.
-// The receiver must call freeElement(md) to release AST memory.
-ModelDescription* parse(const char* xmlPath) {
+static ModelDescription* parseInPlace(char* xml, size_t size, int mapped,
+		const char* name, const VarFilter* filter) {
+	ParserContext ctx;
+	InSitu t;
+	Arena* arena;
+	Arena* names;
+	ModelDescription* md = NULL;
+	memset(&t, 0, sizeof(InSitu));
+	t.text = t.p = xml;
+	t.end = xml + size;
+	if (size >= 3 && !memcmp(xml, "\xEF\xBB\xBF", 3))
+		t.p += 3; // byte order mark
+	t.maxAttr = 32;
+	t.attr = (const char**) malloc(t.maxAttr * sizeof(char*));
+	if (!t.attr)
+		printf("Out of memory\n");
+	else if (startParser(&ctx, size, filter, 1)) {
+		if (tokenize(&t, &ctx)) {
+			md = (ModelDescription*) finishAst(&ctx, &arena, &names);
+			arenaAdopt(arena, xml, size, mapped);
+			xml = NULL;
+			md = checkModel(md, arena, names, filter);
+		} else {
+			if (!ctx.quiet)
+				printf("Parse error in file %s at line %d:\n%s\n", name,
+						lineAt(&t, t.errorAt), t.error);
+			cleanup(&ctx); // releases the partial AST
+		}
+	}
+	free(t.open);
+	free(t.attr);
+	arenaRelease(xml, size, mapped); // NULL if adopted
+	return md;
+}
+
+// Parse the text xml, which is taken over, see parseInPlace()
+// Returns NULL to indicate failure
+static ModelDescription* parseOwned(char* xml, size_t size, int mapped,
+		const char* name, const VarFilter* filter) {
+	ModelDescription* md;
+	if (canParseInPlace(xml, size))
+		return parseInPlace(xml, size, mapped, name, filter);
+	md = parseBufferFiltered(xml, size, name, filter); // by expat
+	arenaRelease(xml, size, mapped);
+	return md;
+}
+
+// Returns a private, writable mapping of the file, NULL if it cannot be
+// mapped, e.g. when empty. Changes of the mapping do not reach the file.
+static char* mapFile(const char* xmlPath, size_t* size) {
+#ifndef _MSC_VER
+	struct stat st;
+	void* xml;
+	int fd = open(xmlPath, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	xml = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (xml == MAP_FAILED)
+		return NULL;
+	*size = st.st_size;
+	return (char*) xml;
+#else
+	return NULL;
+#endif
+}
+
+// Parse the file through a buffer of XMLBUFSIZE chars, see parseFiltered()
+static ModelDescription* parseFile(const char* xmlPath,
+		const VarFilter* filter) {
 	ModelDescription* md = NULL;
+	ParserContext ctx;
+	char text[XMLBUFSIZE];
 	FILE *file;
 	int done = 0;
-	stack = stackNew(100, 10);
-	if (!checkPointer(stack))
-		return NULL;  // failure
-	parser = XML_ParserCreate(NULL);
-	if (!checkPointer(parser))
-		return NULL;  // failure
-	XML_SetElementHandler(parser, startElement, endElement);
-	XML_SetCharacterDataHandler(parser, handleData);
 	file = fopen(xmlPath, "rb");
 	if (file == NULL) {
 		printf("Cannot open file '%s'\n", xmlPath);
-		XML_ParserFree(parser);
 		return NULL; // failure
 	}
-	while (!done) {
-		int n = fread(text, sizeof(char), XMLBUFSIZE, file);
-		if (n != XMLBUFSIZE)
-			done = 1;
-		if (!XML_Parse(parser, text, n, done)) {
-			printf("Parse error in file %s at line %d:\n%s\n", xmlPath,
-					(int) XML_GetCurrentLineNumber(parser),
-					XML_ErrorString(XML_GetErrorCode(parser)));
-			while (!stackIsEmpty(stack))
-				md = (ModelDescription*) stackPop(stack);
-			if (md)
-				freeElement(md);
-			cleanup(file);
-			return NULL; // failure
+	if (startParser(&ctx, 0, filter, 0)) {
+		while (!done) {
+			int n = fread(text, sizeof(char), XMLBUFSIZE, file);
+			if (n != XMLBUFSIZE)
+				done = 1;
+			if (!parseChunk(&ctx, xmlPath, text, n, done))
+				break; // failure
 		}
+		if (ctx.parser)
+			md = finishParser(&ctx);
 	}
-	md = (ModelDescription*) stackPop(stack);
-	assert(stackIsEmpty(stack));
-	cleanup(file);
-	//printElement(1, md); // debug
-	return validate(md); // success if all refs are valid
+	fclose(file);
+	return md;
+}
+
+// Returns NULL to indicate failure
+// Otherwise, return the root node md of the AST.
+// The receiver must call freeElement(md) to release AST memory.
+// The file is mapped and parsed in place if possible, see parseInPlace().
+ModelDescription* parse(const char* xmlPath) {
+	return parseFiltered(xmlPath, NULL);
 }
 
+// Same as parse(), builds only the variables selected by filter.
+// filter must remain valid until parsing is done, NULL selects all.
+ModelDescription* parseFiltered(const char* xmlPath, const VarFilter* filter) {
+	size_t size;
+	char* xml = mapFile(xmlPath, &size);
+	if (!xml)
+		return parseFile(xmlPath, filter); // reports the error
+	return parseOwned(xml, size, 1, xmlPath, filter);
+}
+
+// Same as parse(), for a model description that is already in memory,
+// e.g. inflated from the FMU archive. name is only used in error messages.
+ModelDescription* parseBuffer(const char* xml, size_t size, const char* name) {
+	return parseBufferFiltered(xml, size, name, NULL);
+}
+
+// Same as parseBuffer(), see parseFiltered()
+ModelDescription* parseBufferFiltered(const char* xml, size_t size,
+		const char* name, const VarFilter* filter) {
+	ParserContext ctx;
+	if (startParser(&ctx, size, filter, 0)
+			&& parseChunk(&ctx, name, xml, size, 1))
+		return finishParser(&ctx);
+	return NULL;
+}
+
+// ------------------------------------------------------------------------- 
+// Parallel parsing of the ModelVariables of large model descriptions
+
+#define PARSE_CHUNK_MIN (1 << 20) // least bytes of ModelVariables per thread
+
+#ifndef _MSC_VER
+
+// A share of the ScalarVariables, parsed by a thread of its own
+typedef struct {
+	const char* name;   // of the XML file, for error messages
+	const char* decl;   // the XML declaration of the file, may be empty
+	size_t declSize;
+	const char* xml;    // a sequence of ScalarVariable elements
+	size_t size;
+	ListElement* vars;  // the share as ModelVariables, NULL if parsing failed
+	Arena* arena;       // owns vars
+	Arena* names;       // owns the names of vars, see ParserContext
+} ParseTask;
+
+static int isTagEnd(char c) {
+	return isspace((unsigned char) c) || c == '>' || c == '/';
+}
+
+// Returns the first tag in [s, end) or NULL, e.g. "<ScalarVariable"
+static const char* findTag(const char* s, const char* end, const char* tag) {
+	size_t n = strlen(tag);
+	while (s < end && (s = (const char*) memmem(s, end - s, tag, n))) {
+		if (s + n < end && isTagEnd(s[n]))
+			return s;
+		s += n;
+	}
+	return NULL;
+}
+
+// Returns the last tag in [s, end) or NULL, see findTag()
+static const char* findLastTag(const char* s, const char* end,
+		const char* tag) {
+	size_t n = strlen(tag);
+	const char* p;
+	for (p = end - n - 1; p >= s; p--)
+		if (*p == '<' && !memcmp(p, tag, n) && isTagEnd(p[n]))
+			return p;
+	return NULL;
+}
+
+// Parse the share of t as content of a ModelVariables element.
+// The XML declaration comes first, so that the encoding is the same.
+// Errors are reported by the serial parse, see parseBufferParallel().
+static void* parseTask(void* task) {
+	static const char open[] = "<ModelVariables>";
+	static const char close[] = "</ModelVariables>";
+	ParseTask* t = (ParseTask*) task;
+	ParserContext ctx;
+	if (!startParser(&ctx, t->size, NULL, 0))
+		return NULL;
+	ctx.quiet = 1;
+	if (parseChunk(&ctx, t->name, t->decl, t->declSize, 0)
+			&& parseChunk(&ctx, t->name, open, sizeof(open) - 1, 0)
+			&& parseChunk(&ctx, t->name, t->xml, t->size, 0)
+			&& parseChunk(&ctx, t->name, close, sizeof(close) - 1, 1))
+		t->vars = (ListElement*) finishAst(&ctx, &t->arena, &t->names);
+	return NULL;
+}
+
+// Split [body, bodyEnd) into at most n shares at ScalarVariable tags
+// Returns the number of tasks
+static int splitVariables(ParseTask* tasks, int n, const char* body,
+		const char* bodyEnd) {
+	const char* start = body;
+	int i, k = 0;
+	for (i = 1; i <= n; i++) {
+		const char* split = i == n ? NULL :
+				findTag(body + (bodyEnd - body) / n * i, bodyEnd,
+						"<ScalarVariable");
+		if (!split)
+			split = bodyEnd;
+		if (split <= start)
+			continue; // the previous share took it
+		tasks[k].xml = start;
+		tasks[k].size = split - start;
+		k++;
+		start = split;
+	}
+	return k;
+}
+
+// Append the variables of all tasks to md in document order, their arenas
+// are merged into arena and names
+// Returns 0 to indicate failure
+static int mergeVariables(ModelDescription* md, Arena* arena, Arena* names,
+		ParseTask* tasks, int n) {
+	ScalarVariable** vars;
+	int count = 0, i, j;
+	for (i = 0; i < n; i++)
+		for (j = 0; tasks[i].vars->list[j]; j++)
+			count++;
+	vars = (ScalarVariable**) arenaAlloc(arena,
+			(count + 1) * sizeof(ScalarVariable*));
+	if (!vars) {
+		printf("Out of memory\n");
+		return 0;
+	}
+	for (count = 0, i = 0; i < n; i++) {
+		for (j = 0; tasks[i].vars->list[j]; j++)
+			vars[count++] = (ScalarVariable*) tasks[i].vars->list[j];
+		arenaMerge(arena, tasks[i].arena);
+		arenaMerge(names, tasks[i].names);
+		tasks[i].arena = NULL;
+		tasks[i].names = NULL;
+	}
+	md->modelVariables = vars;
+	return 1;
+}
+
+#endif
+
+// Returns the number of shares parseBufferParallel() splits the
+// ModelVariables of a model description of the given size into
+static int countShares(size_t size, int nThreads) {
+#ifndef _MSC_VER
+	if (nThreads <= 0)
+		nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (nThreads <= 0)
+		nThreads = 1;
+	return size / PARSE_CHUNK_MIN < (size_t) nThreads ?
+			size / PARSE_CHUNK_MIN : nThreads;
+}
+
+// Same as parseBuffer(), parses the ModelVariables on nThreads threads,
+// 0 for one per processor. The variables are split into shares of at least
+// PARSE_CHUNK_MIN bytes at ScalarVariable tags, each parsed by its own
+// parser, while the calling thread parses the rest of the model description.
+// The variables are merged in document order. The tags are found without
+// regard to comments, so a split may be wrong: if the rest or a share fails
+// to parse, the model description is parsed again serially, which also
+// reports the error. All parsers of the split are quiet for this reason.
+ModelDescription* parseBufferParallel(const char* xml, size_t size,
+		const char* name, int nThreads) {
+#ifndef _MSC_VER
+	const char* end = xml + size;
+	const char* body;    // content of the ModelVariables element
+	const char* bodyEnd;
+	const char* decl;
+	size_t declSize = 0;
+	ParseTask* tasks;
+	pthread_t* threads;
+	int* started;
+	ParserContext ctx;
+	ModelDescription* md = NULL;
+	Arena* arena = NULL;
+	Arena* names = NULL;
+	int n, i, failed = 0;
+	n = countShares(size, nThreads);
+	body = n > 1 ? findTag(xml, end, "<ModelVariables") : NULL;
+	body = body ? (const char*) memchr(body, '>', end - body) : NULL;
+	bodyEnd = body ? findLastTag(body, end, "</ModelVariables") : NULL;
+	if (!bodyEnd || body[-1] == '/')
+		return parseBuffer(xml, size, name);
+	body++;
+	decl = (const char*) memmem(xml, body - xml, "<?xml", 5);
+	if (decl && decl - xml <= 3) { // the declaration may follow a BOM
+		decl = (const char*) memmem(decl, body - decl, "?>", 2);
+		declSize = decl ? decl + 2 - xml : 0;
+	}
+	tasks = (ParseTask*) calloc(n, sizeof(ParseTask));
+	threads = (pthread_t*) calloc(n, sizeof(pthread_t));
+	started = (int*) calloc(n, sizeof(int));
+	if (!tasks || !threads || !started) {
+		free(tasks);
+		free(threads);
+		free(started);
+		return parseBuffer(xml, size, name);
+	}
+	n = splitVariables(tasks, n, body, bodyEnd);
+	for (i = 0; i < n; i++) {
+		tasks[i].name = name;
+		tasks[i].decl = xml;
+		tasks[i].declSize = declSize;
+		started[i] = !pthread_create(&threads[i], NULL, parseTask, &tasks[i]);
+		if (!started[i])
+			parseTask(&tasks[i]); // no thread available
+	}
+	// the model description with an empty ModelVariables element
+	if (startParser(&ctx, (body - xml) + (end - bodyEnd), NULL, 0)) {
+		ctx.quiet = 1;
+		if (parseChunk(&ctx, name, xml, body - xml, 0)
+				&& parseChunk(&ctx, name, bodyEnd, end - bodyEnd, 1))
+			md = (ModelDescription*) finishAst(&ctx, &arena, &names);
+	}
+	for (i = 0; i < n; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		failed |= !tasks[i].vars || tasks[i].vars->type != elm_ModelVariables;
+	}
+	if (md && !failed && !mergeVariables(md, arena, names, tasks, n))
+		md = NULL;
+	for (i = 0; i < n; i++) {
+		arenaFree(tasks[i].arena); // NULL if merged
+		arenaFree(tasks[i].names);
+	}
+	free(tasks);
+	free(threads);
+	free(started);
+	if (md && !failed)
+		return checkModel(md, arena, names, NULL);
+	arenaFree(arena);
+	arenaFree(names);
+	return parseBuffer(xml, size, name);
+#else
+	return parseBuffer(xml, size, name);
+#endif
+}
+
+// Parse the text xml, which is taken over. Large model descriptions
+// without a filter are parsed by parseBufferParallel(), which copies,
+// all others in place, see parseInPlace().
+static ModelDescription* parseTaken(char* xml, size_t size, int mapped,
+		const char* name, const VarFilter* filter, int nThreads) {
+	ModelDescription* md;
+	if (filter || countShares(size, nThreads) < 2)
+		return parseOwned(xml, size, mapped, name, filter);
+	md = parseBufferParallel(xml, size, name, nThreads);
+	arenaRelease(xml, size, mapped);
+	return md;
+}
+
+// Same as parseBufferFiltered(), for a text obtained from malloc that is
+// taken over and parsed in place: the AST points into xml, which is freed
+// with it, or right away if parsing fails. Without a filter, large model
+// descriptions are parsed on nThreads threads instead, see parseTaken().
+ModelDescription* parseBufferInSitu(char* xml, size_t size, const char* name,
+		const VarFilter* filter, int nThreads) {
+	return parseTaken(xml, size, 0, name, filter, nThreads);
+}
+
+// Same as parse(), see parseBufferParallel()
+ModelDescription* parseParallel(const char* xmlPath, int nThreads) {
+	size_t size;
+	char* xml = mapFile(xmlPath, &size);
+	if (!xml)
+		return parseFile(xmlPath, NULL); // reports the error
+	return parseTaken(xml, size, 1, xmlPath, NULL, nThreads);
+}